@@ -2,6 +2,7 @@
 #include "Containers/BlockBuffer.h"
 
 #include <algorithm>
+#include <bit>
 #include <cstring>
 
 #include "Profiling.h"
@@ -17,6 +18,7 @@ BlockBuffer::BlockBuffer()
 = default;
 
 BlockBuffer::BlockBuffer(const CtorArgs& args)
+    : NumaNode(args.NumaNode)
 {
     Blocks.reserve(args.Definitions.size());
     for (const BlockDefinition& definition : args.Definitions)
@@ -33,14 +35,26 @@ BlockBuffer::BlockBuffer(const CtorArgs& args)
     size_t totalSize = 0;
     for (Block& block : Blocks)
     {
-        block.Offset = totalSize;
-        totalSize += block.Definition.Size;
+        block.Offset = AlignBlockOffset(totalSize);
+        totalSize = block.Offset + block.Definition.Size;
     }
 
-    Data = MakeUnique<uint8[]>(totalSize);
-    Size = totalSize;
+    // Blocks are looked up by name on every GetBlock call so keep the lookup at most half full.
+    BlockLookup.resize(std::bit_ceil(Blocks.size() * 2 + 1), Index<uint32>::None);
+    uint32 lookupMask = (uint32)BlockLookup.size() - 1;
+    for (uint32 i = 0; i < (uint32)Blocks.size(); ++i)
+    {
+        uint32 slot = (hash32_t)Blocks[i].Definition.Name & lookupMask;
+        while (BlockLookup[slot] != Index<uint32>::None)
+        {
+            slot = (slot + 1) & lookupMask;
+        }
+        BlockLookup[slot] = i;
+    }
+
+    AllocateData(totalSize);
 
-    uint8* dataPtr = Data.get();
+    uint8* dataPtr = AlignedData;
     for (Block& block : Blocks)
     {
         block.Definition.Type->DefaultConstruct(dataPtr + block.Offset);
@@ -49,20 +63,26 @@ BlockBuffer::BlockBuffer(const CtorArgs& args)
 
 BlockBuffer::BlockBuffer(const BlockBuffer& other)
     : Blocks(other.Blocks)
-    , Size(other.Size)
+    , BlockLookup(other.BlockLookup)
+    , NumaNode(other.NumaNode)
 {
-    Data = MakeUnique<uint8[]>(other.Size);
-    std::memcpy(Data.get(), other.Data.get(), other.Size);
+    AllocateData(other.Size);
+    std::memcpy(AlignedData, other.AlignedData, other.Size);
 }
 
 BlockBuffer::BlockBuffer(BlockBuffer&& other) noexcept
     : Blocks(MoveTemp(other.Blocks))
+    , BlockLookup(MoveTemp(other.BlockLookup))
     , Data(MoveTemp(other.Data))
+    , AlignedData(other.AlignedData)
     , Size(other.Size)
+    , NumaNode(other.NumaNode)
 {
     other.Data = nullptr;
+    other.AlignedData = nullptr;
     other.Size = 0;
     other.Blocks.clear();
+    other.BlockLookup.clear();
 }
 
 BlockBuffer& BlockBuffer::operator=(const BlockBuffer& other)
@@ -74,12 +94,10 @@ BlockBuffer& BlockBuffer::operator=(const BlockBuffer& other)
 
     if (Size < other.Size)
     {
-        Data.release();
-        Data = MakeUnique<uint8[]>(other.Size);
-        Size = other.Size;
+        AllocateData(other.Size);
     }
 
-    std::memcpy(Data.get(), other.Data.get(), other.Size);
+    std::memcpy(AlignedData, other.AlignedData, other.Size);
 
     return *this;
 }
@@ -87,18 +105,21 @@ BlockBuffer& BlockBuffer::operator=(const BlockBuffer& other)
 BlockBuffer& BlockBuffer::operator=(BlockBuffer&& other) noexcept
 {
     Data = MoveTemp(other.Data);
+    AlignedData = other.AlignedData;
     Size = other.Size;
+    NumaNode = other.NumaNode;
+    other.AlignedData = nullptr;
     return *this;
 }
 
 uint8* BlockBuffer::GetData()
 {
-    return Data.get();
+    return AlignedData;
 }
 
 const uint8* BlockBuffer::GetData() const
 {
-    return Data.get();
+    return AlignedData;
 }
 
 size_t BlockBuffer::GetSize() const
@@ -106,6 +127,11 @@ size_t BlockBuffer::GetSize() const
     return Size;
 }
 
+uint32 BlockBuffer::GetNumaNode() const
+{
+    return NumaNode;
+}
+
 const TArray<BlockBuffer::Block>& BlockBuffer::GetBlocks() const
 {
     return Blocks;
@@ -113,42 +139,56 @@ const TArray<BlockBuffer::Block>& BlockBuffer::GetBlocks() const
 
 const BlockBuffer::BlockDefinition* BlockBuffer::GetBlockDefinition(const FName& name) const
 {
-    PHX_PROFILE_ZONE_SCOPED;
-
-    for (const Block& block : Blocks)
-    {
-        if (block.Definition.Name == name)
-        {
-            return &block.Definition;
-        }
-    }
-    return nullptr;
+    uint32 index = FindBlockIndex(name);
+    return index != Index<uint32>::None ? &Blocks[index].Definition : nullptr;
 }
 
 uint8* BlockBuffer::GetBlock(const FName& name)
 {
-    PHX_PROFILE_ZONE_SCOPED;
-
-    for (const Block& block : Blocks)
-    {
-        if (block.Definition.Name == name)
-        {
-            return Data.get() + block.Offset;
-        }
-    }
-    return nullptr;
+    uint32 index = FindBlockIndex(name);
+    return index != Index<uint32>::None ? AlignedData + Blocks[index].Offset : nullptr;
 }
 
 const uint8* BlockBuffer::GetBlock(const FName& name) const
 {
-    PHX_PROFILE_ZONE_SCOPED;
+    uint32 index = FindBlockIndex(name);
+    return index != Index<uint32>::None ? AlignedData + Blocks[index].Offset : nullptr;
+}
+
+uint32 BlockBuffer::FindBlockIndex(const FName& name) const
+{
+    if (BlockLookup.empty())
+    {
+        return Index<uint32>::None;
+    }
 
-    for (const Block& block : Blocks)
+    uint32 lookupMask = (uint32)BlockLookup.size() - 1;
+    for (uint32 slot = (hash32_t)name & lookupMask; BlockLookup[slot] != Index<uint32>::None; slot = (slot + 1) & lookupMask)
     {
-        if (block.Definition.Name == name)
+        uint32 index = BlockLookup[slot];
+        if (Blocks[index].Definition.Name == name)
         {
-            return Data.get() + block.Offset;
+            return index;
         }
     }
-    return nullptr;
+    return Index<uint32>::None;
+}
+
+void BlockBuffer::AllocateData(size_t size)
+{
+    size_t allocatedSize = size + PHX_CACHE_LINE_SIZE - 1;
+    Data = std::unique_ptr<uint8[], DataDeleter>((uint8*)Numa::Allocate(allocatedSize, NumaNode), DataDeleter{ allocatedSize, NumaNode });
+    std::memset(Data.get(), 0, allocatedSize);
+    AlignedData = reinterpret_cast<uint8*>((reinterpret_cast<uintptr_t>(Data.get()) + PHX_CACHE_LINE_SIZE - 1) & ~uintptr_t(PHX_CACHE_LINE_SIZE - 1));
+    Size = size;
+}
+
+void BlockBuffer::DataDeleter::operator()(uint8* data) const
+{
+    Numa::Free(data, AllocatedSize, NumaNode);
+}
+
+size_t BlockBuffer::AlignBlockOffset(size_t offset)
+{
+    return (offset + PHX_CACHE_LINE_SIZE - 1) & ~size_t(PHX_CACHE_LINE_SIZE - 1);
 }
@@ -0,0 +1,208 @@
+
+#include "Numa.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+#ifndef _WIN32
+#include <sched.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using namespace Phoenix;
+
+namespace NumaDetail
+{
+#ifndef _WIN32
+    // Parses a sysfs CPU list such as "0-7,16-23".
+    TArray<uint32> ParseCpuList(const std::string& list)
+    {
+        TArray<uint32> cpus;
+        std::stringstream stream(list);
+        std::string range;
+        while (std::getline(stream, range, ','))
+        {
+            if (range.empty() || range[0] == '\n')
+            {
+                continue;
+            }
+
+            size_t dash = range.find('-');
+            uint32 first = (uint32)std::stoul(range.substr(0, dash));
+            uint32 last = dash != std::string::npos ? (uint32)std::stoul(range.substr(dash + 1)) : first;
+            for (uint32 cpu = first; cpu <= last; ++cpu)
+            {
+                cpus.push_back(cpu);
+            }
+        }
+        return cpus;
+    }
+
+    std::string ReadNodeFile(uint32 node, const char* fileName)
+    {
+        std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/" + fileName);
+        std::string contents;
+        std::getline(file, contents);
+        return contents;
+    }
+
+    // Linux memory policy from <linux/mempolicy.h>, declared here so libnuma isn't needed.
+    constexpr int MPOL_PREFERRED = 1;
+#endif
+}
+
+uint32 Numa::GetNumNodes()
+{
+#ifdef _WIN32
+    ULONG highestNode = 0;
+    if (!GetNumaHighestNodeNumber(&highestNode))
+    {
+        return 1;
+    }
+    return (uint32)highestNode + 1;
+#else
+    uint32 numNodes = 0;
+    while (!NumaDetail::ReadNodeFile(numNodes, "cpulist").empty())
+    {
+        ++numNodes;
+    }
+    return numNodes > 0 ? numNodes : 1;
+#endif
+}
+
+TArray<uint32> Numa::GetNodeCpus(uint32 node)
+{
+    TArray<uint32> cpus;
+
+#ifdef _WIN32
+    GROUP_AFFINITY affinity = {};
+    if (GetNumaNodeProcessorMaskEx((USHORT)node, &affinity))
+    {
+        for (uint32 i = 0; i < sizeof(KAFFINITY) * 8; ++i)
+        {
+            if (affinity.Mask & (KAFFINITY(1) << i))
+            {
+                cpus.push_back(affinity.Group * uint32(sizeof(KAFFINITY) * 8) + i);
+            }
+        }
+    }
+#else
+    cpus = NumaDetail::ParseCpuList(NumaDetail::ReadNodeFile(node, "cpulist"));
+#endif
+
+    if (cpus.empty() && node == 0)
+    {
+        // No NUMA information, treat the whole machine as a single node
+        for (uint32 i = 0; i < std::thread::hardware_concurrency(); ++i)
+        {
+            cpus.push_back(i);
+        }
+    }
+
+    return cpus;
+}
+
+uint32 Numa::GetCpuNode(uint32 cpu)
+{
+    for (uint32 node = 0, numNodes = GetNumNodes(); node < numNodes; ++node)
+    {
+        TArray<uint32> cpus = GetNodeCpus(node);
+        if (std::ranges::find(cpus, cpu) != cpus.end())
+        {
+            return node;
+        }
+    }
+    return AnyNumaNode;
+}
+
+bool Numa::SetCurrentThreadAffinity(TSpan<const uint32> cpus)
+{
+    if (cpus.empty())
+    {
+        return false;
+    }
+
+#ifdef _WIN32
+    // A thread can only be bound to the processors of a single group, use the group of the first CPU.
+    constexpr uint32 groupSize = sizeof(KAFFINITY) * 8;
+    GROUP_AFFINITY affinity = {};
+    affinity.Group = (WORD)(cpus[0] / groupSize);
+    for (uint32 cpu : cpus)
+    {
+        if (cpu / groupSize == affinity.Group)
+        {
+            affinity.Mask |= KAFFINITY(1) << (cpu % groupSize);
+        }
+    }
+    return SetThreadGroupAffinity(GetCurrentThread(), &affinity, nullptr) != 0;
+#else
+    cpu_set_t cpuSet;
+    CPU_ZERO(&cpuSet);
+    for (uint32 cpu : cpus)
+    {
+        if (cpu < CPU_SETSIZE)
+        {
+            CPU_SET(cpu, &cpuSet);
+        }
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet) == 0;
+#endif
+}
+
+void* Numa::Allocate(size_t size, uint32 node)
+{
+    if (node == AnyNumaNode)
+    {
+        return ::operator new(size);
+    }
+
+#ifdef _WIN32
+    void* ptr = VirtualAllocExNuma(GetCurrentProcess(), nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE, node);
+    if (!ptr)
+    {
+        // The node doesn't exist or has no memory, Free still has to release it with VirtualFree
+        ptr = VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    }
+    PHX_ASSERT(ptr);
+    return ptr;
+#else
+    void* ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    PHX_ASSERT(ptr != MAP_FAILED);
+
+    // Pages are placed when first touched, prefer the node over the node of whichever thread touches them first.
+    // Failing to set the policy only costs locality so the result is ignored.
+    unsigned long nodeMask[4] = {};
+    if (node < sizeof(nodeMask) * 8)
+    {
+        nodeMask[node / (sizeof(unsigned long) * 8)] |= 1ul << (node % (sizeof(unsigned long) * 8));
+        (void)syscall(SYS_mbind, ptr, size, NumaDetail::MPOL_PREFERRED, nodeMask, sizeof(nodeMask) * 8, 0);
+    }
+    return ptr;
+#endif
+}
+
+void Numa::Free(void* ptr, size_t size, uint32 node)
+{
+    if (!ptr)
+    {
+        return;
+    }
+
+    if (node == AnyNumaNode)
+    {
+        ::operator delete(ptr);
+        return;
+    }
+
+#ifdef _WIN32
+    (void)size;
+    VirtualFree(ptr, 0, MEM_RELEASE);
+#else
+    munmap(ptr, size);
+#endif
+}
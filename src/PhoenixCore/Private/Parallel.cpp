@@ -3,11 +3,67 @@
 
 // xatomic.h is Windows-specific, using standard <atomic> and <thread> from Parallel.h
 
+#include <algorithm>
+
 #include "Platform.h"
 #include "Profiling.h"
 
 using namespace Phoenix;
 
+namespace ParallelDetail
+{
+    // The pool and index of the worker running on the current thread, if any.
+    thread_local const ThreadPool* tCurrentPool = nullptr;
+    thread_local uint32 tCurrentWorkerIndex = ThreadPool::AnyWorker;
+
+    // The number of times an idle worker looks for work before parking.
+    constexpr uint32 NumSpinsBeforeParking = 64;
+
+    // The number of free nodes a worker keeps before handing them back to the shared list.
+    constexpr uint32 MaxFreeNodesPerWorker = 256;
+
+    // The time range groups with a tracked cost aim to spend on each chunk.
+    constexpr float TargetRangeChunkNanoseconds = 50000.0f;
+
+    // How quickly the tracked cost of a range group follows new timings.
+    constexpr float RangeCostSmoothing = 0.25f;
+
+    // The size of the blocks task queues allocate scratch memory from.
+    constexpr size_t ScratchBlockSize = 64 * 1024;
+
+    // How long waits with a time limit sleep for when there is nothing to help with.
+    constexpr std::chrono::microseconds TimedWaitSleep(50);
+
+    // Waits until isDone returns true, running tasks from the pool in the meantime. Atomic waits can't time out
+    // so waits with a time limit sleep in short increments when there is nothing to run.
+    template <class TPredicate>
+    bool WaitUntil(ThreadPool* pool, std::chrono::milliseconds maxWaitTime, const TPredicate& isDone)
+    {
+        if (pool && maxWaitTime.count() <= 0)
+        {
+            pool->HelpUntil(isDone);
+            return true;
+        }
+
+        auto startTime = PHX_SYS_CLOCK_NOW();
+        while (!isDone())
+        {
+            if (pool && pool->TryRunTask())
+            {
+                continue;
+            }
+
+            if (maxWaitTime.count() > 0 && (PHX_SYS_CLOCK_NOW() - startTime) > maxWaitTime)
+            {
+                return false;
+            }
+
+            std::this_thread::sleep_for(TimedWaitSleep);
+        }
+        return true;
+    }
+}
+
 bool TaskHandle::IsCompleted() const
 {
     return bIsCompleted.load(std::memory_order_acquire);
@@ -15,19 +71,10 @@ bool TaskHandle::IsCompleted() const
 
 bool TaskHandle::WaitForCompleted(std::chrono::milliseconds maxWaitTime) const
 {
-    auto startTime = PHX_SYS_CLOCK_NOW();
-    while (!IsCompleted())
-    {
-        std::this_thread::yield();
-        if (maxWaitTime.count() > 0 && (PHX_SYS_CLOCK_NOW() - startTime) > maxWaitTime)
-        {
-            return false;
-        }
-    }
-    return true;
+    return ParallelDetail::WaitUntil(Pool, maxWaitTime, [this] { return IsCompleted(); });
 }
 
-void TaskHandle::OnCompleted(std::function<void()>&& fn)
+void TaskHandle::OnCompleted(TInlineFunction<void()>&& fn)
 {
     OnCompletedFunc = std::move(fn);
     if (IsCompleted())
@@ -50,6 +97,12 @@ Task::Task(TTaskFunc&& work)
 
 void Task::operator()() const
 {
+    if (!Handle)
+    {
+        WorkFunc();
+        return;
+    }
+
     Handle->bIsCompleted.store(false, std::memory_order_release);
     WorkFunc();
     Handle->bIsCompleted.store(true, std::memory_order_release);
@@ -61,61 +114,92 @@ void Task::operator()() const
 
 bool Task::WaitAll(const std::vector<TSharedPtr<TaskHandle>>& handles, std::chrono::milliseconds maxWaitTime)
 {
-    auto startTime = PHX_SYS_CLOCK_NOW();
-   
-    for (;;)
+    if (handles.empty())
     {
-        bool done = true;
-        for (const TSharedPtr<TaskHandle>& handle : handles)
-        {
-            if (!handle->IsCompleted())
-            {
-                done = false;
-                break;
-            }
-        }
-
-        if (done)
-        {
-            return true;
-        }
+        return true;
+    }
 
-        if (maxWaitTime.count() > 0 && (PHX_SYS_CLOCK_NOW() - startTime) > maxWaitTime)
-        {
-            return false;
-        }
+    return ParallelDetail::WaitUntil(handles[0]->Pool, maxWaitTime, [&handles]
+    {
+        return std::ranges::all_of(handles, [](const TSharedPtr<TaskHandle>& handle) { return handle->IsCompleted(); });
+    });
+}
 
-        std::this_thread::yield();
+bool Task::WaitAny(const std::vector<TSharedPtr<TaskHandle>>& handles, std::chrono::milliseconds maxWaitTime)
+{
+    if (handles.empty())
+    {
+        return true;
     }
+
+    return ParallelDetail::WaitUntil(handles[0]->Pool, maxWaitTime, [&handles]
+    {
+        return std::ranges::any_of(handles, [](const TSharedPtr<TaskHandle>& handle) { return handle->IsCompleted(); });
+    });
 }
 
-bool Task::WaitAny(const std::vector<TSharedPtr<TaskHandle>>& handles, std::chrono::milliseconds maxWaitTime)
+TaskCounter::TaskCounter(uint32 count)
+    : Count(count)
+{
+}
+
+void TaskCounter::Add(uint32 count)
 {
-    auto startTime = PHX_SYS_CLOCK_NOW();
+    Count.fetch_add(count, std::memory_order_acq_rel);
+}
 
-    for (;;)
+bool TaskCounter::Done()
+{
+    return Count.fetch_sub(1, std::memory_order_acq_rel) == 1;
+}
+
+bool TaskCounter::IsDone() const
+{
+    return Count.load(std::memory_order_acquire) == 0;
+}
+
+void TaskCounter::Wait(ThreadPool* threadPool) const
+{
+    if (threadPool)
     {
-        for (const TSharedPtr<TaskHandle>& handle : handles)
-        {
-            if (handle->IsCompleted())
-            {
-                return true;
-            }
-        }
+        threadPool->HelpUntil([this] { return IsDone(); });
+        return;
+    }
 
-        if (maxWaitTime.count() > 0 && (PHX_SYS_CLOCK_NOW() - startTime) > maxWaitTime)
-        {
-            return false;
-        }
+    // Tasks only run elsewhere when there is a pool
+    while (!IsDone())
+    {
+        std::this_thread::yield();
     }
 }
 
 ThreadPool::ThreadPool(std::string id, uint32 numWorkers, uint32 queueCapacity)
-    : Id(std::move(id))
-    , TaskQueue(queueCapacity)
-    , NumWorkers(numWorkers)
+    : ThreadPool(ThreadPoolOptions{ std::move(id), numWorkers, queueCapacity, {}, false, AnyNumaNode })
+{
+}
+
+ThreadPool::ThreadPool(const ThreadPoolOptions& options)
+    : Id(options.Id)
+    , NumWorkers(options.NumWorkers)
+    , Cpus(options.Cpus)
+    , bPinWorkers(options.bPinWorkers)
+    , NumaNode(options.NumaNode)
 {
+    uint32 numWorkers = options.NumWorkers;
+    uint32 queueCapacity = options.QueueCapacity;
     PHX_ASSERT(numWorkers > 0);
+
+    if (Cpus.empty() && NumaNode != AnyNumaNode)
+    {
+        Cpus = Numa::GetNodeCpus(NumaNode);
+    }
+
+    Workers.reserve(numWorkers);
+    for (uint32 i = 0; i < numWorkers; ++i)
+    {
+        Workers.push_back(MakeUnique<WorkerState>(queueCapacity));
+    }
+
     Threads.reserve(numWorkers);
     for (uint32 i = 0; i < numWorkers; ++i)
     {
@@ -126,6 +210,22 @@ ThreadPool::ThreadPool(std::string id, uint32 numWorkers, uint32 queueCapacity)
 ThreadPool::~ThreadPool()
 {
     Shutdown();
+
+    auto deleteNodes = [](TaskNode* node)
+    {
+        while (node)
+        {
+            TaskNode* next = node->Next;
+            delete node;
+            node = next;
+        }
+    };
+
+    for (const TUniquePtr<WorkerState>& worker : Workers)
+    {
+        deleteNodes(worker->FreeNodes);
+    }
+    deleteNodes(SharedFreeNodes);
 }
 
 uint32 ThreadPool::GetNumWorkers() const
@@ -133,11 +233,26 @@ uint32 ThreadPool::GetNumWorkers() const
     return NumWorkers;
 }
 
+uint32 ThreadPool::GetNumaNode() const
+{
+    return NumaNode;
+}
+
+uint32 ThreadPool::GetCurrentWorkerIndex() const
+{
+    return ParallelDetail::tCurrentPool == this ? ParallelDetail::tCurrentWorkerIndex : AnyWorker;
+}
+
 void ThreadPool::Shutdown()
 {
     bool expected = false;
     if (Done.compare_exchange_strong(expected, true))
     {
+        {
+            std::scoped_lock lock(ParkMutex);
+            ParkCondition.notify_all();
+        }
+
         for (std::thread& thread : Threads)
         {
             if (thread.joinable())
@@ -148,54 +263,174 @@ void ThreadPool::Shutdown()
     }
 }
 
-TSharedPtr<TaskHandle> ThreadPool::Submit(const Task& task)
+TSharedPtr<TaskHandle> ThreadPool::Submit(const Task& task, uint32 affinity)
 {
     TSharedPtr<TaskHandle> handle = MakeShared<TaskHandle>();
+    handle->Pool = this;
+
+    TaskNode* node = AllocateNode();
+    node->Task = task;
+    node->Task.Handle = handle;
+    node->Counter = nullptr;
+
+    Enqueue(node, affinity);
+
+    return handle;
+}
 
-    Task taskCopy = task;
-    taskCopy.Handle = handle;
+TSharedPtr<TaskHandle> ThreadPool::Submit(TTaskFunc&& work, uint32 affinity)
+{
+    return Submit(Task(std::move(work)), affinity);
+}
+
+void ThreadPool::Submit(Task&& task, TaskCounter* counter, uint32 affinity)
+{
+    TaskNode* node = AllocateNode();
+    node->Task = std::move(task);
+    node->Counter = counter;
 
-    uint32 attempts = 0;
-    while (!TaskQueue.TryEnqueue(taskCopy))
+    Enqueue(node, affinity);
+}
+
+void ThreadPool::Submit(TTaskFunc&& work, TaskCounter* counter, uint32 affinity)
+{
+    TaskNode* node = AllocateNode();
+    node->Task.WorkFunc = std::move(work);
+    node->Task.Handle = nullptr;
+    node->Counter = counter;
+
+    Enqueue(node, affinity);
+}
+
+void ThreadPool::Enqueue(TaskNode* node, uint32 affinity)
+{
+    NumUnfinishedTasks.fetch_add(1, std::memory_order_acq_rel);
+
+    uint32 workerIndex = GetCurrentWorkerIndex();
+    if (workerIndex != AnyWorker && (affinity == AnyWorker || affinity == workerIndex))
+    {
+        // Submitted from one of our workers so push onto its own deque.
+        Workers[workerIndex]->Deque.Push(node);
+    }
+    else
     {
-        ++attempts;
-        if (attempts < 16)
+        // Spread tasks submitted from other threads across the mailboxes of the workers.
+        uint32 mailboxIndex = affinity != AnyWorker ? affinity % NumWorkers : NextMailbox.fetch_add(1, std::memory_order_relaxed) % NumWorkers;
+
+        WorkerState& worker = *Workers[mailboxIndex];
+        std::scoped_lock lock(worker.MailboxMutex);
+        node->Next = nullptr;
+        if (worker.MailboxTail)
+        {
+            worker.MailboxTail->Next = node;
+        }
+        else
         {
-            for (uint32 i = 0; i < (1ULL << (attempts > 6 ? 6 : attempts)); ++i)
+            worker.MailboxHead = node;
+        }
+        worker.MailboxTail = node;
+        worker.NumMailboxTasks.fetch_add(1, std::memory_order_release);
+    }
+
+    NumQueuedTasks.fetch_add(1, std::memory_order_seq_cst);
+
+    WakeWorker();
+    NotifyWaiters();
+}
+
+ThreadPool::TaskNode* ThreadPool::AllocateNode()
+{
+    uint32 workerIndex = GetCurrentWorkerIndex();
+    if (workerIndex != AnyWorker)
+    {
+        WorkerState& worker = *Workers[workerIndex];
+        if (!worker.FreeNodes)
+        {
+            // Take everything from the shared list in one go rather than locking per node
+            std::scoped_lock lock(SharedFreeNodesMutex);
+            worker.FreeNodes = SharedFreeNodes;
+            SharedFreeNodes = nullptr;
+            worker.NumFreeNodes = 0;
+            for (TaskNode* node = worker.FreeNodes; node; node = node->Next)
             {
-                PHX_THREAD_PAUSE();
+                ++worker.NumFreeNodes;
             }
         }
-        else
+
+        if (TaskNode* node = worker.FreeNodes)
+        {
+            worker.FreeNodes = node->Next;
+            --worker.NumFreeNodes;
+            return node;
+        }
+    }
+    else
+    {
+        std::scoped_lock lock(SharedFreeNodesMutex);
+        if (TaskNode* node = SharedFreeNodes)
         {
-            std::this_thread::yield();
+            SharedFreeNodes = node->Next;
+            return node;
         }
     }
 
-    return handle;
+    return new TaskNode();
 }
 
-TSharedPtr<TaskHandle> ThreadPool::Submit(TTaskFunc&& work)
+void ThreadPool::FreeNode(TaskNode* node)
 {
-    return Submit(Task(std::move(work)));
+    // Release anything captured by the task now rather than when the node is reused
+    node->Task = Task();
+    node->Counter = nullptr;
+
+    uint32 workerIndex = GetCurrentWorkerIndex();
+    if (workerIndex != AnyWorker && Workers[workerIndex]->NumFreeNodes < ParallelDetail::MaxFreeNodesPerWorker)
+    {
+        WorkerState& worker = *Workers[workerIndex];
+        node->Next = worker.FreeNodes;
+        worker.FreeNodes = node;
+        ++worker.NumFreeNodes;
+        return;
+    }
+
+    // Tasks submitted from outside of the pool are freed on the workers so hand nodes back to those threads
+    std::scoped_lock lock(SharedFreeNodesMutex);
+    node->Next = SharedFreeNodes;
+    SharedFreeNodes = node;
+}
+
+bool ThreadPool::TryRunTask()
+{
+    TaskNode* node = FindTask(GetCurrentWorkerIndex());
+    if (!node)
+    {
+        return false;
+    }
+
+    RunTask(node);
+    return true;
 }
 
 bool ThreadPool::IsEmpty() const
 {
-    return TaskQueue.IsEmpty();
+    return NumQueuedTasks.load(std::memory_order_acquire) == 0;
 }
 
 bool ThreadPool::WaitIdle(std::chrono::milliseconds maxWaitTime) const
 {
-    auto startTime = PHX_SYS_CLOCK_NOW();
-    while (!IsEmpty() || ActiveWorkerCount.load(std::memory_order_acquire) != 0)
+    std::unique_lock lock(IdleMutex);
+
+    auto isIdle = [this]
     {
-        std::this_thread::yield();
-        if (maxWaitTime.count() > 0 && (PHX_SYS_CLOCK_NOW() - startTime) > maxWaitTime)
-        {
-            return false;
-        }
+        return NumUnfinishedTasks.load(std::memory_order_acquire) == 0;
+    };
+
+    if (maxWaitTime.count() > 0)
+    {
+        return IdleCondition.wait_for(lock, maxWaitTime, isIdle);
     }
+
+    IdleCondition.wait(lock, isIdle);
     return true;
 }
 
@@ -203,103 +438,211 @@ void ThreadPool::Worker(uint32 workerId)
 {
     PHX_PROFILE_SET_THREAD_NAME(Id.c_str(), (int32)workerId);
 
-    Task task;
+    ParallelDetail::tCurrentPool = this;
+    ParallelDetail::tCurrentWorkerIndex = workerId;
 
-    while (!Done.load(std::memory_order_acquire))
+    if (!Cpus.empty())
     {
-        if (TaskQueue.TryDequeue(task))
+        // Keeps the worker close to the memory of the worlds it updates. If the OS refuses the worker just runs
+        // wherever it is scheduled.
+        TSpan<const uint32> cpus = Cpus;
+        (void)Numa::SetCurrentThreadAffinity(bPinWorkers ? cpus.subspan(workerId % Cpus.size(), 1) : cpus);
+    }
+
+    for (;;)
+    {
+        TaskNode* node = FindTask(workerId);
+
+        // Look for work a few more times before parking since tasks tend to be submitted in bursts.
+        for (uint32 spins = 0; !node && spins < ParallelDetail::NumSpinsBeforeParking; ++spins)
         {
-            ActiveWorkerCount.fetch_add(1, std::memory_order_acq_rel);
-            task();
-            ActiveWorkerCount.fetch_sub(1, std::memory_order_acq_rel);
+            PHX_THREAD_PAUSE();
+            node = FindTask(workerId);
+        }
+
+        if (node)
+        {
+            RunTask(node);
             continue;
         }
 
-        SpinningWorkerCount.fetch_add(1, std::memory_order_relaxed);
+        std::unique_lock lock(ParkMutex);
 
-        // Spin with exponential backoff
-        uint32 spins = 0;
-        while (!Done.load(std::memory_order_acquire))
+        // Submit increments NumQueuedTasks before checking for parked workers so either we see the new task here
+        // or the submitting thread sees us parked and notifies us.
+        NumParkedWorkers.fetch_add(1, std::memory_order_seq_cst);
+        ParkCondition.wait(lock, [this]
         {
-            if (TaskQueue.TryDequeue(task))
-            {
-                ActiveWorkerCount.fetch_add(1, std::memory_order_acq_rel);
-                task();
-                ActiveWorkerCount.fetch_sub(1, std::memory_order_acq_rel);
-                break;
-            }
-            if (spins < 8)
-            {
-                for (uint32 i = 0; i < (1ULL << spins); ++i)
-                {
-                    PHX_THREAD_PAUSE();
-                }
-            }
-            else
-            {
-                std::this_thread::yield();
-            }
-            ++spins;
+            return Done.load(std::memory_order_acquire) || NumQueuedTasks.load(std::memory_order_seq_cst) != 0;
+        });
+        NumParkedWorkers.fetch_sub(1, std::memory_order_relaxed);
+
+        if (Done.load(std::memory_order_acquire) && NumQueuedTasks.load(std::memory_order_acquire) == 0)
+        {
+            break;
         }
+    }
 
-        SpinningWorkerCount.fetch_sub(1, std::memory_order_relaxed);
+    ParallelDetail::tCurrentPool = nullptr;
+    ParallelDetail::tCurrentWorkerIndex = AnyWorker;
+}
+
+ThreadPool::TaskNode* ThreadPool::FindTask(uint32 workerId)
+{
+    TaskNode* task = nullptr;
+
+    auto tryMailbox = [&](WorkerState& worker)
+    {
+        if (worker.NumMailboxTasks.load(std::memory_order_acquire) == 0)
+        {
+            return false;
+        }
+
+        std::scoped_lock lock(worker.MailboxMutex);
+        if (!worker.MailboxHead)
+        {
+            return false;
+        }
+
+        task = worker.MailboxHead;
+        worker.MailboxHead = task->Next;
+        if (!worker.MailboxHead)
+        {
+            worker.MailboxTail = nullptr;
+        }
+        task->Next = nullptr;
+        worker.NumMailboxTasks.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+    };
+
+    bool found = false;
+    uint32 firstVictim = 0;
+
+    if (workerId != AnyWorker)
+    {
+        WorkerState& self = *Workers[workerId];
+        found = self.Deque.Pop(task) || tryMailbox(self);
+        firstVictim = 1;
     }
 
-    while (TaskQueue.TryDequeue(task))
+    // Steal from the other workers starting with the next one so thieves spread out.
+    // Threads that aren't workers can only steal.
+    uint32 start = workerId != AnyWorker ? workerId : 0;
+    for (uint32 i = firstVictim; !found && i < NumWorkers; ++i)
     {
-        ActiveWorkerCount.fetch_add(1, std::memory_order_acq_rel);
-        task();
-        ActiveWorkerCount.fetch_sub(1, std::memory_order_acq_rel);
+        WorkerState& victim = *Workers[(start + i) % NumWorkers];
+        found = victim.Deque.Steal(task) || tryMailbox(victim);
     }
-}
 
-TMap<uint32, TSharedPtr<TaskQueue>> gTaskQueues;
-std::mutex gTaskQueueMutex;
+    if (!found)
+    {
+        return nullptr;
+    }
 
-TaskQueue::TaskQueue(uint32 id, Phoenix::ThreadPool* threadPool)
-    : Id (id)
-    , ThreadPool(threadPool)
+    NumQueuedTasks.fetch_sub(1, std::memory_order_acq_rel);
+    return task;
+}
+
+void ThreadPool::RunTask(TaskNode* node)
 {
-    Tasks.reserve(32);
+    node->Task();
+
+    // Recycle the node before signaling the counter so nothing captured by the task outlives the wait
+    TaskCounter* counter = node->Counter;
+    FreeNode(node);
+
+    if (counter)
+    {
+        counter->Done();
+    }
+
+    if (NumUnfinishedTasks.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    {
+        std::scoped_lock lock(IdleMutex);
+        IdleCondition.notify_all();
+    }
+
+    NotifyWaiters();
 }
 
-TSharedPtr<TaskQueue> TaskQueue::CreateTaskQueue(uint32 id)
+void ThreadPool::NotifyWaiters()
 {
-    std::scoped_lock lock(gTaskQueueMutex);
+    // Pairs with the fence in HelpUntil so either the waiter sees our changes or we see the waiter
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (NumWaiters.load(std::memory_order_relaxed) == 0)
+    {
+        return;
+    }
 
-    TSharedPtr<TaskQueue> taskQueue = MakeShared<TaskQueue>(id);
-    gTaskQueues[id] = taskQueue;
-    return taskQueue;
+    WaitEpoch.fetch_add(1, std::memory_order_release);
+    WaitEpoch.notify_all();
 }
 
-TSharedPtr<TaskQueue> TaskQueue::GetTaskQueue(uint32 id)
+void ThreadPool::WakeWorker()
 {
-    PHX_PROFILE_ZONE_SCOPED;
+    if (NumParkedWorkers.load(std::memory_order_seq_cst) == 0)
+    {
+        return;
+    }
 
-    std::scoped_lock lock(gTaskQueueMutex);
+    std::scoped_lock lock(ParkMutex);
+    ParkCondition.notify_one();
+}
 
-    auto iter = gTaskQueues.find(id);
-    if (iter != gTaskQueues.end())
+void TaskAccess::AddRead(const FName& resource)
+{
+    if (std::find(Reads.begin(), Reads.end(), resource) == Reads.end())
     {
-        return iter->second;
+        Reads.push_back(resource);
     }
+}
 
-    return nullptr;
+void TaskAccess::AddWrite(const FName& resource)
+{
+    if (std::find(Writes.begin(), Writes.end(), resource) == Writes.end())
+    {
+        Writes.push_back(resource);
+    }
 }
 
-bool TaskQueue::ReleaseTaskQueue(uint32 id)
+bool TaskAccess::IsEmpty() const
 {
-    std::scoped_lock lock(gTaskQueueMutex);
+    return Reads.empty() && Writes.empty();
+}
 
-    auto iter = gTaskQueues.find(id);
-    if (iter != gTaskQueues.end())
+bool TaskAccess::ConflictsWith(const TaskAccess& other) const
+{
+    auto contains = [](const TArray<FName>& resources, const FName& resource)
     {
-        gTaskQueues.erase(iter);
-        return true;
+        return std::find(resources.begin(), resources.end(), resource) != resources.end();
+    };
+
+    for (const FName& resource : Writes)
+    {
+        if (contains(other.Writes, resource) || contains(other.Reads, resource))
+        {
+            return true;
+        }
     }
+
+    for (const FName& resource : Reads)
+    {
+        if (contains(other.Writes, resource))
+        {
+            return true;
+        }
+    }
+
     return false;
 }
 
+TaskQueue::TaskQueue(uint32 id, Phoenix::ThreadPool* threadPool)
+    : Id (id)
+    , ThreadPool(threadPool)
+{
+    Groups.reserve(32);
+}
+
 uint32 TaskQueue::GetId() const
 {
     return Id;
@@ -307,24 +650,32 @@ uint32 TaskQueue::GetId() const
 
 ThreadPool* TaskQueue::GetThreadPool() const
 {
-    return ThreadPool;
+    return bUsesNumaThreadPool ? Phoenix::GetThreadPool(NumaNode) : ThreadPool;
 }
 
 uint32 TaskQueue::GetNumWorkers() const
 {
-    return ThreadPool ? ThreadPool->GetNumWorkers() : 0;
+    Phoenix::ThreadPool* threadPool = GetThreadPool();
+    return threadPool ? threadPool->GetNumWorkers() : 0;
+}
+
+void TaskQueue::UseNumaThreadPool(uint32 numaNode)
+{
+    bUsesNumaThreadPool = true;
+    NumaNode = numaNode;
+    ThreadPool = Phoenix::GetThreadPool(numaNode);
 }
 
 void TaskQueue::Enqueue(Task&& task)
 {
     PHX_PROFILE_ZONE_SCOPED;
 
-    if (Tasks.empty())
+    if (OpenGroup == InvalidGroup)
     {
-        Tasks.emplace_back();
+        AddGroup(std::vector<Task>());
     }
 
-    Tasks.back().push_back(std::move(task));
+    Groups[OpenGroup]->Tasks.push_back(std::move(task));
 }
 
 void TaskQueue::Enqueue(TTaskFunc&& work)
@@ -334,51 +685,408 @@ void TaskQueue::Enqueue(TTaskFunc&& work)
 
 void TaskQueue::Enqueue(std::vector<Task>&& tasks)
 {
-    Tasks.push_back(std::move(tasks));
+    AddGroup(std::move(tasks));
 }
 
 std::vector<Task>& TaskQueue::BeginGroup(uint32 size)
 {
-    Tasks.emplace_back().reserve(size);
-    return Tasks.back();
+    taskgroupid_t groupId = AddGroup(std::vector<Task>());
+    Groups[groupId]->Tasks.reserve(size);
+    return Groups[groupId]->Tasks;
 }
 
 void TaskQueue::EndGroup()
 {
-    Tasks.emplace_back();
+    // The next enqueued task starts a new group that waits for this one
+    OpenGroup = InvalidGroup;
+}
+
+taskgroupid_t TaskQueue::AddGroup(std::vector<Task>&& tasks)
+{
+    TUniquePtr<TaskGroup> group = AcquireGroup();
+    if (!tasks.empty())
+    {
+        group->Tasks = std::move(tasks);
+    }
+    taskgroupid_t groupId = AddGroup(std::move(group), {}, EGroupOrder::Barrier);
+    OpenGroup = groupId;
+    return groupId;
+}
+
+taskgroupid_t TaskQueue::AddGroup(std::vector<Task>&& tasks, std::initializer_list<taskgroupid_t> dependencies)
+{
+    TUniquePtr<TaskGroup> group = AcquireGroup();
+    group->Tasks = std::move(tasks);
+    return AddGroup(std::move(group), dependencies, EGroupOrder::Explicit);
+}
+
+taskgroupid_t TaskQueue::AddEmptyGroup(std::initializer_list<taskgroupid_t> dependencies)
+{
+    return AddGroup(AcquireGroup(), dependencies, EGroupOrder::Explicit);
+}
+
+taskgroupid_t TaskQueue::AddEmptyGroup(const TaskAccess& access)
+{
+    TUniquePtr<TaskGroup> group = AcquireGroup();
+    group->bHasAccess = true;
+    group->Access = access;
+    return AddGroup(std::move(group), {}, EGroupOrder::Access);
+}
+
+std::vector<Task>& TaskQueue::GetGroupTasks(taskgroupid_t groupId)
+{
+    PHX_ASSERT(groupId < Groups.size());
+    return Groups[groupId]->Tasks;
+}
+
+void* TaskQueue::AllocateScratch(size_t size, size_t alignment)
+{
+    for (;;)
+    {
+        if (CurrentScratchBlock < ScratchBlocks.size())
+        {
+            ScratchBlock& block = ScratchBlocks[CurrentScratchBlock];
+            uintptr_t base = reinterpret_cast<uintptr_t>(block.Data.get());
+            size_t offset = ((base + ScratchOffset + alignment - 1) & ~uintptr_t(alignment - 1)) - base;
+            if (offset + size <= block.Size)
+            {
+                ScratchOffset = offset + size;
+                return block.Data.get() + offset;
+            }
+
+            ++CurrentScratchBlock;
+            ScratchOffset = 0;
+            continue;
+        }
+
+        size_t blockSize = size + alignment > ParallelDetail::ScratchBlockSize ? size + alignment : ParallelDetail::ScratchBlockSize;
+        ScratchBlocks.push_back({ MakeUnique<uint8[]>(blockSize), blockSize });
+    }
+}
+
+taskgroupid_t TaskQueue::AddRangeGroup(TRangeCountFunc&& getCount, uint32 minRange, TRangeFunc&& func)
+{
+    TUniquePtr<TaskGroup> group = AcquireGroup();
+    group->GetRangeCount = std::move(getCount);
+    group->RangeFunc = std::move(func);
+    group->MinRange = minRange;
+    return AddGroup(std::move(group), {}, EGroupOrder::Barrier);
+}
+
+taskgroupid_t TaskQueue::AddRangeGroup(
+    TRangeCountFunc&& getCount,
+    uint32 minRange,
+    TRangeFunc&& func,
+    std::initializer_list<taskgroupid_t> dependencies)
+{
+    TUniquePtr<TaskGroup> group = AcquireGroup();
+    group->GetRangeCount = std::move(getCount);
+    group->RangeFunc = std::move(func);
+    group->MinRange = minRange;
+    return AddGroup(std::move(group), dependencies, EGroupOrder::Explicit);
+}
+
+taskgroupid_t TaskQueue::AddGroup(std::vector<Task>&& tasks, const TaskAccess& access)
+{
+    TUniquePtr<TaskGroup> group = AcquireGroup();
+    group->Tasks = std::move(tasks);
+    group->bHasAccess = true;
+    group->Access = access;
+    return AddGroup(std::move(group), {}, EGroupOrder::Access);
+}
+
+taskgroupid_t TaskQueue::AddRangeGroup(TRangeCountFunc&& getCount, uint32 minRange, TRangeFunc&& func, const TaskAccess& access)
+{
+    TUniquePtr<TaskGroup> group = AcquireGroup();
+    group->GetRangeCount = std::move(getCount);
+    group->RangeFunc = std::move(func);
+    group->MinRange = minRange;
+    group->bHasAccess = true;
+    group->Access = access;
+    return AddGroup(std::move(group), {}, EGroupOrder::Access);
+}
+
+void TaskQueue::TrackRangeCost(taskgroupid_t groupId, hash32_t costKey)
+{
+    PHX_ASSERT(groupId < Groups.size() && Groups[groupId]->RangeFunc);
+    if (groupId < Groups.size())
+    {
+        Groups[groupId]->Cost = &RangeCosts[costKey];
+    }
+}
+
+taskgroupid_t TaskQueue::GetLastGroup() const
+{
+    return Groups.empty() ? InvalidGroup : taskgroupid_t(Groups.size() - 1);
+}
+
+TUniquePtr<TaskQueue::TaskGroup> TaskQueue::AcquireGroup()
+{
+    if (FreeGroups.empty())
+    {
+        return MakeUnique<TaskGroup>();
+    }
+
+    TUniquePtr<TaskGroup> group = std::move(FreeGroups.back());
+    FreeGroups.pop_back();
+    return group;
+}
+
+taskgroupid_t TaskQueue::AddGroup(TUniquePtr<TaskGroup>&& group, std::initializer_list<taskgroupid_t> dependencies, EGroupOrder order)
+{
+    taskgroupid_t groupId = taskgroupid_t(Groups.size());
+
+    auto addDependency = [&](taskgroupid_t dependency)
+    {
+        PHX_ASSERT(dependency < groupId);
+        if (dependency < groupId)
+        {
+            Groups[dependency]->Successors.push_back(groupId);
+            ++group->NumDependencies;
+        }
+    };
+
+    switch (order)
+    {
+    case EGroupOrder::Barrier:
+        for (taskgroupid_t dependency : BarrierDependencies)
+        {
+            addDependency(dependency);
+        }
+        BarrierDependencies.clear();
+        break;
+    case EGroupOrder::Explicit:
+        for (taskgroupid_t dependency : dependencies)
+        {
+            addDependency(dependency);
+        }
+        break;
+    case EGroupOrder::Access:
+        // Groups without an access set could touch anything so they are always waited on
+        for (taskgroupid_t dependency : BarrierDependencies)
+        {
+            const TaskGroup& other = *Groups[dependency];
+            if (!other.bHasAccess || other.Access.ConflictsWith(group->Access))
+            {
+                addDependency(dependency);
+            }
+        }
+        break;
+    }
+
+    // Explicit groups can't be appended to by Enqueue since they may run alongside the barrier groups
+    OpenGroup = InvalidGroup;
+    BarrierDependencies.push_back(groupId);
+    Groups.push_back(std::move(group));
+    return groupId;
 }
 
 void TaskQueue::Flush()
 {
     PHX_PROFILE_ZONE_SCOPED;
 
+    if (Groups.empty())
+    {
+        Complete();
+        return;
+    }
+
+    // The global pools may have been replaced since the last flush
+    ThreadPool = GetThreadPool();
+
     bIsCompleted.store(false, std::memory_order_release);
 
-    for (const std::vector<Task>& tasks : Tasks)
+    RootGroups.clear();
+    for (taskgroupid_t i = 0; i < Groups.size(); ++i)
     {
-        std::vector<TSharedPtr<TaskHandle>> handles;
-        handles.reserve(tasks.size());
-        
-        for (const Task& task : tasks)
+        TaskGroup& group = *Groups[i];
+        group.NumPendingDependencies.store(group.NumDependencies, std::memory_order_relaxed);
+        if (group.NumDependencies == 0)
         {
-            handles.push_back(ThreadPool->Submit(task));
+            RootGroups.push_back(i);
         }
+    }
+
+    NumRemainingGroups.store(uint32(Groups.size()), std::memory_order_release);
 
-        Task::WaitAll(handles);
+    for (taskgroupid_t groupId : RootGroups)
+    {
+        StartGroup(groupId);
+    }
+
+    if (ThreadPool)
+    {
+        // The flushing thread runs tasks of the queue too instead of sitting idle. This also keeps workers that
+        // flush from a task, e.g. while worlds are updated in parallel, from waiting on tasks that never run.
+        ThreadPool->HelpUntil([this]
+        {
+            return NumRemainingGroups.load(std::memory_order_acquire) == 0;
+        });
     }
 
+    // Without a pool every group has already run inline
+    PHX_ASSERT(NumRemainingGroups.load(std::memory_order_acquire) == 0);
+
     Complete();
 }
 
+void TaskQueue::StartGroup(taskgroupid_t groupId)
+{
+    TaskGroup& group = *Groups[groupId];
+
+    // Range groups are only split once the groups they depend on have completed so the count can be up to date
+    if (group.RangeFunc)
+    {
+        uint32 total = group.GetRangeCount ? group.GetRangeCount() : 0;
+        uint32 numWorkers = GetNumWorkers() > 0 ? GetNumWorkers() : 1;
+
+        // Use chunks that took roughly the target time in previous flushes, but never smaller than the min range
+        uint32 grain = group.MinRange > 0 ? group.MinRange : 1;
+        float nanosecondsPerItem = group.Cost ? group.Cost->NanosecondsPerItem.load(std::memory_order_relaxed) : 0.0f;
+        if (nanosecondsPerItem > 0.0f)
+        {
+            float costGrain = ParallelDetail::TargetRangeChunkNanoseconds / nanosecondsPerItem;
+            grain = costGrain > float(grain) ? (costGrain < float(total) ? uint32(costGrain) : total) : grain;
+        }
+
+        group.RangeTotal = total;
+        group.RangeGrain = grain;
+        group.NextRangeStart.store(0, std::memory_order_relaxed);
+        group.RangeBusyNanoseconds.store(0, std::memory_order_relaxed);
+
+        // Each task keeps claiming chunks until the range is exhausted so no more tasks than workers are needed.
+        uint32 numChunks = total > 0 ? (total + grain - 1) / grain : 0;
+        uint32 numRangeTasks = numChunks < numWorkers ? numChunks : numWorkers;
+
+        group.Tasks.clear();
+        group.Tasks.reserve(numRangeTasks);
+        for (uint32 i = 0; i < numRangeTasks; ++i)
+        {
+            group.Tasks.emplace_back([this, groupId] { RunRangeChunks(groupId); });
+        }
+    }
+
+    uint32 numTasks = uint32(group.Tasks.size());
+    if (numTasks == 0)
+    {
+        CompleteGroup(groupId);
+        return;
+    }
+
+    // No thread pool? Just run synchronously.
+    if (!ThreadPool)
+    {
+        for (const Task& task : group.Tasks)
+        {
+            if (task.WorkFunc)
+            {
+                task.WorkFunc();
+            }
+        }
+        CompleteGroup(groupId);
+        return;
+    }
+
+    group.PendingTasks.Add(numTasks);
+
+    for (uint32 i = 0; i < numTasks; ++i)
+    {
+        ThreadPool->Submit([this, groupId, i]
+        {
+            TaskGroup& taskGroup = *Groups[groupId];
+            if (const TTaskFunc& workFunc = taskGroup.Tasks[i].WorkFunc)
+            {
+                workFunc();
+            }
+
+            if (taskGroup.PendingTasks.Done())
+            {
+                CompleteGroup(groupId);
+            }
+        }, nullptr);
+    }
+}
+
+void TaskQueue::RunRangeChunks(taskgroupid_t groupId)
+{
+    TaskGroup& group = *Groups[groupId];
+    uint32 numWorkers = GetNumWorkers() > 0 ? GetNumWorkers() : 1;
+
+    auto startTime = std::chrono::steady_clock::now();
+
+    uint32 start = 0;
+    uint32 len = 0;
+    while (ClaimGuidedRange(group.NextRangeStart, group.RangeTotal, group.RangeGrain, numWorkers, start, len))
+    {
+        group.RangeFunc(start, len);
+    }
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - startTime);
+    group.RangeBusyNanoseconds.fetch_add(uint64(elapsed.count()), std::memory_order_relaxed);
+}
+
+void TaskQueue::CompleteGroup(taskgroupid_t groupId)
+{
+    TaskGroup& group = *Groups[groupId];
+    if (group.Cost && group.RangeTotal > 0)
+    {
+        // Smooth the cost over several flushes so one slow step doesn't throw off the chunk sizes
+        float sample = float(group.RangeBusyNanoseconds.load(std::memory_order_relaxed)) / float(group.RangeTotal);
+        float average = group.Cost->NanosecondsPerItem.load(std::memory_order_relaxed);
+        average = average > 0.0f ? average + (sample - average) * ParallelDetail::RangeCostSmoothing : sample;
+        group.Cost->NanosecondsPerItem.store(average, std::memory_order_relaxed);
+    }
+
+    for (taskgroupid_t successor : group.Successors)
+    {
+        if (Groups[successor]->NumPendingDependencies.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            StartGroup(successor);
+        }
+    }
+
+    // The thread flushing the queue is woken by the pool once the task running this has finished
+    NumRemainingGroups.fetch_sub(1, std::memory_order_acq_rel);
+}
+
 void TaskQueue::Complete()
 {
-    Tasks.clear();
-    CurrTaskIndex = 0;
+    for (auto itr = ScratchDestructors.rbegin(); itr != ScratchDestructors.rend(); ++itr)
+    {
+        itr->first(itr->second);
+    }
+    ScratchDestructors.clear();
+    CurrentScratchBlock = 0;
+    ScratchOffset = 0;
+
+    for (TUniquePtr<TaskGroup>& group : Groups)
+    {
+        group->Tasks.clear();
+        group->Successors.clear();
+        group->NumDependencies = 0;
+        group->GetRangeCount = nullptr;
+        group->RangeFunc = nullptr;
+        group->MinRange = 1;
+        group->RangeTotal = 0;
+        group->Cost = nullptr;
+        group->bHasAccess = false;
+        group->Access.Reads.clear();
+        group->Access.Writes.clear();
+        FreeGroups.push_back(std::move(group));
+    }
+
+    Groups.clear();
+    BarrierDependencies.clear();
+    OpenGroup = InvalidGroup;
     bIsCompleted.store(true, std::memory_order_release);
 }
 
 TUniquePtr<ThreadPool> gThreadPool;
 
+// Pools created by SetNumaThreadPools indexed by NUMA node. The pool of the first node is gThreadPool so its entry
+// is left empty.
+TArray<TUniquePtr<ThreadPool>> gNumaThreadPools;
+
 bool Phoenix::HasThreadPool()
 {
     return gThreadPool != nullptr;
@@ -391,10 +1099,58 @@ ThreadPool* Phoenix::GetThreadPool()
 
 void Phoenix::SetThreadPool(const std::string& id, uint32 numWorkers, uint32 queueCapacity)
 {
+    gNumaThreadPools.clear();
     gThreadPool = MakeUnique<ThreadPool>(id, numWorkers, queueCapacity);
 }
 
+void Phoenix::SetThreadPool(const ThreadPoolOptions& options)
+{
+    gNumaThreadPools.clear();
+    gThreadPool = MakeUnique<ThreadPool>(options);
+}
+
+void Phoenix::SetNumaThreadPools(const std::string& id, uint32 numWorkersPerNode, uint32 queueCapacity)
+{
+    DestroyThreadPool();
+
+    uint32 numNodes = Numa::GetNumNodes();
+    for (uint32 node = 0; node < numNodes; ++node)
+    {
+        ThreadPoolOptions options;
+        options.Id = numNodes > 1 ? id + std::to_string(node) : id;
+        options.NumWorkers = numWorkersPerNode;
+        options.QueueCapacity = queueCapacity;
+        options.NumaNode = node;
+
+        if (node == 0)
+        {
+            gThreadPool = MakeUnique<ThreadPool>(options);
+            gNumaThreadPools.emplace_back();
+        }
+        else
+        {
+            gNumaThreadPools.push_back(MakeUnique<ThreadPool>(options));
+        }
+    }
+}
+
+ThreadPool* Phoenix::GetThreadPool(uint32 numaNode)
+{
+    if (numaNode > 0 && numaNode < gNumaThreadPools.size())
+    {
+        return gNumaThreadPools[numaNode].get();
+    }
+    return gThreadPool.get();
+}
+
+uint32 Phoenix::GetNumNumaThreadPools()
+{
+    return (uint32)gNumaThreadPools.size();
+}
+
 void Phoenix::DestroyThreadPool()
 {
-    (void)gThreadPool.release();
+    // Shuts the pools down and joins their workers
+    gNumaThreadPools.clear();
+    gThreadPool.reset();
 }
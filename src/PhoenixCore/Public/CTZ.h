@@ -3,6 +3,8 @@
 
 #include <bit>
 
+#include "Platform.h"
+
 namespace Phoenix
 {
     template <class T>
@@ -1,6 +1,7 @@
 
 #pragma once
 
+#include "Numa.h"
 #include "Platform.h"
 #include "Reflection.h"
 
@@ -35,6 +36,9 @@ namespace Phoenix
             }
 
             TArray<BlockDefinition> Definitions;
+
+            // The NUMA node to allocate the data buffer on.
+            uint32 NumaNode = AnyNumaNode;
         };
 
         struct Block
@@ -58,6 +62,8 @@ namespace Phoenix
 
         size_t GetSize() const;
 
+        uint32 GetNumaNode() const;
+
         const TArray<Block>& GetBlocks() const;
 
         const BlockDefinition* GetBlockDefinition(const FName& name) const;
@@ -103,9 +109,33 @@ namespace Phoenix
 
     private:
 
+        // Gets the index of the block with the given name or -1 if there is no such block.
+        uint32 FindBlockIndex(const FName& name) const;
+
+        // Allocates the data buffer with enough padding to align the start of the buffer to a cache line.
+        void AllocateData(size_t size);
+
+        // Every block is aligned to a cache line relative to the start of the aligned data buffer.
+        static size_t AlignBlockOffset(size_t offset);
+
+        // Returns the data buffer to the NUMA node it was allocated from.
+        struct PHOENIXCORE_API DataDeleter
+        {
+            void operator()(uint8* data) const;
+
+            // No default member initializers, the deleter needs to be default constructible within BlockBuffer.
+            size_t AllocatedSize;
+            uint32 NumaNode;
+        };
+
         TArray<Block> Blocks;
-        TUniquePtr<uint8[]> Data = nullptr;
+
+        // Open-addressed lookup of block name hash to block index.
+        TArray<uint32> BlockLookup;
+        std::unique_ptr<uint8[], DataDeleter> Data;
+        uint8* AlignedData = nullptr;
         size_t Size = 0;
+        uint32 NumaNode = AnyNumaNode;
     };
 
     struct PHOENIXCORE_API BufferBlockBase
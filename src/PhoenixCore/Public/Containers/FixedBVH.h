@@ -1,7 +1,11 @@
 
 #pragma once
 
+#include <atomic>
+#include <type_traits>
+
 #include "CTZ.h"
+#include "Parallel.h"
 #include "Platform.h"
 #include "Containers/FixedArray.h"
 #include "FixedPoint/FixedVector.h"
@@ -9,10 +13,24 @@
 
 namespace Phoenix
 {
+    // A linear bounding volume hierarchy built from items sorted by their morton codes.
+    // See "Maximizing Parallelism in the Construction of BVHs, Octrees, and k-d Trees" (Karras)
+    //
+    // For n items the internal nodes are stored at [0, n - 1) and the leaves at [n - 1, 2n - 1) in the order of the
+    // items, so N must be at least 2n - 1. Every internal node can be built independently which lets the build run
+    // in parallel. Bounds are calculated bottom-up and can be refit without rebuilding when the items move but
+    // keep roughly the same order.
     template <class T, uint32 N, class TVec = Vec2, class TIdx = uint16>
     struct TFixedBVH
     {
+        static_assert(std::is_trivially_copyable_v<T>, "Nodes are copied with the buffer they live in.");
+        static_assert(N - 1 < Index<TIdx>::None, "TIdx is too small to index every node.");
+
         using TBox = TFixedBox<TVec>;
+        using TVecComp = typename TVec::ComponentT;
+
+        // Deep enough for 64-bit codes plus the index bits used to split duplicate codes.
+        static constexpr uint32 MaxDepth = 64 + (sizeof(TIdx) << 3);
 
         enum class ENodeType : uint8
         {
@@ -37,91 +55,387 @@ namespace Phoenix
             union
             {
                 Leaf LeafData;      // Renamed to avoid conflict with struct name
-                Parent ParentData;  // Renamed to avoid conflict with struct name
+                Parent ParentData = {};  // Renamed to avoid conflict with struct name
             };
 
             TBox Bounds;
+            TIdx ParentIndex = Index<TIdx>::None;
             ENodeType Type = ENodeType::None;
+
+            // The number of children that have been refit. Only touched while refitting.
+            uint32 RefitVisits = 0;
         };
 
-        TIdx Insert(const TBox& bounds, const T& value)
+        // Builds the tree from a list sorted by the codes returned by codeFunc. boundsFunc and valueFunc return the
+        // bounds and the value of each item. Returns false if there are too many items.
+        template <class TList, class TCodeFunc, class TBoundsFunc, class TValueFunc>
+        bool Build(const TList& sorted, const TCodeFunc& codeFunc, const TBoundsFunc& boundsFunc, const TValueFunc& valueFunc)
         {
-            // uint64 mortonCode = bounds.GetCenter();
-            // CommonPrefix()
-            return Index<TIdx>::None;
+            return BuildImpl(
+                [](uint32 total, const auto& job) { job(0, total); },
+                sorted, codeFunc, boundsFunc, valueFunc);
         }
 
-        template <class TList, class TBoundsFunc, class TValueFunc>
-        TIdx InsertRange(
-            const TList& list,
-            TIdx begin,
-            TIdx end,
-            const TBoundsFunc& boundsFunc,
-            const TValueFunc& valueFunc)
+        // Same as Build but splits the work across the workers of the pool.
+        template <class TThreadPool, class TList, class TCodeFunc, class TBoundsFunc, class TValueFunc>
+        bool Build(TThreadPool& pool, const TList& sorted, const TCodeFunc& codeFunc, const TBoundsFunc& boundsFunc, const TValueFunc& valueFunc)
+        {
+            return BuildImpl(
+                [&](uint32 total, const auto& job) { ParallelRange(pool, total, ParallelGrain, job); },
+                sorted, codeFunc, boundsFunc, valueFunc);
+        }
+
+        // Updates the bounds of the leaves from their values and propagates them up to the root.
+        template <class TBoundsFunc>
+        void Refit(const TBoundsFunc& boundsFunc)
+        {
+            RefitImpl([](uint32 total, const auto& job) { job(0, total); }, boundsFunc);
+        }
+
+        // Same as Refit but splits the work across the workers of the pool.
+        template <class TThreadPool, class TBoundsFunc>
+        void Refit(TThreadPool& pool, const TBoundsFunc& boundsFunc)
+        {
+            RefitImpl([&](uint32 total, const auto& job) { ParallelRange(pool, total, ParallelGrain, job); }, boundsFunc);
+        }
+
+        // Calls func with the value of each leaf whose bounds overlap the box.
+        // Stops early if func returns true.
+        template <class TFunc>
+        void QueryBox(const TBox& box, const TFunc& func) const
+        {
+            Traverse([&](const TBox& bounds) { return bounds.Overlaps(box); }, func);
+        }
+
+        // Calls func with the value of each leaf whose bounds overlap the circle.
+        // Stops early if func returns true.
+        template <class TFunc>
+        void QueryCircle(const TVec& center, TVecComp radius, const TFunc& func) const
+        {
+            Traverse(
+                [&](const TBox& bounds)
+                {
+                    TVec closest = { Phoenix::Min(Phoenix::Max(center.X, bounds.Min.X), bounds.Max.X),
+                                     Phoenix::Min(Phoenix::Max(center.Y, bounds.Min.Y), bounds.Max.Y) };
+                    return TVec::Distance(closest, center) <= radius;
+                },
+                func);
+        }
+
+        // Calls func with the value of each leaf whose bounds the segment from start to end passes through.
+        // Leaves are not visited in the order the segment hits them. Stops early if func returns true.
+        template <class TFunc>
+        void Raycast(const TVec& start, const TVec& end, const TFunc& func) const
         {
-            return Index<TIdx>::None;
-            // if (begin == end)
-            // {
-            //     return AllocateLeafNode(boundsFunc(list, begin), valueFunc(list, begin));
-            // }
-            //
-            // TIdx m = GetSplitPos(begin, end);
-            // TIdx left = InsertRange(list, begin, m - 1);
-            // TIdx right = InsertRange(list, m, end);
-            // if (left == Index<TIdx>::None || right == Index<TIdx>::None)
-            // {
-            //     return Index<TIdx>::None;
-            // }
-            //
-            // TBox bounds = TBox::Union(Nodes[left].Bounds, Nodes[right].Bounds);
-            // return AllocateParentNode(bounds, left, right);
+            Traverse([&](const TBox& bounds) { return SegmentOverlaps(start, end, bounds); }, func);
         }
 
         void Reset()
         {
             Nodes.Reset();
+            NumLeaves = 0;
         }
 
-        static uint64 CommonPrefix(uint64 a, uint64 b)
+        bool IsEmpty() const
         {
-            // Count leading zeroes of differing bits
-            return CLZ(a ^ b);
+            return NumLeaves == 0;
         }
 
-        TIdx GetSplitPos(TIdx begin, TIdx end)
+        uint32 GetNumLeaves() const
         {
-            return floor((begin + end) / 2);
+            return NumLeaves;
         }
 
-        TIdx AllocateLeafNode(const TBox& bounds, const T& value)
+        TIdx GetRoot() const
         {
-            if (Nodes.IsFull())
+            return NumLeaves > 0 ? TIdx(0) : Index<TIdx>::None;
+        }
+
+        const TBox& GetBounds() const
+        {
+            PHX_ASSERT(NumLeaves > 0);
+            return Nodes[0].Bounds;
+        }
+
+        // The length of the prefix the codes of two of the num items share, codeAt returns the code of an item.
+        // Duplicate codes are told apart by their indices. Returns -1 for j outside of the items.
+        template <class TCodeAt>
+        static int32 CommonPrefix(const TCodeAt& codeAt, int64 num, int64 i, int64 j)
+        {
+            if (j < 0 || j >= num)
             {
-                return Index<TIdx>::None;
+                return -1;
             }
 
-            Node& node = Nodes.AddDefaulted_GetRef();
-            node.Type = ENodeType::Leaf;
-            node.Bounds = bounds;
-            node.LeafData.Value = value;
-            return Nodes.Num() - 1;
+            uint64 a = codeAt(i);
+            uint64 b = codeAt(j);
+            if (a == b)
+            {
+                return 64 + int32(CLZ(uint32(i ^ j)));
+            }
+            return int32(CLZ(a ^ b));
         }
 
-        TIdx AllocateParentNode(const TBox& bounds, uint16 left, uint16 right)
+        // Finds where the range of items [first, last] splits in two, which is the highest bit the codes differ in.
+        // Returns the index of the last item of the left half.
+        template <class TCodeAt>
+        static int64 GetSplitPos(const TCodeAt& codeAt, int64 num, int64 first, int64 last)
         {
-            if (Nodes.IsFull())
+            int32 commonPrefix = CommonPrefix(codeAt, num, first, last);
+
+            // Binary search for the last item that shares more than the common prefix with the first
+            int64 split = first;
+            int64 step = last - first;
+            do
             {
-                return Index<TIdx>::None;
+                step = (step + 1) >> 1;
+                int64 newSplit = split + step;
+                if (newSplit < last && CommonPrefix(codeAt, num, first, newSplit) > commonPrefix)
+                {
+                    split = newSplit;
+                }
             }
+            while (step > 1);
+
+            return split;
+        }
+
+        TFixedArray<Node, N> Nodes;
+        uint32 NumLeaves = 0;
+
+    private:
+
+        static constexpr uint32 ParallelGrain = 256;
+
+        TIdx GetLeafIndex(uint32 item) const
+        {
+            return TIdx(NumLeaves - 1 + item);
+        }
+
+        template <class TRunner, class TList, class TCodeFunc, class TBoundsFunc, class TValueFunc>
+        bool BuildImpl(
+            const TRunner& runner,
+            const TList& sorted,
+            const TCodeFunc& codeFunc,
+            const TBoundsFunc& boundsFunc,
+            const TValueFunc& valueFunc)
+        {
+            uint32 num = 0;
+            if constexpr (requires { sorted.Num(); })
+            {
+                num = uint32(sorted.Num());
+            }
+            else
+            {
+                num = uint32(std::size(sorted));
+            }
+            if (num == 0)
+            {
+                Reset();
+                return true;
+            }
+
+            if (2 * size_t(num) - 1 > N)
+            {
+                Reset();
+                return false;
+            }
+
+            NumLeaves = num;
+            Nodes.SetSize(2 * num - 1);
+
+            runner(num, [&](uint32 start, uint32 count)
+            {
+                for (uint32 i = start; i < start + count; ++i)
+                {
+                    Node& leaf = Nodes[GetLeafIndex(i)];
+                    leaf.Type = ENodeType::Leaf;
+                    leaf.LeafData.Value = valueFunc(sorted[i]);
+                    leaf.Bounds = boundsFunc(sorted[i]);
+                }
+            });
 
-            Node& node = Nodes.AddDefaulted_GetRef();
+            Nodes[0].ParentIndex = Index<TIdx>::None;
+
+            auto codeAt = [&](int64 i) { return uint64(codeFunc(sorted[size_t(i)])); };
+
+            runner(num - 1, [&](uint32 start, uint32 count)
+            {
+                for (uint32 i = start; i < start + count; ++i)
+                {
+                    BuildInternalNode(codeAt, num, i);
+                }
+            });
+
+            // Internal node bounds come from the leaves
+            PropagateBounds(runner);
+
+            return true;
+        }
+
+        // Finds the range of items covered by internal node i and splits it between its children.
+        template <class TCodeAt>
+        void BuildInternalNode(const TCodeAt& codeAt, int64 num, int64 i)
+        {
+            // The direction of the range is towards the neighbour sharing the longer prefix
+            int64 d = CommonPrefix(codeAt, num, i, i + 1) - CommonPrefix(codeAt, num, i, i - 1) >= 0 ? 1 : -1;
+            int32 minPrefix = CommonPrefix(codeAt, num, i, i - d);
+
+            // Find an upper bound for the length of the range then binary search for the other end
+            int64 maxLength = 2;
+            while (CommonPrefix(codeAt, num, i, i + maxLength * d) > minPrefix)
+            {
+                maxLength <<= 1;
+            }
+
+            int64 length = 0;
+            for (int64 t = maxLength >> 1; t >= 1; t >>= 1)
+            {
+                if (CommonPrefix(codeAt, num, i, i + (length + t) * d) > minPrefix)
+                {
+                    length += t;
+                }
+            }
+
+            int64 j = i + length * d;
+            int64 first = Phoenix::Min(i, j);
+            int64 last = Phoenix::Max(i, j);
+            int64 split = GetSplitPos(codeAt, num, first, last);
+
+            TIdx left = first == split ? GetLeafIndex(uint32(split)) : TIdx(split);
+            TIdx right = last == split + 1 ? GetLeafIndex(uint32(split + 1)) : TIdx(split + 1);
+
+            Node& node = Nodes[size_t(i)];
             node.Type = ENodeType::Parent;
-            node.Bounds = bounds;
             node.ParentData.Left = left;
             node.ParentData.Right = right;
-            return Nodes.Num() - 1;
+            Nodes[left].ParentIndex = TIdx(i);
+            Nodes[right].ParentIndex = TIdx(i);
         }
 
-        TFixedArray<Node, N> Nodes;
+        template <class TRunner, class TBoundsFunc>
+        void RefitImpl(const TRunner& runner, const TBoundsFunc& boundsFunc)
+        {
+            if (NumLeaves == 0)
+            {
+                return;
+            }
+
+            runner(NumLeaves, [&](uint32 start, uint32 count)
+            {
+                for (uint32 i = start; i < start + count; ++i)
+                {
+                    Node& leaf = Nodes[GetLeafIndex(i)];
+                    leaf.Bounds = boundsFunc(leaf.LeafData.Value);
+                }
+            });
+
+            PropagateBounds(runner);
+        }
+
+        // Walks up from every leaf. The second child to arrive at a node sets its bounds and keeps going so each
+        // node is visited once, after both of its children are done.
+        template <class TRunner>
+        void PropagateBounds(const TRunner& runner)
+        {
+            for (uint32 i = 0; i + 1 < NumLeaves; ++i)
+            {
+                Nodes[i].RefitVisits = 0;
+            }
+
+            runner(NumLeaves, [&](uint32 start, uint32 count)
+            {
+                for (uint32 i = start; i < start + count; ++i)
+                {
+                    TIdx index = Nodes[GetLeafIndex(i)].ParentIndex;
+                    while (index != Index<TIdx>::None)
+                    {
+                        Node& node = Nodes[index];
+                        if (std::atomic_ref<uint32>(node.RefitVisits).fetch_add(1, std::memory_order_acq_rel) == 0)
+                        {
+                            break;
+                        }
+
+                        node.Bounds = Nodes[node.ParentData.Left].Bounds.Union(Nodes[node.ParentData.Right].Bounds);
+                        index = node.ParentIndex;
+                    }
+                }
+            });
+        }
+
+        template <class TOverlapFunc, class TFunc>
+        void Traverse(const TOverlapFunc& overlapFunc, const TFunc& func) const
+        {
+            if (NumLeaves == 0)
+            {
+                return;
+            }
+
+            TIdx stack[MaxDepth + 1];
+            uint32 stackSize = 0;
+            stack[stackSize++] = 0;
+
+            while (stackSize > 0)
+            {
+                const Node& node = Nodes[stack[--stackSize]];
+                if (!overlapFunc(node.Bounds))
+                {
+                    continue;
+                }
+
+                if (node.Type == ENodeType::Leaf)
+                {
+                    if constexpr (std::is_same_v<decltype(func(node.LeafData.Value)), bool>)
+                    {
+                        if (func(node.LeafData.Value))
+                        {
+                            return;
+                        }
+                    }
+                    else
+                    {
+                        func(node.LeafData.Value);
+                    }
+                    continue;
+                }
+
+                PHX_ASSERT(stackSize + 2 <= _countof(stack));
+                stack[stackSize++] = node.ParentData.Right;
+                stack[stackSize++] = node.ParentData.Left;
+            }
+        }
+
+        // Slab test of the segment against the box. The crossing points are kept as 48.16 fractions of the segment
+        // in 64-bit so short segments don't overflow the fixed point types.
+        static bool SegmentOverlaps(const TVec& start, const TVec& end, const TBox& box)
+        {
+            constexpr int64 one = int64(1) << 16;
+
+            int64 tMin = 0;
+            int64 tMax = one;
+
+            auto clipAxis = [&](TVecComp s, TVecComp e, TVecComp lo, TVecComp hi)
+            {
+                int64 delta = int64(e.Value) - int64(s.Value);
+                if (delta == 0)
+                {
+                    return s >= lo && s <= hi;
+                }
+
+                int64 t0 = (int64(lo.Value) - int64(s.Value)) * one / delta;
+                int64 t1 = (int64(hi.Value) - int64(s.Value)) * one / delta;
+                if (t0 > t1)
+                {
+                    std::swap(t0, t1);
+                }
+
+                tMin = Phoenix::Max(tMin, t0);
+                tMax = Phoenix::Min(tMax, t1);
+                return tMin <= tMax;
+            };
+
+            return clipAxis(start.X, end.X, box.Min.X, box.Max.X)
+                && clipAxis(start.Y, end.Y, box.Min.Y, box.Max.Y);
+        }
     };
 }
@@ -19,7 +19,9 @@ namespace Phoenix
         {
             uint32 Id = 0;
             uint32 UserData = 0;
-            uint8 Data[BlockSize] = {};
+
+            // Block data starts on a cache line so that objects stored in different blocks never share one.
+            alignas(PHX_CACHE_LINE_SIZE) uint8 Data[BlockSize] = {};
         };
 
         constexpr uint32 GetNumBlocks() const
@@ -277,12 +279,12 @@ namespace Phoenix
                 }
 
                 index = (uint32)Blocks.Num();
-
-                Block& block = Blocks.AddDefaulted_GetRef();
-                block.Id = ++BlockIdGen;
+                Blocks.SetSize(index + 1);
             }
 
+            // Always hand out a new id so that handles to a previously freed block stay invalid.
             Block& block = Blocks[index];
+            block.Id = ++BlockIdGen;
             block.UserData = userData;
             IndexMap.Insert(block.Id, index);
 
@@ -0,0 +1,168 @@
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+#include "Platform.h"
+
+namespace Phoenix
+{
+    // A Chase-Lev work-stealing deque. The owning thread pushes and pops items at the bottom while any other
+    // thread can steal items from the top. The buffer grows as needed so pushing never fails.
+    // See "Correct and Efficient Work-Stealing for Weak Memory Models" (Le et al.)
+    template <class T>
+    class TWorkStealingDeque
+    {
+    public:
+
+        static_assert(std::is_trivially_copyable_v<T>, "Items are read by thieves before being claimed so they must be trivially copyable.");
+
+        TWorkStealingDeque(size_t capacity = 1024)
+            : Top(0)
+            , Bottom(0)
+        {
+            PHX_ASSERT(capacity > 0 && (capacity & (capacity - 1)) == 0);
+            Buffers.push_back(std::make_unique<Array>(capacity));
+            Buffer.store(Buffers.back().get(), std::memory_order_relaxed);
+        }
+
+        TWorkStealingDeque(const TWorkStealingDeque&) = delete;
+        TWorkStealingDeque& operator=(const TWorkStealingDeque&) = delete;
+
+        // Pushes an item onto the bottom of the deque. Must only be called by the owning thread.
+        void Push(T item)
+        {
+            int64 b = Bottom.load(std::memory_order_relaxed);
+            int64 t = Top.load(std::memory_order_acquire);
+            Array* array = Buffer.load(std::memory_order_relaxed);
+
+            if (b - t > (int64)array->Capacity - 1)
+            {
+                array = Grow(array, t, b);
+            }
+
+            array->Put(b, item);
+            std::atomic_thread_fence(std::memory_order_release);
+            Bottom.store(b + 1, std::memory_order_relaxed);
+        }
+
+        // Pops the most recently pushed item. Must only be called by the owning thread.
+        bool Pop(T& outItem)
+        {
+            int64 b = Bottom.load(std::memory_order_relaxed) - 1;
+            Array* array = Buffer.load(std::memory_order_relaxed);
+            Bottom.store(b, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            int64 t = Top.load(std::memory_order_relaxed);
+
+            if (t > b)
+            {
+                // Empty
+                Bottom.store(b + 1, std::memory_order_relaxed);
+                return false;
+            }
+
+            T item = array->Get(b);
+            if (t == b)
+            {
+                // Last item, race against thieves for it
+                bool won = Top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+                Bottom.store(b + 1, std::memory_order_relaxed);
+                if (!won)
+                {
+                    return false;
+                }
+            }
+
+            outItem = item;
+            return true;
+        }
+
+        // Steals the oldest item. Can be called from any thread.
+        // May fail spuriously if another thread claimed the item first.
+        bool Steal(T& outItem)
+        {
+            int64 t = Top.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            int64 b = Bottom.load(std::memory_order_acquire);
+
+            if (t >= b)
+            {
+                return false;
+            }
+
+            Array* array = Buffer.load(std::memory_order_acquire);
+            T item = array->Get(t);
+            if (!Top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            {
+                return false;
+            }
+
+            outItem = item;
+            return true;
+        }
+
+        bool IsEmpty() const
+        {
+            int64 b = Bottom.load(std::memory_order_relaxed);
+            int64 t = Top.load(std::memory_order_relaxed);
+            return b <= t;
+        }
+
+        size_t Num() const
+        {
+            int64 b = Bottom.load(std::memory_order_relaxed);
+            int64 t = Top.load(std::memory_order_relaxed);
+            return b > t ? size_t(b - t) : 0;
+        }
+
+    private:
+
+        struct Array
+        {
+            Array(size_t capacity)
+                : Capacity(capacity)
+                , Mask(capacity - 1)
+                , Items(new std::atomic<T>[capacity])
+            {
+            }
+
+            T Get(int64 index) const
+            {
+                return Items[index & Mask].load(std::memory_order_relaxed);
+            }
+
+            void Put(int64 index, T item)
+            {
+                Items[index & Mask].store(item, std::memory_order_relaxed);
+            }
+
+            size_t Capacity;
+            size_t Mask;
+            std::unique_ptr<std::atomic<T>[]> Items;
+        };
+
+        Array* Grow(Array* array, int64 t, int64 b)
+        {
+            Buffers.push_back(std::make_unique<Array>(array->Capacity * 2));
+            Array* newArray = Buffers.back().get();
+
+            for (int64 i = t; i < b; ++i)
+            {
+                newArray->Put(i, array->Get(i));
+            }
+
+            // Old buffers are kept alive until the deque is destroyed since thieves may still be reading them.
+            Buffer.store(newArray, std::memory_order_release);
+            return newArray;
+        }
+
+        alignas(PHX_CACHE_LINE_SIZE) std::atomic<int64> Top;
+        alignas(PHX_CACHE_LINE_SIZE) std::atomic<int64> Bottom;
+        std::atomic<Array*> Buffer;
+        std::vector<std::unique_ptr<Array>> Buffers;
+    };
+}
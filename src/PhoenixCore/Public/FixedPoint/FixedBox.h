@@ -13,6 +13,9 @@ namespace Phoenix
         constexpr TFixedBox(const TFixedBox& other) : Min(other.Min), Max(other.Max) {}
         constexpr TFixedBox(TFixedBox&& other) noexcept : Min(other.Min), Max(other.Max) {}
 
+        constexpr TFixedBox& operator=(const TFixedBox& other) = default;
+        constexpr TFixedBox& operator=(TFixedBox&& other) noexcept = default;
+
         static TFixedBox FromPoints(const TVec& a, const TVec& b, const TVec& c)
         {
             TFixedBox box(TVec::Max, TVec::Min);
@@ -87,12 +90,12 @@ namespace Phoenix
 
         constexpr TFixedBox ExpandBy(const TVec& v) const
         {
-            return FixedBox(Min - v, Max + v);
+            return TFixedBox(Min - v, Max + v);
         }
 
         constexpr TFixedBox ExpandBy(const TVecComp& v) const
         {
-            return FixedBox(Min - v, Max + v);
+            return TFixedBox(Min - v, Max + v);
         }
 
         constexpr TFixedBox& Union(const TVec& pt)
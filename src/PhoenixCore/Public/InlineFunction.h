@@ -0,0 +1,212 @@
+
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+
+#include "Platform.h"
+
+#ifndef PHX_INLINE_FUNCTION_SIZE
+#define PHX_INLINE_FUNCTION_SIZE 48
+#endif
+
+namespace Phoenix
+{
+    template <class TSignature, size_t Capacity = PHX_INLINE_FUNCTION_SIZE>
+    class TInlineFunction;
+
+    // A copyable function wrapper like std::function that stores callables of up to Capacity bytes inline instead
+    // of allocating them on the heap. Larger callables still work but fall back to a heap allocation.
+    template <class TRet, class ...TArgs, size_t Capacity>
+    class TInlineFunction<TRet(TArgs...), Capacity>
+    {
+    public:
+
+        TInlineFunction() = default;
+
+        TInlineFunction(std::nullptr_t)
+        {
+        }
+
+        template <class TFunc>
+            requires (!std::is_same_v<std::decay_t<TFunc>, TInlineFunction> && std::is_invocable_r_v<TRet, std::decay_t<TFunc>&, TArgs...>)
+        TInlineFunction(TFunc&& func)
+        {
+            using TStored = std::decay_t<TFunc>;
+
+            if constexpr (requires { func == nullptr; })
+            {
+                // Function pointers and std::functions can be empty
+                if (func == nullptr)
+                {
+                    return;
+                }
+            }
+
+            if constexpr (IsStoredInline<TStored>())
+            {
+                new (Storage) TStored(std::forward<TFunc>(func));
+            }
+            else
+            {
+                *reinterpret_cast<TStored**>(Storage) = new TStored(std::forward<TFunc>(func));
+            }
+
+            Ops = &TOps<TStored>::Table;
+        }
+
+        TInlineFunction(const TInlineFunction& other)
+        {
+            if (other.Ops)
+            {
+                other.Ops->Copy(Storage, other.Storage);
+                Ops = other.Ops;
+            }
+        }
+
+        TInlineFunction(TInlineFunction&& other) noexcept
+        {
+            if (other.Ops)
+            {
+                other.Ops->Move(Storage, other.Storage);
+                Ops = other.Ops;
+                other.Reset();
+            }
+        }
+
+        ~TInlineFunction()
+        {
+            Reset();
+        }
+
+        TInlineFunction& operator=(const TInlineFunction& other)
+        {
+            if (this != &other)
+            {
+                TInlineFunction copy(other);
+                *this = std::move(copy);
+            }
+            return *this;
+        }
+
+        TInlineFunction& operator=(TInlineFunction&& other) noexcept
+        {
+            if (this != &other)
+            {
+                Reset();
+                if (other.Ops)
+                {
+                    other.Ops->Move(Storage, other.Storage);
+                    Ops = other.Ops;
+                    other.Reset();
+                }
+            }
+            return *this;
+        }
+
+        TRet operator()(TArgs... args) const
+        {
+            PHX_ASSERT(Ops);
+            return Ops->Invoke(const_cast<uint8*>(Storage), std::forward<TArgs>(args)...);
+        }
+
+        explicit operator bool() const
+        {
+            return Ops != nullptr;
+        }
+
+        void Reset()
+        {
+            if (Ops)
+            {
+                Ops->Destroy(Storage);
+                Ops = nullptr;
+            }
+        }
+
+    private:
+
+        template <class TStored>
+        static constexpr bool IsStoredInline()
+        {
+            return sizeof(TStored) <= Capacity
+                && alignof(TStored) <= alignof(std::max_align_t)
+                && std::is_nothrow_move_constructible_v<TStored>;
+        }
+
+        struct OpsTable
+        {
+            TRet (*Invoke)(uint8* storage, TArgs&&... args);
+            void (*Copy)(uint8* dest, const uint8* src);
+            void (*Move)(uint8* dest, uint8* src);
+            void (*Destroy)(uint8* storage);
+        };
+
+        template <class TStored>
+        struct TOps
+        {
+            static TStored& Get(uint8* storage)
+            {
+                if constexpr (IsStoredInline<TStored>())
+                {
+                    return *std::launder(reinterpret_cast<TStored*>(storage));
+                }
+                else
+                {
+                    return **reinterpret_cast<TStored**>(storage);
+                }
+            }
+
+            static TRet Invoke(uint8* storage, TArgs&&... args)
+            {
+                return std::invoke(Get(storage), std::forward<TArgs>(args)...);
+            }
+
+            static void Copy(uint8* dest, const uint8* src)
+            {
+                const TStored& stored = Get(const_cast<uint8*>(src));
+                if constexpr (IsStoredInline<TStored>())
+                {
+                    new (dest) TStored(stored);
+                }
+                else
+                {
+                    *reinterpret_cast<TStored**>(dest) = new TStored(stored);
+                }
+            }
+
+            static void Move(uint8* dest, uint8* src)
+            {
+                if constexpr (IsStoredInline<TStored>())
+                {
+                    new (dest) TStored(std::move(Get(src)));
+                }
+                else
+                {
+                    // Steal the heap allocation, Destroy on the source is a no-op once the pointer is cleared
+                    *reinterpret_cast<TStored**>(dest) = *reinterpret_cast<TStored**>(src);
+                    *reinterpret_cast<TStored**>(src) = nullptr;
+                }
+            }
+
+            static void Destroy(uint8* storage)
+            {
+                if constexpr (IsStoredInline<TStored>())
+                {
+                    Get(storage).~TStored();
+                }
+                else
+                {
+                    delete *reinterpret_cast<TStored**>(storage);
+                }
+            }
+
+            static constexpr OpsTable Table = { &Invoke, &Copy, &Move, &Destroy };
+        };
+
+        alignas(std::max_align_t) uint8 Storage[Capacity < sizeof(void*) ? sizeof(void*) : Capacity];
+        const OpsTable* Ops = nullptr;
+    };
+}
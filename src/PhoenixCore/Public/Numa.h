@@ -0,0 +1,30 @@
+
+#pragma once
+
+#include "Platform.h"
+
+namespace Phoenix
+{
+    // Used wherever a NUMA node can be given to mean that placement is left to the OS.
+    static constexpr uint32 AnyNumaNode = Index<uint32>::None;
+
+    namespace Numa
+    {
+        // Gets the number of NUMA nodes of the machine. Always at least 1.
+        PHOENIXCORE_API uint32 GetNumNodes();
+
+        // Gets the logical CPUs that belong to a NUMA node.
+        PHOENIXCORE_API TArray<uint32> GetNodeCpus(uint32 node);
+
+        // Gets the NUMA node that a logical CPU belongs to or AnyNumaNode if it is unknown.
+        PHOENIXCORE_API uint32 GetCpuNode(uint32 cpu);
+
+        // Restricts the calling thread to run on the given logical CPUs. Returns false if the OS refused.
+        PHOENIXCORE_API bool SetCurrentThreadAffinity(TSpan<const uint32> cpus);
+
+        // Allocates memory that is backed by pages of the given NUMA node where the OS supports it.
+        // Memory allocated with AnyNumaNode comes from the regular heap. Must be freed with Free.
+        PHOENIXCORE_API void* Allocate(size_t size, uint32 node);
+        PHOENIXCORE_API void Free(void* ptr, size_t size, uint32 node);
+    }
+}
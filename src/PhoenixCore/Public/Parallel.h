@@ -2,29 +2,44 @@
 #pragma once
 
 #include <atomic>
+#include <condition_variable>
 #include <functional>
 #include <mutex>
 #include <thread>
 #include <vector>
 
 #include "Platform.h"
-#include "Containers/MPMCQueue.h"
+#include "InlineFunction.h"
+#include "Name.h"
+#include "Numa.h"
+#include "Containers/WorkStealingDeque.h"
 
 namespace Phoenix
 {
+    class ThreadPool;
+
     struct PHOENIXCORE_API TaskHandle
     {
         bool IsCompleted() const;
         bool WaitForCompleted(std::chrono::milliseconds maxWaitTime = std::chrono::milliseconds(0)) const;
-        void OnCompleted(std::function<void()>&& fn);
+        void OnCompleted(TInlineFunction<void()>&& fn);
 
     private:
         friend class Task;
-        std::function<void()> OnCompletedFunc;
+        friend class ThreadPool;
+        TInlineFunction<void()> OnCompletedFunc;
         std::atomic<bool> bIsCompleted;
+
+        // The pool the task was submitted to, waiting threads run its tasks instead of blocking.
+        ThreadPool* Pool = nullptr;
     };
 
-    using TTaskFunc = std::function<void()>;
+    // Small callables are stored inline so submitting a task doesn't allocate.
+    using TTaskFunc = TInlineFunction<void()>;
+    using TRangeFunc = TInlineFunction<void(uint32, uint32)>;
+    using TRangeCountFunc = TInlineFunction<uint32()>;
+
+    typedef uint32 taskgroupid_t;
     
     class PHOENIXCORE_API Task
     {
@@ -46,59 +61,268 @@ namespace Phoenix
     private:
 
         friend class ThreadPool;
+        friend class TaskQueue;
 
         TTaskFunc WorkFunc;
         TSharedPtr<TaskHandle> Handle;
     };
 
+    // Counts the tasks of a group that haven't finished yet. Tasks submitted with a counter decrement it when they
+    // finish so the whole group can be waited on without a handle per task.
+    class PHOENIXCORE_API TaskCounter
+    {
+    public:
+
+        TaskCounter(uint32 count = 0);
+
+        TaskCounter(const TaskCounter&) = delete;
+        TaskCounter& operator=(const TaskCounter&) = delete;
+
+        void Add(uint32 count = 1);
+
+        // Marks a task as finished. Returns true if it was the last one.
+        bool Done();
+
+        bool IsDone() const;
+
+        // Pauses the calling thread until all tasks have finished. The calling thread runs tasks of the pool while
+        // waiting and blocks when there are none left to run.
+        void Wait(ThreadPool* threadPool) const;
+
+    private:
+
+        std::atomic<uint32> Count;
+    };
+
+    struct PHOENIXCORE_API ThreadPoolOptions
+    {
+        std::string Id;
+        uint32 NumWorkers = 1;
+        uint32 QueueCapacity = 1024;
+
+        // The logical CPUs the workers are allowed to run on. Defaults to the CPUs of NumaNode if a node is given,
+        // otherwise workers aren't restricted at all.
+        TArray<uint32> Cpus;
+
+        // Pins each worker to a single CPU of Cpus, round-robin, instead of letting it run on any of them.
+        bool bPinWorkers = false;
+
+        // The NUMA node the pool serves. Worlds bound to the node run their tasks on the pool.
+        uint32 NumaNode = AnyNumaNode;
+    };
+
     PHOENIXCORE_API bool HasThreadPool();
     PHOENIXCORE_API ThreadPool* GetThreadPool();
     PHOENIXCORE_API void SetThreadPool(const std::string& id, uint32 numWorkers, uint32 queueCapacity = 1024);
+    PHOENIXCORE_API void SetThreadPool(const ThreadPoolOptions& options);
+
+    // Creates a pool per NUMA node with its workers restricted to the CPUs of the node. The first pool also becomes
+    // the default pool returned by GetThreadPool().
+    PHOENIXCORE_API void SetNumaThreadPools(const std::string& id, uint32 numWorkersPerNode, uint32 queueCapacity = 1024);
+
+    // Gets the pool serving a NUMA node, falling back to the default pool if there is no pool for the node.
+    PHOENIXCORE_API ThreadPool* GetThreadPool(uint32 numaNode);
+
+    // Gets the number of NUMA nodes that have their own pool.
+    PHOENIXCORE_API uint32 GetNumNumaThreadPools();
+
+    // Shuts down the default pool and the pools of the NUMA nodes, joining their workers. Must not be called while
+    // a task queue is being flushed.
     PHOENIXCORE_API void DestroyThreadPool();
 
+    // Each worker owns a work-stealing deque that tasks submitted from the worker are pushed onto, and a mailbox
+    // that receives tasks submitted from other threads. Idle workers steal from the deques and mailboxes of other
+    // workers before parking on a condition variable until more work is submitted.
     class PHOENIXCORE_API ThreadPool
     {
     public:
+
+        // Lets the pool pick the worker that runs a task.
+        static constexpr uint32 AnyWorker = Index<uint32>::None;
+
         ThreadPool(std::string id, uint32 numWorkers, uint32 queueCapacity = 1024);
+        ThreadPool(const ThreadPoolOptions& options);
         ~ThreadPool();
 
         uint32 GetNumWorkers() const;
 
+        // Gets the NUMA node the pool serves or AnyNumaNode.
+        uint32 GetNumaNode() const;
+
+        // Gets the index of the worker of this pool running on the calling thread or AnyWorker if the calling
+        // thread is not one of the workers of this pool.
+        uint32 GetCurrentWorkerIndex() const;
+
         void Shutdown();
 
-        TSharedPtr<TaskHandle> Submit(const Task& task);
-        TSharedPtr<TaskHandle> Submit(TTaskFunc&& work);
+        // Submits a task to run on the pool. The affinity is a hint for which worker should run the task; idle
+        // workers can still steal the task.
+        TSharedPtr<TaskHandle> Submit(const Task& task, uint32 affinity = AnyWorker);
+        TSharedPtr<TaskHandle> Submit(TTaskFunc&& work, uint32 affinity = AnyWorker);
+
+        // Submits a task without creating a handle for it. The counter, if given, is decremented once the task has
+        // finished. Prefer these when submitting many tasks since they don't allocate.
+        void Submit(Task&& task, TaskCounter* counter, uint32 affinity = AnyWorker);
+        void Submit(TTaskFunc&& work, TaskCounter* counter, uint32 affinity = AnyWorker);
+
+        // Runs one pending task on the calling thread if a task is available. Workers take tasks from their own
+        // deque first, other threads can only steal.
+        bool TryRunTask();
+
+        // Runs tasks on the calling thread until isDone returns true. Blocks when there is nothing left to run and
+        // wakes up again whenever a task is submitted or finishes, so the predicate should only depend on tasks
+        // of this pool.
+        template <class TPredicate>
+        void HelpUntil(const TPredicate& isDone)
+        {
+            for (;;)
+            {
+                if (isDone())
+                {
+                    return;
+                }
+
+                if (TryRunTask())
+                {
+                    continue;
+                }
+
+                uint32 epoch = WaitEpoch.load(std::memory_order_acquire);
+                NumWaiters.fetch_add(1, std::memory_order_seq_cst);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+
+                if (!isDone() && NumQueuedTasks.load(std::memory_order_seq_cst) == 0)
+                {
+                    WaitEpoch.wait(epoch, std::memory_order_acquire);
+                }
+
+                NumWaiters.fetch_sub(1, std::memory_order_relaxed);
+            }
+        }
 
         bool IsEmpty() const;
         bool WaitIdle(std::chrono::milliseconds maxWaitTime = std::chrono::milliseconds(0)) const;
 
     private:
 
+        // Submitted tasks are stored in nodes that are recycled instead of being freed.
+        struct TaskNode
+        {
+            Task Task;
+            TaskCounter* Counter = nullptr;
+
+            // Links the node into a free list or a mailbox.
+            TaskNode* Next = nullptr;
+        };
+
+        struct WorkerState
+        {
+            WorkerState(uint32 capacity) : Deque(capacity) {}
+
+            TWorkStealingDeque<TaskNode*> Deque;
+
+            // An intrusive FIFO list of nodes so submitting from other threads doesn't allocate.
+            std::mutex MailboxMutex;
+            TaskNode* MailboxHead = nullptr;
+            TaskNode* MailboxTail = nullptr;
+
+            // Lets thieves skip empty mailboxes without taking the lock.
+            std::atomic<uint32> NumMailboxTasks = 0;
+
+            // Nodes freed by this worker. Only accessed by the worker itself.
+            TaskNode* FreeNodes = nullptr;
+            uint32 NumFreeNodes = 0;
+        };
+
         void Worker(uint32 workerId);
 
+        TaskNode* AllocateNode();
+        void FreeNode(TaskNode* node);
+
+        void Enqueue(TaskNode* node, uint32 affinity);
+
+        // Finds the next task for a worker from its own deque, its mailbox or by stealing from other workers.
+        TaskNode* FindTask(uint32 workerId);
+
+        void RunTask(TaskNode* node);
+
+        void WakeWorker();
+
+        // Wakes threads blocked in HelpUntil so they can check their predicate or pick up new tasks.
+        void NotifyWaiters();
+
         std::string Id;
         std::vector<std::thread> Threads;
-        TMPMCQueue<Task> TaskQueue;
+        std::vector<TUniquePtr<WorkerState>> Workers;
         std::atomic<bool> Done = false;
-        std::atomic<uint32_t> ActiveWorkerCount;
-        std::atomic<uint32_t> SpinningWorkerCount;
+
+        // The number of tasks submitted but not yet picked up by a worker.
+        std::atomic<uint32> NumQueuedTasks = 0;
+
+        // The number of tasks submitted but not yet completed.
+        std::atomic<uint32> NumUnfinishedTasks = 0;
+
+        // Used to pick the mailbox of tasks submitted from outside of the pool without an affinity.
+        std::atomic<uint32> NextMailbox = 0;
+
+        std::mutex ParkMutex;
+        std::condition_variable ParkCondition;
+        std::atomic<uint32> NumParkedWorkers = 0;
+
+        mutable std::mutex IdleMutex;
+        mutable std::condition_variable IdleCondition;
+
+        // Bumped whenever a task is submitted or finishes while threads are blocked in HelpUntil.
+        std::atomic<uint32> WaitEpoch = 0;
+        std::atomic<uint32> NumWaiters = 0;
+
+        // Nodes that are shared between threads that aren't workers and workers that have run out of free nodes.
+        std::mutex SharedFreeNodesMutex;
+        TaskNode* SharedFreeNodes = nullptr;
+
         uint32 NumWorkers;
+
+        TArray<uint32> Cpus;
+        bool bPinWorkers = false;
+        uint32 NumaNode = AnyNumaNode;
+    };
+
+    // The resources (components, world blocks, etc.) that a group of tasks reads and writes.
+    struct PHOENIXCORE_API TaskAccess
+    {
+        TArray<FName> Reads;
+        TArray<FName> Writes;
+
+        void AddRead(const FName& resource);
+        void AddWrite(const FName& resource);
+
+        bool IsEmpty() const;
+
+        // Returns true if the groups can't run at the same time, i.e. either one writes to a resource that the
+        // other reads or writes.
+        bool ConflictsWith(const TaskAccess& other) const;
     };
 
+    // Collects groups of tasks and runs them as a dependency graph when flushed. A group starts once all of the
+    // groups it depends on have completed. Groups added through Enqueue/BeginGroup or without explicit
+    // dependencies act as barriers and depend on every group added before them. Groups added with an access set
+    // only depend on the last barrier and the groups since then that their access conflicts with.
     class PHOENIXCORE_API TaskQueue
     {
     public:
 
-        TaskQueue(uint32 id, ThreadPool* threadPool = Phoenix::GetThreadPool());
+        static constexpr taskgroupid_t InvalidGroup = Index<taskgroupid_t>::None;
 
-        static TSharedPtr<TaskQueue> CreateTaskQueue(uint32 id);
-        static TSharedPtr<TaskQueue> GetTaskQueue(uint32 id);
-        static bool ReleaseTaskQueue(uint32 id);
+        TaskQueue(uint32 id, ThreadPool* threadPool = Phoenix::GetThreadPool());
 
         uint32 GetId() const;
         ThreadPool* GetThreadPool() const;
         uint32 GetNumWorkers() const;
 
+        // Makes the queue run on the global pool serving the NUMA node, looked up whenever the queue is flushed,
+        // instead of the pool it was created with. The global pools can then be replaced while the queue is alive.
+        void UseNumaThreadPool(uint32 numaNode);
+
         void Enqueue(Task&& task);
         void Enqueue(TTaskFunc&& work);
         void Enqueue(std::vector<Task>&& tasks);
@@ -106,27 +330,190 @@ namespace Phoenix
         std::vector<Task>& BeginGroup(uint32 size = 0);
         void EndGroup();
 
+        // Adds a group of tasks that depends on every group added before it.
+        taskgroupid_t AddGroup(std::vector<Task>&& tasks);
+
+        // Adds a group of tasks that starts as soon as the given groups have completed.
+        taskgroupid_t AddGroup(std::vector<Task>&& tasks, std::initializer_list<taskgroupid_t> dependencies);
+
+        // Adds a group of tasks that only waits for the earlier groups that its access conflicts with.
+        taskgroupid_t AddGroup(std::vector<Task>&& tasks, const TaskAccess& access);
+
+        // Adds a group without tasks that starts as soon as the given groups have completed, or that only waits
+        // for the earlier groups that its access conflicts with. Its tasks are added through GetGroupTasks before
+        // the queue is flushed. Groups are reused across flushes so this doesn't allocate once warmed up.
+        taskgroupid_t AddEmptyGroup(std::initializer_list<taskgroupid_t> dependencies);
+        taskgroupid_t AddEmptyGroup(const TaskAccess& access);
+
+        std::vector<Task>& GetGroupTasks(taskgroupid_t groupId);
+
+        // Allocates memory that stays valid until the queue has been flushed, e.g. for the state shared by the
+        // tasks of a group. The memory is kept for the next flush.
+        void* AllocateScratch(size_t size, size_t alignment);
+
+        // Constructs an object in scratch memory. It is destroyed once the queue has been flushed.
+        template <class T, class ...TArgs>
+        T* NewScratch(TArgs&&... args)
+        {
+            T* object = new (AllocateScratch(sizeof(T), alignof(T))) T(std::forward<TArgs>(args)...);
+            if constexpr (!std::is_trivially_destructible_v<T>)
+            {
+                ScratchDestructors.emplace_back([](void* ptr) { static_cast<T*>(ptr)->~T(); }, object);
+            }
+            return object;
+        }
+
+        // Adds a group that splits [0, count) into ranges of at least minRange and calls func(start, len) for each
+        // range in parallel. The count is only resolved when the group starts so it can depend on the results of
+        // earlier groups. Depends on every group added before it.
+        taskgroupid_t AddRangeGroup(TRangeCountFunc&& getCount, uint32 minRange, TRangeFunc&& func);
+
+        // Adds a range group that starts as soon as the given groups have completed.
+        taskgroupid_t AddRangeGroup(
+            TRangeCountFunc&& getCount,
+            uint32 minRange,
+            TRangeFunc&& func,
+            std::initializer_list<taskgroupid_t> dependencies);
+
+        // Adds a range group that only waits for the earlier groups that its access conflicts with.
+        taskgroupid_t AddRangeGroup(TRangeCountFunc&& getCount, uint32 minRange, TRangeFunc&& func, const TaskAccess& access);
+
+        // Records how long the items of a range group take so that later range groups with the same key, e.g. the
+        // same job in the next step, can size their chunks to match.
+        void TrackRangeCost(taskgroupid_t groupId, hash32_t costKey);
+
+        // Gets the id of the most recently added group or InvalidGroup if there are none.
+        taskgroupid_t GetLastGroup() const;
+
+        // Runs every group in dependency order and pauses the calling thread until all of them have completed.
         void Flush();
 
     private:
 
+        // The average time an item of the range groups with the same cost key took in previous flushes.
+        struct RangeCost
+        {
+            std::atomic<float> NanosecondsPerItem = 0.0f;
+        };
+
+        struct TaskGroup
+        {
+            std::vector<Task> Tasks;
+            std::vector<taskgroupid_t> Successors;
+            uint32 NumDependencies = 0;
+            std::atomic<uint32> NumPendingDependencies = 0;
+            TaskCounter PendingTasks;
+
+            // Set for range groups whose tasks are only created when the group starts.
+            TRangeCountFunc GetRangeCount;
+            TRangeFunc RangeFunc;
+            uint32 MinRange = 1;
+
+            // The tasks of a range group claim chunks of the range until it is exhausted.
+            uint32 RangeTotal = 0;
+            uint32 RangeGrain = 1;
+            std::atomic<uint32> NextRangeStart = 0;
+            std::atomic<uint64> RangeBusyNanoseconds = 0;
+            RangeCost* Cost = nullptr;
+
+            // Set for groups that were added with an access set.
+            bool bHasAccess = false;
+            TaskAccess Access;
+        };
+
+        enum class EGroupOrder : uint8
+        {
+            // Depends on every group since the last barrier.
+            Barrier,
+            // Depends only on the given groups.
+            Explicit,
+            // Depends on the last barrier and any conflicting groups since then.
+            Access,
+        };
+
+        taskgroupid_t AddGroup(TUniquePtr<TaskGroup>&& group, std::initializer_list<taskgroupid_t> dependencies, EGroupOrder order);
+
+        // Takes a group left over from an earlier flush or creates a new one.
+        TUniquePtr<TaskGroup> AcquireGroup();
+
+        void RunRangeChunks(taskgroupid_t groupId);
+
+        void StartGroup(taskgroupid_t groupId);
+        void CompleteGroup(taskgroupid_t groupId);
+
         void Complete();
 
         uint32 Id = 0;
-        std::vector<std::vector<Task>> Tasks;
-        std::atomic<uint32> CurrTaskIndex;
+        std::vector<TUniquePtr<TaskGroup>> Groups;
+
+        // Completed groups are cleared and kept so the tasks and successors of new groups reuse their storage.
+        std::vector<TUniquePtr<TaskGroup>> FreeGroups;
+        std::vector<taskgroupid_t> RootGroups;
+
+        struct ScratchBlock
+        {
+            TUniquePtr<uint8[]> Data;
+            size_t Size = 0;
+        };
+
+        std::vector<ScratchBlock> ScratchBlocks;
+        size_t CurrentScratchBlock = 0;
+        size_t ScratchOffset = 0;
+        std::vector<TPair<void(*)(void*), void*>> ScratchDestructors;
+
+        // The group that Enqueue adds tasks to.
+        taskgroupid_t OpenGroup = InvalidGroup;
+
+        // The groups added since the last barrier group, including the barrier group itself.
+        std::vector<taskgroupid_t> BarrierDependencies;
+
+        TMap<hash32_t, RangeCost> RangeCosts;
+
+        std::atomic<uint32> NumRemainingGroups = 0;
         std::atomic<bool> bIsCompleted = false;
         ThreadPool* ThreadPool;
+
+        // Set by UseNumaThreadPool.
+        bool bUsesNumaThreadPool = false;
+        uint32 NumaNode = AnyNumaNode;
     };
 
+    // Claims the next chunk of [0, total) from a cursor shared between tasks. Chunks start large and shrink as the
+    // range is used up (guided scheduling) so the tasks that finish first pick up the remaining work in small
+    // pieces instead of waiting on one large chunk. Chunks are never smaller than the grain.
+    inline bool ClaimGuidedRange(std::atomic<uint32>& next, uint32 total, uint32 grain, uint32 numWorkers, uint32& outStart, uint32& outLen)
+    {
+        uint32 start = next.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            if (start >= total)
+            {
+                return false;
+            }
+
+            uint32 remaining = total - start;
+            uint32 len = remaining / (2 * numWorkers);
+            len = len < grain ? grain : len;
+            len = len > remaining ? remaining : len;
+
+            if (next.compare_exchange_weak(start, start + len, std::memory_order_relaxed))
+            {
+                outStart = start;
+                outLen = len;
+                return true;
+            }
+        }
+    }
+
     template <class TThreadPool, class TJob>
     void ParallelForEach(TThreadPool& pool, uint32 num, const TJob& job)
     {
+        TaskCounter counter(num);
         for (uint32 i = 0; i < num; ++i)
         {
-            pool.Submit([=] { job(i); });
+            pool.Submit([&job, i] { job(i); }, &counter);
         }
-        pool.WaitIdle();
+        counter.Wait(&pool);
     }
 
     template <class TJob>
@@ -148,17 +535,26 @@ namespace Phoenix
     template <class TThreadPool, class TJob>
     void ParallelRange(TThreadPool& pool, uint32 total, uint32 minRange, const TJob& job)
     {
-        uint32 desiredRange = total / pool.GetNumWorkers();
-        uint32 actualRange = desiredRange < minRange ? minRange : desiredRange;
-        uint32 start = 0;
-        while (start != total)
+        uint32 numWorkers = pool.GetNumWorkers();
+        uint32 grain = minRange > 0 ? minRange : 1;
+        uint32 numChunks = (total + grain - 1) / grain;
+        uint32 numTasks = numChunks < numWorkers ? numChunks : numWorkers;
+
+        std::atomic<uint32> next = 0;
+        TaskCounter counter(numTasks);
+        for (uint32 i = 0; i < numTasks; ++i)
         {
-            uint32 len = actualRange;
-            len = len > (total - start) ? (total - start) : len;
-            pool.Submit([=] { job(start, len); });
-            start += len;
+            pool.Submit([&]
+            {
+                uint32 start = 0;
+                uint32 len = 0;
+                while (ClaimGuidedRange(next, total, grain, numWorkers, start, len))
+                {
+                    job(start, len);
+                }
+            }, &counter);
         }
-        pool.WaitIdle();
+        counter.Wait(&pool);
     }
 
     template <class TJob>
@@ -9,6 +9,7 @@
 #include <string>
 #include <map>
 #include <memory>
+#include <span>
 #include <vector>
 #include <cassert>
 #include <functional>
@@ -50,6 +51,10 @@
 
 #define PHX_ASSERT(...) assert(__VA_ARGS__)
 
+#ifndef PHX_CACHE_LINE_SIZE
+#define PHX_CACHE_LINE_SIZE 64
+#endif
+
 #ifndef PHX_CONCAT
 #   define PHX_CONCAT(x, y) PHX_CONCAT_INDIRECT(x, y)
 #endif
@@ -90,6 +95,7 @@ namespace Phoenix
     typedef std::string PHXString;
 
     template <class T> using TArray = std::vector<T>;
+    template <class T> using TSpan = std::span<T>;
     template <class T, class THasher = std::hash<T>> using TSet = std::unordered_set<T, THasher>;
     template <class ...TArgs> using TTuple = std::tuple<TArgs...>;
     template <class TKey, class TValue> using TPair = std::pair<TKey, TValue>;
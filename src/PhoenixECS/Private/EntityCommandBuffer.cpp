@@ -0,0 +1,149 @@
+
+#include "EntityCommandBuffer.h"
+
+#include <algorithm>
+
+using namespace Phoenix;
+using namespace Phoenix::ECS;
+
+bool EntityCommand::operator<(const EntityCommand& other) const
+{
+    if (SortKey != other.SortKey)
+        return SortKey < other.SortKey;
+    if (Type != other.Type)
+        return Type < other.Type;
+    if (EntityId != other.EntityId)
+        return (entityid_t)EntityId < (entityid_t)other.EntityId;
+    return (hash32_t)Name < (hash32_t)other.Name;
+}
+
+EntityCommand* EntityCommandBuffer::Record(uint64 sortKey, EEntityCommandType type, EntityId entityId, const FName& name)
+{
+    uint32 index = NumCommands.fetch_add(1);
+    if (index >= Capacity)
+    {
+        return nullptr;
+    }
+
+    EntityCommand& command = Commands[index];
+    command.SortKey = sortKey;
+    command.Type = type;
+    command.EntityId = entityId;
+    command.Name = name;
+    command.PayloadSize = 0;
+    return &command;
+}
+
+EntityId EntityCommandBuffer::CreatePlaceholder()
+{
+    uint32 index = NumPlaceholders.fetch_add(1);
+    if (index >= Capacity)
+    {
+        return EntityId::Invalid;
+    }
+
+    ResolvedPlaceholders[index] = EntityId::Invalid;
+    return EntityId::Make(index, EntityId::PlaceholderGeneration);
+}
+
+EntityId EntityCommandBuffer::Resolve(EntityId entityId) const
+{
+    if (!entityId.IsPlaceholder())
+    {
+        return entityId;
+    }
+
+    uint32 index = entityId.GetIndex();
+    return index < std::min<uint32>(NumPlaceholders, Capacity) ? ResolvedPlaceholders[index] : EntityId::Invalid;
+}
+
+void EntityCommandBuffer::SetResolved(EntityId placeholder, EntityId entityId)
+{
+    PHX_ASSERT(placeholder.IsPlaceholder());
+
+    uint32 index = placeholder.GetIndex();
+    if (index < std::min<uint32>(NumPlaceholders, Capacity))
+    {
+        ResolvedPlaceholders[index] = entityId;
+    }
+}
+
+void EntityCommandBuffer::Sort()
+{
+    // Calculated from the number of recorded commands
+    Commands.SetSize(NumCommands);
+    ResolvedPlaceholders.SetSize(NumPlaceholders);
+
+    std::sort(Commands.begin(), Commands.end());
+}
+
+void EntityCommandBuffer::Reset()
+{
+    Commands.Reset();
+    ResolvedPlaceholders.Reset();
+    NumCommands = 0;
+    NumPlaceholders = 0;
+}
+
+uint32 EntityCommandBuffer::GetNumCommands() const
+{
+    return std::min<uint32>(NumCommands, Capacity);
+}
+
+const EntityCommand* EntityCommandBuffer::begin() const
+{
+    return &Commands[0];
+}
+
+const EntityCommand* EntityCommandBuffer::end() const
+{
+    return &Commands[0] + GetNumCommands();
+}
+
+EntityCommandWriter::EntityCommandWriter(EntityCommandBuffer& buffer, uint32 sourceKey)
+    : Buffer(buffer)
+    , SourceKey(sourceKey)
+{
+}
+
+EntityId EntityCommandWriter::AcquireEntity(const FName& kind)
+{
+    EntityId placeholder = Buffer.CreatePlaceholder();
+    if (placeholder == EntityId::Invalid)
+    {
+        return EntityId::Invalid;
+    }
+
+    return Record(EEntityCommandType::AcquireEntity, placeholder, kind) ? placeholder : EntityId::Invalid;
+}
+
+bool EntityCommandWriter::ReleaseEntity(EntityId entityId)
+{
+    return Record(EEntityCommandType::ReleaseEntity, entityId, FName::None) != nullptr;
+}
+
+bool EntityCommandWriter::AddComponent(EntityId entityId, const FName& componentId)
+{
+    return Record(EEntityCommandType::AddComponent, entityId, componentId) != nullptr;
+}
+
+bool EntityCommandWriter::RemoveComponent(EntityId entityId, const FName& componentId)
+{
+    return Record(EEntityCommandType::RemoveComponent, entityId, componentId) != nullptr;
+}
+
+bool EntityCommandWriter::AddTag(EntityId entityId, const FName& tagName)
+{
+    return Record(EEntityCommandType::AddTag, entityId, tagName) != nullptr;
+}
+
+bool EntityCommandWriter::RemoveTag(EntityId entityId, const FName& tagName)
+{
+    return Record(EEntityCommandType::RemoveTag, entityId, tagName) != nullptr;
+}
+
+EntityCommand* EntityCommandWriter::Record(EEntityCommandType type, EntityId entityId, const FName& name)
+{
+    uint64 sortKey = (uint64(SourceKey) << 32) | Sequence++;
+    return Buffer.Record(sortKey, type, entityId, name);
+}
@@ -18,6 +18,11 @@ namespace FeatureECSDetail
 {
     struct PopulateSortedEntitiesJob : IBufferJob<TransformComponent&>
     {
+        PopulateSortedEntitiesJob()
+        {
+            DeclareWrite<FeatureECSScratchBlock>();
+        }
+
         void Execute(const EntityComponentSpan<TransformComponent&>& span) override
         {
             PHX_PROFILE_ZONE_SCOPED_N("PopulateSortedEntitiesJob");
@@ -169,8 +174,6 @@ void FeatureECS::OnWorldInitialize(WorldRef world)
 {
     PHX_PROFILE_ZONE_SCOPED;
     
-    TaskQueue::CreateTaskQueue((uint32)world.GetName());
-
     for (const TSharedPtr<ISystem>& system : Systems)
     {
         system->OnWorldInitialize(world);
@@ -185,14 +188,16 @@ void FeatureECS::OnWorldShutdown(WorldRef world)
     {
         system->OnWorldShutdown(world);
     }
-    
-    TaskQueue::ReleaseTaskQueue((uint32)world.GetName());
 }
 
 void FeatureECS::OnPreWorldUpdate(WorldRef world, const FeatureUpdateArgs& args)
 {
     PHX_PROFILE_ZONE_SCOPED;
 
+    // Compact at the start of the step rather than the end of the previous one so that component pointers
+    // cached in scratch blocks during the last step stay valid while actions are handled between steps.
+    CompactWorldBuffer(world, bPackArchetypeLists);
+
     SortEntitiesByZCode(world);
 
     SystemUpdateArgs systemUpdateArgs;
@@ -238,7 +243,8 @@ void FeatureECS::OnPostWorldUpdate(WorldRef world, const FeatureUpdateArgs& args
 
     WorldTaskQueue::Flush(world);
 
-    CompactWorldBuffer(world);
+    // All jobs have finished so structural changes recorded during the step can be applied.
+    PlaybackCommands(world);
 }
 
 bool FeatureECS::OnPreHandleWorldAction(WorldRef world, const FeatureActionArgs& action)
@@ -427,6 +433,50 @@ bool FeatureECS::ReleaseEntity(WorldRef world, EntityId entityId)
     return true;
 }
 
+EntityCommandBuffer& FeatureECS::GetCommandBuffer(WorldRef world)
+{
+    FeatureECSScratchBlock& scratchBlock = world.GetBlockRef<FeatureECSScratchBlock>();
+    return scratchBlock.Commands;
+}
+
+uint32 FeatureECS::AcquireEntities(WorldRef world, const FName& kind, uint32 count, TArray<EntityId>& outEntityIds)
+{
+    PHX_PROFILE_ZONE_SCOPED;
+
+    FeatureECSDynamicBlock& block = world.GetBlockRef<FeatureECSDynamicBlock>();
+
+    size_t start = outEntityIds.size();
+    outEntityIds.resize(start + count);
+
+    uint32 numAcquired = block.Entities.Acquire(kind, count, outEntityIds.data() + start);
+    outEntityIds.resize(start + numAcquired);
+
+    // Automatically acquire an archetype if the kind matches one
+    if (block.ArchetypeManager.IsArchetypeRegistered(kind))
+    {
+        for (size_t i = start; i < outEntityIds.size(); ++i)
+        {
+            EntityId entityId = outEntityIds[i];
+            Entity& entity = block.Entities.GetEntityRef(entityId);
+            entity.Handle = block.ArchetypeManager.Acquire(entityId, kind);
+        }
+    }
+
+    return numAcquired;
+}
+
+uint32 FeatureECS::ReleaseEntities(WorldRef world, TSpan<const EntityId> entityIds)
+{
+    PHX_PROFILE_ZONE_SCOPED;
+
+    uint32 numReleased = 0;
+    for (EntityId entityId : entityIds)
+    {
+        numReleased += ReleaseEntity(world, entityId) ? 1 : 0;
+    }
+    return numReleased;
+}
+
 bool FeatureECS::SetEntityKind(WorldRef world, EntityId entityId, const FName& kind)
 {
     FeatureECSDynamicBlock& block = world.GetBlockRef<FeatureECSDynamicBlock>();
@@ -449,6 +499,7 @@ bool FeatureECS::SetEntityKind(WorldRef world, EntityId entityId, const FName& k
     if (block.ArchetypeManager.IsArchetypeRegistered(kind))
     {
         entity->Handle = block.ArchetypeManager.Acquire(entity->GetId(), kind);
+        block.ArchetypeManager.SetTagBits(entity->Handle, entity->TagBits);
     }
 
     return true;
@@ -568,7 +619,9 @@ IComponent* FeatureECS::AddComponent(
         return nullptr;
     }
 
-    return static_cast<IComponent*>(block->ArchetypeManager.AddComponent(entity->Handle, componentType));
+    void* component = block->ArchetypeManager.AddComponent(entity->Handle, componentType);
+    block->ArchetypeManager.SetTagBits(entity->Handle, entity->TagBits);
+    return static_cast<IComponent*>(component);
 }
 
 bool FeatureECS::RemoveComponent(WorldRef world, EntityId entityId, const FName& componentType)
@@ -635,7 +688,13 @@ bool FeatureECS::AddTag(WorldRef world, EntityId entityId, const FName& tagName)
         return false;
     }
 
-    return block->Tags.AddTag(*entity, tagName);
+    if (!block->Tags.AddTag(*entity, tagName))
+    {
+        return false;
+    }
+
+    block->ArchetypeManager.SetTagBits(entity->Handle, entity->TagBits);
+    return true;
 }
 
 bool FeatureECS::RemoveTag(WorldRef world, EntityId entityId, const FName& tagName)
@@ -652,7 +711,13 @@ bool FeatureECS::RemoveTag(WorldRef world, EntityId entityId, const FName& tagNa
         return false;
     }
 
-    return block->Tags.RemoveTag(*entity, tagName);
+    if (!block->Tags.RemoveTag(*entity, tagName))
+    {
+        return false;
+    }
+
+    block->ArchetypeManager.SetTagBits(entity->Handle, entity->TagBits);
+    return true;
 }
 
 uint32 FeatureECS::RemoveAllTags(WorldRef world, EntityId entityId)
@@ -669,7 +734,9 @@ uint32 FeatureECS::RemoveAllTags(WorldRef world, EntityId entityId)
         return 0;
     }
 
-    return block->Tags.RemoveAllTags(*entity);
+    uint32 numTagsRemoved = block->Tags.RemoveAllTags(*entity);
+    block->ArchetypeManager.SetTagBits(entity->Handle, entity->TagBits);
+    return numTagsRemoved;
 }
 
 blackboard_key_t FeatureECS::CreateBlackboardKey(
@@ -686,6 +753,11 @@ bool FeatureECS::HasBlackboardValue(
     const FName& key,
     blackboard_type_t type)
 {
+    if (!IsEntityValid(world, id))
+    {
+        return false;
+    }
+
     const WorldBlackboard& blackboard = FeatureBlackboard::GetBlackboard(world);
     blackboard_key_t fullKey = CreateBlackboardKey(id, key);
     return blackboard.HasValue(BlackboardKeyQuery(fullKey, type));
@@ -698,6 +770,11 @@ bool FeatureECS::SetBlackboardValue(
     blackboard_value_t value,
     blackboard_type_t type)
 {
+    if (!IsEntityValid(world, id))
+    {
+        return false;
+    }
+
     WorldBlackboard& blackboard = FeatureBlackboard::GetBlackboard(world);
     blackboard_key_t fullKey = CreateBlackboardKey(id, key, type);
     return blackboard.SetValue(fullKey, value);
@@ -710,6 +787,11 @@ bool FeatureECS::GetBlackboardValue(
     blackboard_value_t& outValue,
     blackboard_type_t expectedType)
 {
+    if (!IsEntityValid(world, id))
+    {
+        return false;
+    }
+
     const WorldBlackboard& blackboard = FeatureBlackboard::GetBlackboard(world);
     blackboard_key_t fullKey = CreateBlackboardKey(id, key);
     return blackboard.GetValue(BlackboardKeyQuery(fullKey, expectedType), outValue);
@@ -756,8 +838,85 @@ void FeatureECS::SortEntitiesByZCode(WorldRef world)
     WorldTaskQueue::Schedule(world, &FeatureECSDetail::SortEntitiesByZCodeTask);
 }
 
-void FeatureECS::CompactWorldBuffer(WorldRef world)
+void FeatureECS::CompactWorldBuffer(WorldRef world, bool packArchetypeLists)
 {
+    PHX_PROFILE_ZONE_SCOPED;
+
     FeatureECSDynamicBlock& dynamicBlock = world.GetBlockRef<FeatureECSDynamicBlock>();
-    dynamicBlock.ArchetypeManager.Compact();
+
+    if (!packArchetypeLists)
+    {
+        dynamicBlock.ArchetypeManager.Compact();
+        return;
+    }
+
+    // Patch the handles of any entities whose archetype instance was moved.
+    dynamicBlock.ArchetypeManager.Compact([&](EntityId entityId, const ArchetypeHandle& handle)
+    {
+        Entity* entity = dynamicBlock.Entities.GetEntityPtr(entityId);
+        PHX_ASSERT(entity);
+        entity->Handle = handle;
+    });
+}
+
+void FeatureECS::PlaybackCommands(WorldRef world)
+{
+    PHX_PROFILE_ZONE_SCOPED;
+
+    EntityCommandBuffer& commands = GetCommandBuffer(world);
+    if (commands.GetNumCommands() == 0)
+    {
+        commands.Reset();
+        return;
+    }
+
+    // Commands were recorded in whatever order jobs ran in so sort them to keep playback deterministic.
+    commands.Sort();
+
+    for (const EntityCommand& command : commands)
+    {
+        if (command.Type == EEntityCommandType::AcquireEntity)
+        {
+            commands.SetResolved(command.EntityId, AcquireEntity(world, command.Name));
+            continue;
+        }
+
+        EntityId entityId = commands.Resolve(command.EntityId);
+
+        switch (command.Type)
+        {
+            case EEntityCommandType::ReleaseEntity:
+                ReleaseEntity(world, entityId);
+                break;
+            case EEntityCommandType::AddComponent:
+                AddComponent(world, entityId, command.Name);
+                break;
+            case EEntityCommandType::SetComponent:
+            {
+                IComponent* component = GetComponent(world, entityId, command.Name);
+                if (!component)
+                {
+                    component = AddComponent(world, entityId, command.Name);
+                }
+                if (component)
+                {
+                    memcpy(component, command.Payload, command.PayloadSize);
+                }
+                break;
+            }
+            case EEntityCommandType::RemoveComponent:
+                RemoveComponent(world, entityId, command.Name);
+                break;
+            case EEntityCommandType::AddTag:
+                AddTag(world, entityId, command.Name);
+                break;
+            case EEntityCommandType::RemoveTag:
+                RemoveTag(world, entityId, command.Name);
+                break;
+            default:
+                break;
+        }
+    }
+
+    commands.Reset();
 }
@@ -16,6 +16,18 @@ namespace Phoenix
 {
     namespace ECS
     {
+        // Controls how the instances of an archetype are laid out in an archetype list.
+        enum class EArchetypeLayout : uint8
+        {
+            // Array-of-structures; each instance stores its entity id followed by all of its components.
+            // Data: [Entity0][Comp0][Comp1][Entity1][Comp0][Comp1]...
+            Interleaved,
+
+            // Structure-of-arrays; each component is stored in its own contiguous column.
+            // Data: [Entity0][Entity1]...[Comp0][Comp0]...[Comp1][Comp1]...
+            Columnar,
+        };
+
         struct ComponentDefinition
         {
             FName Id = 0;
@@ -34,10 +46,17 @@ namespace Phoenix
         template <uint8 MaxComponents = PHX_ECS_ARCHETYPE_MAX_COMPS>
         struct TArchetypeDefinition
         {
+            static constexpr uint8 MaxNumComponents = MaxComponents;
+
             TArchetypeDefinition() = default;
 
-            TArchetypeDefinition(const FName& id, const ComponentDefinition* comps, uint8 n)
+            TArchetypeDefinition(
+                const FName& id,
+                const ComponentDefinition* comps,
+                uint8 n,
+                EArchetypeLayout layout = EArchetypeLayout::Interleaved)
                 : Id(id)
+                , Layout(layout)
             {
                 PHX_ASSERT(n <= MaxComponents);
 
@@ -50,13 +69,15 @@ namespace Phoenix
             }
 
             template <class ...TComponents>
-            static TArchetypeDefinition Create(const FName& id = FName::None)
+            static TArchetypeDefinition Create(
+                const FName& id = FName::None,
+                EArchetypeLayout layout = EArchetypeLayout::Interleaved)
             {
                 static const ComponentDefinition comps[sizeof...(TComponents)] =
                 {
                     ComponentDefinition::Create<TComponents>()...
                 };
-                return TArchetypeDefinition(id, comps, sizeof...(TComponents));
+                return TArchetypeDefinition(id, comps, sizeof...(TComponents), layout);
             }
 
             // Returns a new archetype definition with the newly added component.
@@ -127,6 +148,11 @@ namespace Phoenix
                 return Id == archetypeIdOrHash || Hash == (hash32_t)archetypeIdOrHash;
             }
 
+            constexpr EArchetypeLayout GetLayout() const
+            {
+                return Layout;
+            }
+
             constexpr uint8 GetNumComponents() const
             {
                 return (uint8)Components.Num();
@@ -158,35 +184,49 @@ namespace Phoenix
                 return Index<uint16>::None;
             }
 
+            // Constructs all components of an instance whose components are tightly packed at data.
             void Construct(void* data) const
             {
-                for (const ComponentDefinition& componentDefinition : Components)
+                for (uint8 i = 0; i < (uint8)Components.Num(); ++i)
                 {
-                    uint8* compDataPtr = static_cast<uint8*>(data) + componentDefinition.Offset;
-                    if (const TypeDescriptor* descriptor = componentDefinition.TypeDescriptor)
-                    {
-                        descriptor->DefaultConstruct(compDataPtr);
-                    }
-                    else
-                    {
-                        memset(compDataPtr, 0, componentDefinition.Size);
-                    }
+                    ConstructComponent(i, static_cast<uint8*>(data) + Components[i].Offset);
                 }
             }
 
+            // Deconstructs all components of an instance whose components are tightly packed at data.
             void Deconstruct(void* data) const
             {
-                for (const ComponentDefinition& componentDefinition : Components)
+                for (uint8 i = 0; i < (uint8)Components.Num(); ++i)
                 {
-                    uint8* compDataPtr = static_cast<uint8*>(data) + componentDefinition.Offset;
-                    if (const TypeDescriptor* descriptor = componentDefinition.TypeDescriptor)
-                    {
-                        descriptor->Destruct(compDataPtr);
-                    }
-                    else
-                    {
-                        memset(compDataPtr, 0, componentDefinition.Size);
-                    }
+                    DeconstructComponent(i, static_cast<uint8*>(data) + Components[i].Offset);
+                }
+            }
+
+            // Constructs a single component at the given address.
+            void ConstructComponent(uint32 index, void* data) const
+            {
+                const ComponentDefinition& componentDefinition = Components[index];
+                if (const TypeDescriptor* descriptor = componentDefinition.TypeDescriptor)
+                {
+                    descriptor->DefaultConstruct(data);
+                }
+                else
+                {
+                    memset(data, 0, componentDefinition.Size);
+                }
+            }
+
+            // Deconstructs a single component at the given address.
+            void DeconstructComponent(uint32 index, void* data) const
+            {
+                const ComponentDefinition& componentDefinition = Components[index];
+                if (const TypeDescriptor* descriptor = componentDefinition.TypeDescriptor)
+                {
+                    descriptor->Destruct(data);
+                }
+                else
+                {
+                    memset(data, 0, componentDefinition.Size);
                 }
             }
 
@@ -223,9 +263,17 @@ namespace Phoenix
                         Id += Components[i].Id;
                     }
                 }
+
+                // Columnar archetypes are stored in their own lists so they can't share a hash with
+                // the interleaved archetype made up of the same components.
+                if (Layout != EArchetypeLayout::Interleaved)
+                {
+                    Hash = Hashing::FN1VA32Combine(Hash, (hash32_t)Layout);
+                }
             }
 
             FName Id;
+            EArchetypeLayout Layout = EArchetypeLayout::Interleaved;
             hash32_t Hash = 0;
             TFixedArray<ComponentDefinition, MaxComponents> Components;
             uint16 TotalSize = 0;
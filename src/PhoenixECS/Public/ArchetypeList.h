@@ -1,9 +1,12 @@
 ﻿
 #pragma once
 
+#include <bit>
+
 #include "ArchetypeHandle.h"
 #include "ArchetypeDefinition.h"
 #include "EntityId.h"
+#include "EntityTag.h"
 #include "Name.h"
 #include "Platform.h"
 
@@ -11,6 +14,10 @@
 #define PHX_ECS_ARCHETYPE_LIST_SIZE 16000
 #endif
 
+#ifndef PHX_ECS_ARCHETYPE_COLUMN_ALIGNMENT
+#define PHX_ECS_ARCHETYPE_COLUMN_ALIGNMENT PHX_CACHE_LINE_SIZE
+#endif
+
 namespace Phoenix
 {
     namespace ECS
@@ -46,14 +53,18 @@ namespace Phoenix
             uint32 NextFree = Index<uint32>::None;
         };
 
-        // Archetype data is tightly packed into the Data buffer.
-        // Data: [Entity0][Comp0][Comp1][Entity1][Comp0][Comp1]...
+        // Archetype data is tightly packed into the Data buffer using the layout of the archetype definition.
+        // Interleaved: [Entity0][Comp0][Comp1][Entity1][Comp0][Comp1]...[TagBits0][TagBits1]...
+        // Columnar:    [Entity0][Entity1]...[NextFree0][NextFree1]...[TagBits0][TagBits1]...[Comp0][Comp0]...[Comp1][Comp1]...
+        // The EntityId of each instance is always found at offset 0 + index * GetEntityIdStride().
         template <class TArchetypeDefinition = ArchetypeDefinition, uint32 N = PHX_ECS_ARCHETYPE_LIST_SIZE>
         class TArchetypeList
         {
         public:
 
             static constexpr size_t Capacity = N;
+            static constexpr uint8 MaxNumComponents = TArchetypeDefinition::MaxNumComponents;
+            static constexpr uint32 ComponentLookupSize = std::bit_ceil(uint32(MaxNumComponents) * 2);
 
             using Handle = ArchetypeHandle;
 
@@ -61,6 +72,7 @@ namespace Phoenix
                 : Id(id)
                 , Definition(definition)
             {
+                InitializeLayout();
             }
 
             uint32 GetId() const
@@ -73,6 +85,17 @@ namespace Phoenix
                 Id = id;
             }
 
+            // Gets the id of the next list in the chain of lists of the same archetype or -1 if this is the last one.
+            uint32 GetNextListId() const
+            {
+                return NextListId;
+            }
+
+            void SetNextListId(uint32 id)
+            {
+                NextListId = id;
+            }
+
             const TArchetypeDefinition& GetDefinition() const
             {
                 return Definition;
@@ -83,6 +106,11 @@ namespace Phoenix
                 return Definition.HasIdOrHash(archetypeIdOrHash);
             }
 
+            constexpr EArchetypeLayout GetLayout() const
+            {
+                return Definition.GetLayout();
+            }
+
             constexpr uint8* GetData()
             {
                 return Data;
@@ -115,7 +143,7 @@ namespace Phoenix
 
             constexpr uint32 GetInstanceCapacity() const
             {
-                return Capacity / GetEntityTotalSize();
+                return InstanceCapacity;
             }
 
             constexpr bool IsValid(const Handle& handle) const
@@ -125,8 +153,7 @@ namespace Phoenix
                     return false;
                 }
 
-                const ArchetypeInstance* instance = GetEntityPtr(handle.Id);
-                return instance && instance->EntityId == handle.EntityId;
+                return GetEntityId(handle.Id) == handle.EntityId;
             }
 
             constexpr bool OwnsHandle(const Handle& handle) const
@@ -148,80 +175,256 @@ namespace Phoenix
                 }
                 
                 Handle handle = { Id, slotIndex, entityId };
-                ArchetypeInstance* instance = GetEntityPtr(handle.Id);
-                instance->EntityId = entityId;
-
-                void* entityComponentDataPtr = GetEntityComponentHeadPtr(handle.Id);
-                PHX_ASSERT(entityComponentDataPtr);
+                GetEntityIdRef(handle.Id) = entityId;
+                GetNextFreeRef(handle.Id) = Index<uint32>::None;
+                GetTagBitsRef(handle.Id) = 0;
 
-                Definition.Construct(entityComponentDataPtr);
+                for (uint8 i = 0; i < Definition.GetNumComponents(); ++i)
+                {
+                    Definition.ConstructComponent(i, GetEntityComponentPtrAt(handle.Id, i));
+                }
 
                 ++NumActiveInstances;
 
                 return handle;
             }
 
+            // Gets the handle of the instance at the given index.
+            constexpr Handle GetHandleAt(uint32 index) const
+            {
+                return { Id, index, GetEntityId(index) };
+            }
+
+            // Returns the number of instances that can still be appended to the end of the list.
+            constexpr uint32 GetNumUnreservedInstances() const
+            {
+                return InstanceCapacity - NumInstances;
+            }
+
+            // Appends instances for up to count entities as a single contiguous run at the end of the list and
+            // constructs their components in place. Free slots between existing instances are left for Compact.
+            // Returns the number of instances that were acquired and the index of the first one in outStartIndex.
+            uint32 AcquireRange(const EntityId* entityIds, uint32 count, uint32& outStartIndex)
+            {
+                uint32 numAcquired = std::min(count, GetNumUnreservedInstances());
+
+                outStartIndex = NumInstances;
+
+                for (uint32 i = 0; i < numAcquired; ++i)
+                {
+                    uint32 slotIndex = outStartIndex + i;
+                    GetEntityIdRef(slotIndex) = entityIds[i];
+                    GetNextFreeRef(slotIndex) = Index<uint32>::None;
+                    GetTagBitsRef(slotIndex) = 0;
+
+                    for (uint8 c = 0; c < Definition.GetNumComponents(); ++c)
+                    {
+                        Definition.ConstructComponent(c, GetEntityComponentPtrAt(slotIndex, c));
+                    }
+                }
+
+                NumInstances += numAcquired;
+                NumActiveInstances += numAcquired;
+
+                return numAcquired;
+            }
+
             bool Release(const Handle& handle)
             {
-                if (!OwnsHandle(handle))
+                if (!OwnsHandle(handle) || handle.Id >= NumInstances)
                 {
                     return false;
                 }
 
-                ArchetypeInstance* instance = GetEntityPtr(handle.Id);
-                if (!instance || instance->EntityId != handle.EntityId)
+                EntityId& instanceEntityId = GetEntityIdRef(handle.Id);
+                if (instanceEntityId != handle.EntityId)
                 {
                     return false;
                 }
 
-                instance->EntityId = EntityId::Invalid;
+                instanceEntityId = EntityId::Invalid;
+
+                tagmask_t& instanceTagBits = GetTagBitsRef(handle.Id);
+                bTagBitsStale |= instanceTagBits != 0;
+                instanceTagBits = 0;
 
                 if (FreeHead == Index<uint32>::None)
                 {
                     FreeHead = FreeTail = handle.Id;
                 }
-                else if (ArchetypeInstance* freeTail = GetEntityPtr(FreeTail))
+                else
                 {
-                    freeTail->NextFree = handle.Id;
+                    GetNextFreeRef(FreeTail) = handle.Id;
                     FreeTail = handle.Id;
                 }
 
-                void* entityComponentDataPtr = GetEntityComponentHeadPtr(handle.Id);
-                PHX_ASSERT(entityComponentDataPtr);
-
-                Definition.Deconstruct(entityComponentDataPtr);
+                for (uint8 i = 0; i < Definition.GetNumComponents(); ++i)
+                {
+                    Definition.DeconstructComponent(i, GetEntityComponentPtrAt(handle.Id, i));
+                }
 
                 --NumActiveInstances;
 
                 return true;
             }
 
-            constexpr void* GetComponent(const Handle& handle, const FName& componentId)
+            // Returns true if there are no free slots between the active instances of the list.
+            constexpr bool IsDense() const
             {
-                if (!IsValid(handle))
+                return NumInstances == NumActiveInstances;
+            }
+
+            // Moves active instances from the back of the list into free slots so that all active instances are
+            // densely packed at the front of the list. Calls onMoved(entityId, newHandle) for each moved instance.
+            // Returns the number of instances that were moved.
+            template <class TCallback>
+            uint32 Compact(const TCallback& onMoved)
+            {
+                if (bTagBitsStale)
                 {
-                    return nullptr;
+                    RebuildTagBits();
                 }
-                uint32 entityCompOffset = GetOffsetToEntityComponent(handle.Id, componentId);
-                if (entityCompOffset == Index<uint32>::None)
+
+                if (IsDense())
                 {
-                    return nullptr;
+                    return 0;
                 }
-                return Data + entityCompOffset;
+
+                uint32 numMoved = 0;
+                uint32 dst = 0;
+                uint32 src = NumInstances;
+                for (;;)
+                {
+                    while (dst < src && GetEntityId(dst) != EntityId::Invalid)
+                    {
+                        ++dst;
+                    }
+
+                    while (src > dst && GetEntityId(src - 1) == EntityId::Invalid)
+                    {
+                        --src;
+                    }
+
+                    if (dst >= src)
+                    {
+                        break;
+                    }
+
+                    EntityId entityId = GetEntityId(src - 1);
+                    MoveInstance(src - 1, dst);
+                    onMoved(entityId, Handle(Id, dst, entityId));
+
+                    ++numMoved;
+                    ++dst;
+                    --src;
+                }
+
+                PHX_ASSERT(src == NumActiveInstances);
+
+                NumInstances = src;
+                FreeHead = FreeTail = Index<uint32>::None;
+
+                return numMoved;
             }
 
-            constexpr const void* GetComponent(const Handle& handle, const FName& componentId) const
+            // Moves the last instance of another, densely packed, list of the same archetype into this list.
+            // Returns the new handle of the instance or an invalid handle if no instance could be moved.
+            Handle TakeLastInstance(TArchetypeList& other)
+            {
+                PHX_ASSERT(other.Definition.GetArchetypeHash() == Definition.GetArchetypeHash());
+
+                if (IsFull() || other.NumInstances == 0 || !other.IsDense())
+                {
+                    return Handle();
+                }
+
+                uint32 slotIndex = FindFreeSlot();
+                if (slotIndex == Index<uint32>::None)
+                {
+                    slotIndex = NumInstances++;
+                }
+
+                uint32 otherIndex = other.NumInstances - 1;
+                EntityId entityId = other.GetEntityId(otherIndex);
+
+                GetEntityIdRef(slotIndex) = entityId;
+                GetNextFreeRef(slotIndex) = Index<uint32>::None;
+                GetTagBitsRef(slotIndex) = other.GetTagBitsAt(otherIndex);
+                TagBits |= GetTagBitsAt(slotIndex);
+
+                for (uint8 i = 0; i < Definition.GetNumComponents(); ++i)
+                {
+                    memcpy(GetEntityComponentPtrAt(slotIndex, i), other.GetEntityComponentPtrAt(otherIndex, i), Definition[i].Size);
+                }
+
+                other.GetEntityIdRef(otherIndex) = EntityId::Invalid;
+                other.bTagBitsStale |= other.GetTagBitsAt(otherIndex) != 0;
+                other.GetTagBitsRef(otherIndex) = 0;
+                --other.NumInstances;
+                --other.NumActiveInstances;
+
+                ++NumActiveInstances;
+
+                return { Id, slotIndex, entityId };
+            }
+
+            // Gets the combined tag bits of every instance in the list. May include bits of tags that were since
+            // removed from instances until the list is compacted.
+            constexpr tagmask_t GetTagBits() const
+            {
+                return TagBits;
+            }
+
+            // Gets the tag bits of an instance. Returns 0 if the handle is not valid.
+            constexpr tagmask_t GetTagBits(const Handle& handle) const
+            {
+                return IsValid(handle) ? GetTagBitsAt(handle.Id) : 0;
+            }
+
+            // Sets the tag bits of an instance. Returns false if the handle is not valid.
+            bool SetTagBits(const Handle& handle, tagmask_t tagBits)
+            {
+                if (!IsValid(handle))
+                {
+                    return false;
+                }
+
+                tagmask_t& instanceTagBits = GetTagBitsRef(handle.Id);
+                bTagBitsStale |= (instanceTagBits & ~tagBits) != 0;
+                instanceTagBits = tagBits;
+                TagBits |= tagBits;
+
+                return true;
+            }
+
+            // Gets the offset of the tag bits of the first instance within the Data buffer.
+            constexpr uint32 GetTagBitsOffset() const
+            {
+                return TagBitsOffset;
+            }
+
+            // Gets the number of bytes between the tag bits of two consecutive instances.
+            constexpr uint32 GetTagBitsStride() const
+            {
+                return TagBitsStride;
+            }
+
+            constexpr void* GetComponent(const Handle& handle, const FName& componentId)
             {
                 if (!IsValid(handle))
                 {
                     return nullptr;
                 }
-                uint32 entityCompOffset = GetOffsetToEntityComponent(handle.Id, componentId);
-                if (entityCompOffset == Index<uint32>::None)
+                return GetComponentUnchecked(handle, componentId);
+            }
+
+            constexpr const void* GetComponent(const Handle& handle, const FName& componentId) const
+            {
+                if (!IsValid(handle))
                 {
                     return nullptr;
                 }
-                return Data + entityCompOffset;
+                return GetComponentUnchecked(handle, componentId);
             }
 
             template <class T>
@@ -244,46 +447,112 @@ namespace Phoenix
                 return sizeof(ArchetypeInstance) + Definition.GetTotalSize();
             }
 
-            // Gets the local offset of a component within an entity in the list.
+            // Gets the number of bytes between the EntityIds of two consecutive instances.
+            constexpr uint32 GetEntityIdStride() const
+            {
+                return EntityIdStride;
+            }
+
+            // Gets the offset of the first instance of a component within the Data buffer.
             // Returns -1 if a component with the given id could not be found.
             constexpr uint32 GetComponentLocalOffset(const FName& componentId) const
             {
-                uint32 index = Definition.IndexOfComponent(componentId);
-                if (!Definition.IsValidIndex(index))
+                uint32 index = IndexOfComponent(componentId);
+                if (index == Index<uint32>::None)
+                {
+                    return Index<uint32>::None;
+                }
+                return ComponentOffsets[index];
+            }
+
+            // Gets the number of bytes between two consecutive instances of a component.
+            // Returns -1 if a component with the given id could not be found.
+            constexpr uint32 GetComponentStride(const FName& componentId) const
+            {
+                uint32 index = IndexOfComponent(componentId);
+                if (index == Index<uint32>::None)
                 {
                     return Index<uint32>::None;
                 }
-                return Definition[index].Offset;
+                return ComponentStrides[index];
+            }
+
+            // Gets the index of a component within the archetype definition using the component lookup table.
+            // Returns -1 if a component with the given id could not be found.
+            constexpr uint32 IndexOfComponent(const FName& componentId) const
+            {
+                for (uint32 i = 0; i < ComponentLookupSize; ++i)
+                {
+                    uint8 index = ComponentLookup[((hash32_t)componentId + i) & (ComponentLookupSize - 1)];
+                    if (index == Index<uint8>::None)
+                    {
+                        break;
+                    }
+                    if (Definition[index].Id == componentId)
+                    {
+                        return index;
+                    }
+                }
+                return Index<uint32>::None;
+            }
+
+            // Gets a component of an entity without validating the handle.
+            // The caller is expected to have checked IsValid(handle) beforehand.
+            constexpr void* GetComponentUnchecked(const Handle& handle, const FName& componentId)
+            {
+                uint32 index = IndexOfComponent(componentId);
+                if (index == Index<uint32>::None)
+                {
+                    return nullptr;
+                }
+                return Data + GetOffsetToEntityComponentAt(handle.Id, index);
+            }
+
+            // Gets a component of an entity without validating the handle.
+            // The caller is expected to have checked IsValid(handle) beforehand.
+            constexpr const void* GetComponentUnchecked(const Handle& handle, const FName& componentId) const
+            {
+                uint32 index = IndexOfComponent(componentId);
+                if (index == Index<uint32>::None)
+                {
+                    return nullptr;
+                }
+                return Data + GetOffsetToEntityComponentAt(handle.Id, index);
             }
 
             void ForEachInstance(TFunction<void(const Handle&)>&& func) const
             {
                 for (uint32 i = 0; i < NumInstances; ++i)
                 {
-                    const ArchetypeInstance* instance = GetEntityPtr(i);
+                    EntityId entityId = GetEntityId(i);
 
-                    if (instance->EntityId == EntityId::Invalid)
+                    if (entityId == EntityId::Invalid)
                     {
                         continue;
                     }
 
-                    func(Handle(Id, i, instance->EntityId));
+                    func(Handle(Id, i, entityId));
                 }
             }
 
             template <class ...TComponents>
-            void ForEachEntity(TFunction<void(EntityId, TComponents...)>&& func)
+            void ForEachEntity(const std::type_identity_t<TFunction<void(EntityId, TComponents...)>>& func, const EntityTagFilter& tagFilter = {})
             {
+                if (!tagFilter.PassesGroupFilter(TagBits))
+                {
+                    return;
+                }
+
                 for (uint32 i = 0; i < NumInstances; ++i)
                 {
-                    ArchetypeInstance* instance = GetEntityPtr(i);
+                    EntityId entityId = GetEntityId(i);
 
-                    if (instance->EntityId == EntityId::Invalid)
+                    if (entityId == EntityId::Invalid || !tagFilter.PassesFilter(GetTagBitsAt(i)))
                     {
                         continue;
                     }
 
-                    func(instance->EntityId, GetComponentRef<TComponents>(i)...);
+                    func(entityId, GetComponentRef<TComponents>(i)...);
                 }
             }
 
@@ -328,14 +597,14 @@ namespace Phoenix
                 Handle result;
                 for (uint32 i = handle.Id; i < NumInstances; ++i)
                 {
-                    ArchetypeInstance* instance = GetEntityPtr(i);
+                    EntityId entityId = GetEntityId(i);
 
-                    if (instance->EntityId == EntityId::Invalid)
+                    if (entityId == EntityId::Invalid)
                     {
                         continue;
                     }
 
-                    result = { Id, i, instance->EntityId };
+                    result = { Id, i, entityId };
                     break;
                 }
 
@@ -387,73 +656,147 @@ namespace Phoenix
 
         private:
 
-            // Gets the total offset to the entity at the given index in the raw Data buffer.
-            constexpr uint32 GetOffsetToEntity(uint32 index) const
+            // Computes the instance capacity and the offset/stride of every column for the layout of the definition.
+            void InitializeLayout()
+            {
+                uint32 numComponents = Definition.GetNumComponents();
+
+                // Build an open-addressed lookup of component id hash to component index.
+                memset(ComponentLookup, Index<uint8>::None, sizeof(ComponentLookup));
+                for (uint32 i = 0; i < numComponents; ++i)
+                {
+                    uint32 slot = (hash32_t)Definition[i].Id & (ComponentLookupSize - 1);
+                    while (ComponentLookup[slot] != Index<uint8>::None)
+                    {
+                        slot = (slot + 1) & (ComponentLookupSize - 1);
+                    }
+                    ComponentLookup[slot] = (uint8)i;
+                }
+
+                if (Definition.GetLayout() == EArchetypeLayout::Columnar)
+                {
+                    // Reserve enough space to align the start of every column.
+                    constexpr uint32 alignment = PHX_ECS_ARCHETYPE_COLUMN_ALIGNMENT;
+                    uint32 padding = (numComponents + 2) * (alignment - 1);
+                    InstanceCapacity = Capacity > padding ? uint32(Capacity - padding) / (GetEntityTotalSize() + sizeof(tagmask_t)) : 0;
+
+                    EntityIdStride = sizeof(EntityId);
+                    NextFreeStride = sizeof(uint32);
+                    NextFreeOffset = InstanceCapacity * EntityIdStride;
+
+                    TagBitsStride = sizeof(tagmask_t);
+                    TagBitsOffset = NextFreeOffset + InstanceCapacity * NextFreeStride;
+                    TagBitsOffset = (TagBitsOffset + alignment - 1) & ~(alignment - 1);
+
+                    uint32 columnOffset = TagBitsOffset + InstanceCapacity * TagBitsStride;
+                    for (uint32 i = 0; i < numComponents; ++i)
+                    {
+                        columnOffset = (columnOffset + alignment - 1) & ~(alignment - 1);
+                        ComponentOffsets[i] = columnOffset;
+                        ComponentStrides[i] = Definition[i].Size;
+                        columnOffset += InstanceCapacity * Definition[i].Size;
+                    }
+
+                    PHX_ASSERT(columnOffset <= Capacity);
+                }
+                else
+                {
+                    // The tag bits are kept in a column after the instances, like the columnar layout, so they
+                    // don't grow the header of every instance.
+                    constexpr uint32 alignment = alignof(tagmask_t);
+                    uint32 padding = alignment - 1;
+                    InstanceCapacity = uint32(Capacity - padding) / (GetEntityTotalSize() + sizeof(tagmask_t));
+
+                    EntityIdStride = GetEntityTotalSize();
+                    NextFreeStride = GetEntityTotalSize();
+                    NextFreeOffset = offsetof(ArchetypeInstance, NextFree);
+
+                    for (uint32 i = 0; i < numComponents; ++i)
+                    {
+                        ComponentOffsets[i] = sizeof(ArchetypeInstance) + Definition[i].Offset;
+                        ComponentStrides[i] = GetEntityTotalSize();
+                    }
+
+                    TagBitsStride = sizeof(tagmask_t);
+                    TagBitsOffset = InstanceCapacity * GetEntityTotalSize();
+                    TagBitsOffset = (TagBitsOffset + alignment - 1) & ~(alignment - 1);
+
+                    PHX_ASSERT(TagBitsOffset + InstanceCapacity * TagBitsStride <= Capacity);
+                }
+            }
+
+            constexpr EntityId GetEntityId(uint32 index) const
             {
-                return uint32(index * GetEntityTotalSize());
+                return *reinterpret_cast<const EntityId*>(Data + index * EntityIdStride);
             }
 
-            // Gets the total offset to the head of the components of an entity in the Data buffer.
-            constexpr uint32 GetOffsetToEntityComponentHead(uint32 index) const
+            constexpr EntityId& GetEntityIdRef(uint32 index)
             {
-                return GetOffsetToEntity(index) + sizeof(ArchetypeInstance);
+                return *reinterpret_cast<EntityId*>(Data + index * EntityIdStride);
             }
 
-            // Gets the total offset to the component of a given entity.
-            constexpr uint32 GetOffsetToEntityComponent(uint32 index, const FName& componentId) const
+            constexpr uint32& GetNextFreeRef(uint32 index)
             {
-                uint32 componentOffset = GetComponentLocalOffset(componentId);
-                if (componentOffset == Index<uint32>::None)
-                {
-                    return Index<uint32>::None;
-                }
-                return GetOffsetToEntityComponentHead(index) + componentOffset;
+                return *reinterpret_cast<uint32*>(Data + NextFreeOffset + index * NextFreeStride);
             }
 
-            // Gets a pointer to the Entity object at a given index.
-            // Returns nullptr if there is no entity at that index.
-            constexpr ArchetypeInstance* GetEntityPtr(uint32 index)
+            constexpr tagmask_t GetTagBitsAt(uint32 index) const
             {
-                uint32 offset = GetOffsetToEntity(index);
-                if (offset == Index<uint32>::None)
-                {
-                    return nullptr;
-                }
-                return reinterpret_cast<ArchetypeInstance*>(Data + offset);
+                return *reinterpret_cast<const tagmask_t*>(Data + TagBitsOffset + index * TagBitsStride);
             }
 
-            // Gets a pointer to the Entity object at a given index.
-            // Returns nullptr if there is no entity at that index.
-            constexpr const ArchetypeInstance* GetEntityPtr(uint32 index) const
+            constexpr tagmask_t& GetTagBitsRef(uint32 index)
             {
-                uint32 offset = GetOffsetToEntity(index);
-                if (offset == Index<uint32>::None)
+                return *reinterpret_cast<tagmask_t*>(Data + TagBitsOffset + index * TagBitsStride);
+            }
+
+            // Recalculates the combined tag bits of the list from the tag bits of the active instances.
+            void RebuildTagBits()
+            {
+                TagBits = 0;
+                for (uint32 i = 0; i < NumInstances; ++i)
                 {
-                    return nullptr;
+                    TagBits |= GetTagBitsAt(i);
                 }
-                return reinterpret_cast<const ArchetypeInstance*>(Data + offset);
+                bTagBitsStale = false;
             }
 
-            // Gets the address of the first component of an entity at a given index.
-            constexpr void* GetEntityComponentHeadPtr(uint32 index)
+            // Moves the entity id and component data of an active instance into a free slot.
+            void MoveInstance(uint32 fromIndex, uint32 toIndex)
             {
-                uint32 offset = GetOffsetToEntityComponentHead(index);
-                if (offset == Index<uint32>::None)
+                GetEntityIdRef(toIndex) = GetEntityId(fromIndex);
+                GetEntityIdRef(fromIndex) = EntityId::Invalid;
+
+                GetTagBitsRef(toIndex) = GetTagBitsAt(fromIndex);
+                GetTagBitsRef(fromIndex) = 0;
+
+                for (uint8 i = 0; i < Definition.GetNumComponents(); ++i)
                 {
-                    return nullptr;
+                    memcpy(GetEntityComponentPtrAt(toIndex, i), GetEntityComponentPtrAt(fromIndex, i), Definition[i].Size);
                 }
-                return Data + offset;
             }
 
-            // Gets the address of the first component of an entity at a given index.
-            constexpr const void* GetEntityComponentHeadPtr(uint32 index) const
+            // Gets the total offset to the component at the given component index of an entity in the Data buffer.
+            constexpr uint32 GetOffsetToEntityComponentAt(uint32 index, uint32 componentIndex) const
             {
-                uint32 offset = GetOffsetToEntityComponentHead(index);
-                if (offset == Index<uint32>::None)
+                return ComponentOffsets[componentIndex] + index * ComponentStrides[componentIndex];
+            }
+
+            // Gets the total offset to the component of a given entity.
+            constexpr uint32 GetOffsetToEntityComponent(uint32 index, const FName& componentId) const
+            {
+                uint32 componentIndex = IndexOfComponent(componentId);
+                if (componentIndex == Index<uint32>::None)
                 {
-                    return nullptr;
+                    return Index<uint32>::None;
                 }
-                return Data + offset;
+                return GetOffsetToEntityComponentAt(index, componentIndex);
+            }
+
+            // Gets the address of the component at the given component index of an entity.
+            constexpr void* GetEntityComponentPtrAt(uint32 index, uint32 componentIndex)
+            {
+                return Data + GetOffsetToEntityComponentAt(index, componentIndex);
             }
 
             // Gets the address of a component of an entity at a given index.
@@ -517,49 +860,103 @@ namespace Phoenix
                 // Shortcut using free list
                 if (FreeHead != Index<uint32>::None)
                 {
-                    if (ArchetypeInstance* freeHead = GetEntityPtr(FreeHead))
+                    PHX_ASSERT(GetEntityId(FreeHead) == EntityId::Invalid);
+
+                    uint32 slotIndex = FreeHead;
+                    if (FreeHead == FreeTail)
                     {
-                        PHX_ASSERT(freeHead->EntityId == EntityId::Invalid);
-
-                        uint32 slotIndex = FreeHead;
-                        if (FreeHead == FreeTail)
-                        {
-                            FreeHead = FreeTail = Index<uint32>::None;
-                        }
-                        else
-                        {
-                            FreeHead = freeHead->NextFree;
-                        }
-                        
-                        return slotIndex;
-                    }                    
+                        FreeHead = FreeTail = Index<uint32>::None;
+                    }
+                    else
+                    {
+                        FreeHead = GetNextFreeRef(FreeHead);
+                    }
+
+                    return slotIndex;
                 }
                 return Index<uint32>::None;
             }
 
             uint32 Id = 0;
+            uint32 NextListId = Index<uint32>::None;
             TArchetypeDefinition Definition;
             uint32 NumInstances = 0;
             uint32 NumActiveInstances = 0;
             uint32 FreeHead = Index<uint32>::None;
             uint32 FreeTail = Index<uint32>::None;
-            uint8 Data[Capacity] = {};
+            uint32 InstanceCapacity = 0;
+            uint32 EntityIdStride = 0;
+            uint32 NextFreeOffset = 0;
+            uint32 NextFreeStride = 0;
+            uint32 TagBitsOffset = 0;
+            uint32 TagBitsStride = 0;
+            tagmask_t TagBits = 0;
+            bool bTagBitsStale = false;
+            uint32 ComponentOffsets[MaxNumComponents] = {};
+            uint32 ComponentStrides[MaxNumComponents] = {};
+            uint8 ComponentLookup[ComponentLookupSize] = {};
+            alignas(PHX_CACHE_LINE_SIZE) uint8 Data[Capacity] = {};
+        };
+
+        // The offsets and strides of a set of components resolved against an archetype list.
+        // Every list of an archetype shares the same layout so a layout only needs to be resolved once per archetype.
+        template <class ...TComponents>
+        struct EntityComponentLayout
+        {
+            template <class TArchetypeList>
+            static EntityComponentLayout Resolve(const TArchetypeList& list)
+            {
+                return
+                {
+                    list.GetEntityIdStride(),
+                    { list.GetComponentLocalOffset(Underlying_T<TComponents>::StaticTypeName)... },
+                    { list.GetComponentStride(Underlying_T<TComponents>::StaticTypeName)... },
+                    list.GetTagBitsOffset(),
+                    list.GetTagBitsStride()
+                };
+            }
+
+            uint32 Step = 0;
+            uint32 Offsets[sizeof...(TComponents)] = {};
+            uint32 Strides[sizeof...(TComponents)] = {};
+            uint32 TagBitsOffset = 0;
+            uint32 TagBitsStride = 0;
         };
 
+        // A view over the instances of an archetype list for a given set of components.
+        // Components can be accessed per entity through iteration or, for columnar archetypes,
+        // as contiguous columns through GetColumn. Iteration skips entities that don't pass the tag filter
+        // of the span; code reading columns directly should test PassesTagFilter for each instance.
         template <class ...TComponents>
         struct EntityComponentSpan
         {
+            using LayoutType = EntityComponentLayout<TComponents...>;
+
+            template <class TArchetypeList>
+            static EntityComponentSpan FromList(TArchetypeList& list, uint32 startingIndex, const EntityTagFilter& tagFilter = {})
+            {
+                return FromList(list, startingIndex, LayoutType::Resolve(list), tagFilter);
+            }
+
+            // Creates a span over a list using a layout that was already resolved for the archetype of the list.
             template <class TArchetypeList>
-            static EntityComponentSpan FromList(TArchetypeList& list, uint32 startingIndex)
+            static EntityComponentSpan FromList(
+                TArchetypeList& list,
+                uint32 startingIndex,
+                const LayoutType& layout,
+                const EntityTagFilter& tagFilter = {})
             {
                 EntityComponentSpan span;
                 span.RawData = list.GetData();
                 span.StartingIndex = startingIndex;
                 span.InstanceCount = list.GetNumInstances();
-                span.Step = list.GetEntityTotalSize();
+                span.Step = layout.Step;
+                span.TagBitsOffset = layout.TagBitsOffset;
+                span.TagBitsStride = layout.TagBitsStride;
+                span.TagFilter = tagFilter;
 
-                uint32 offsets[sizeof...(TComponents)] = { list.GetComponentLocalOffset(Underlying_T<TComponents>::StaticTypeName)... };
-                memcpy(span.Offsets, offsets, sizeof...(TComponents) * sizeof(uint32));
+                memcpy(span.Offsets, layout.Offsets, sizeof...(TComponents) * sizeof(uint32));
+                memcpy(span.Strides, layout.Strides, sizeof...(TComponents) * sizeof(uint32));
 
                 span.CheckRawData();
 
@@ -590,14 +987,69 @@ namespace Phoenix
                 return StartingIndex + localIndex;
             }
 
+            // Returns true if the entity ids and every component of the span are stored in contiguous columns.
+            bool IsColumnar() const
+            {
+                CheckRawData();
+                if (Step != sizeof(EntityId))
+                {
+                    return false;
+                }
+                constexpr uint32 sizes[sizeof...(TComponents)] = { sizeof(Underlying_T<TComponents>)... };
+                for (uint32 i = 0; i < sizeof...(TComponents); ++i)
+                {
+                    if (Strides[i] != sizes[i])
+                    {
+                        return false;
+                    }
+                }
+                return true;
+            }
+
+            // Gets the column of entity ids. Slots that are not in use hold EntityId::Invalid.
+            // Only valid for columnar archetypes.
+            const EntityId* GetEntityIdColumn() const
+            {
+                CheckRawData();
+                PHX_ASSERT(Step == sizeof(EntityId));
+                return reinterpret_cast<const EntityId*>(RawData);
+            }
+
+            const EntityTagFilter& GetTagFilter() const
+            {
+                return TagFilter;
+            }
+
+            // Gets the tag bits of the instance at the given index.
+            tagmask_t GetTagBits(uint32 index) const
+            {
+                CheckRawData();
+                return *reinterpret_cast<const tagmask_t*>(static_cast<uint8*>(RawData) + TagBitsOffset + index * TagBitsStride);
+            }
+
+            // Returns true if the instance at the given index passes the tag filter of the span.
+            bool PassesTagFilter(uint32 index) const
+            {
+                return TagFilter.IsEmpty() || TagFilter.PassesFilter(GetTagBits(index));
+            }
+
+            // Gets the column of the I-th component of the span with GetInstanceCount() elements.
+            // Only valid for columnar archetypes.
+            template <uint8 I>
+            auto* GetColumn() const
+            {
+                CheckRawData();
+                using TComp = std::tuple_element_t<I, TTuple<TComponents...>>;
+                using TColumn = std::conditional_t<std::is_const_v<std::remove_reference_t<TComp>>, const Underlying_T<TComp>, Underlying_T<TComp>>;
+                PHX_ASSERT(Strides[I] == sizeof(Underlying_T<TComp>));
+                return reinterpret_cast<TColumn*>(static_cast<uint8*>(RawData) + Offsets[I]);
+            }
+
             TTuple<EntityId, uint32, TComponents...> operator[](uint32 index) const
             {
                 CheckRawData();
-                uint32 entityOffset = index * Step;
-                uint8* dataPtr = static_cast<uint8*>(RawData) + entityOffset;
-                const ArchetypeInstance* instance = reinterpret_cast<const ArchetypeInstance*>(dataPtr);
-                dataPtr += sizeof(ArchetypeInstance);
-                return MakeTuple(instance->EntityId, index, dataPtr, std::make_index_sequence<sizeof...(TComponents)>{});
+                const EntityId* entityId = reinterpret_cast<const EntityId*>(static_cast<uint8*>(RawData) + index * Step);
+                return MakeTuple(*entityId, index, std::make_index_sequence<sizeof...(TComponents)>{});
             }
 
             struct ConstIter
@@ -656,29 +1108,29 @@ namespace Phoenix
         private:
 
             template <uint8 I, class T>
-            T GetComponentRef(void* data) const
+            T GetComponentRef(uint32 index) const
             {
                 CheckRawData();
-                auto ptr = reinterpret_cast<Underlying_T<T>*>(static_cast<uint8*>(data) + Offsets[I]);
+                auto ptr = reinterpret_cast<Underlying_T<T>*>(static_cast<uint8*>(RawData) + Offsets[I] + index * Strides[I]);
                 return ComponentAccessor<T>::GetComponentRef(ptr);
             }
 
             template <std::size_t ...Is>
-            std::tuple<EntityId, uint32, TComponents...> MakeTuple(EntityId entityId, uint32 index, void* data, std::index_sequence<Is...>) const
+            std::tuple<EntityId, uint32, TComponents...> MakeTuple(EntityId entityId, uint32 index, std::index_sequence<Is...>) const
             {
                 CheckRawData();
-                return { entityId, index, GetComponentRef<Is, TComponents>(data)... };
+                return { entityId, index, GetComponentRef<Is, TComponents>(index)... };
             }
 
             uint32 FindNextActiveEntity(uint32 index) const
             {
                 CheckRawData();
+                bool bFilterTags = !TagFilter.IsEmpty();
                 while (index < InstanceCount)
                 {
-                    uint32 entityOffset = index * Step;
-                    const uint8* dataPtr = static_cast<uint8*>(RawData) + entityOffset;
-                    const ArchetypeInstance* instance = reinterpret_cast<const ArchetypeInstance*>(dataPtr);
-                    if (instance->EntityId != EntityId::Invalid)
+                    const uint8* dataPtr = static_cast<uint8*>(RawData) + index * Step;
+                    if (*reinterpret_cast<const EntityId*>(dataPtr) != EntityId::Invalid &&
+                        (!bFilterTags || TagFilter.PassesFilter(GetTagBits(index))))
                     {
                         break;
                     }
@@ -693,6 +1145,10 @@ namespace Phoenix
             uint32 InstanceCount = 0;
             uint32 Step = 0;
             uint32 Offsets[sizeof...(TComponents)] = {};
+            uint32 Strides[sizeof...(TComponents)] = {};
+            uint32 TagBitsOffset = 0;
+            uint32 TagBitsStride = 0;
+            EntityTagFilter TagFilter;
             void* RawData = nullptr;
         };
 
@@ -24,6 +24,15 @@
 #define PHX_ECS_ARCHETYPE_MGR_MAX_ARCHETYPE_LISTS 1024
 #endif
 
+#ifndef PHX_ECS_ARCHETYPE_MGR_MAX_TRANSITIONS
+#define PHX_ECS_ARCHETYPE_MGR_MAX_TRANSITIONS 256
+#endif
+
+// The maximum number of distinct queries whose matching archetypes are cached. Must be a power of 2.
+#ifndef PHX_ECS_ARCHETYPE_MGR_MAX_CACHED_QUERIES
+#define PHX_ECS_ARCHETYPE_MGR_MAX_CACHED_QUERIES 64
+#endif
+
 namespace Phoenix
 {
     namespace ECS
@@ -51,6 +60,28 @@ namespace Phoenix
             using TEntityHandle = typename TArchetypeList::Handle;
             using TComponentDefMap = TFixedMap<FName, ComponentDefinition, MaxNumComponents>;
             using TArchetypeDefMap = TFixedMap<FName, TArchetypeDefinition, MaxNumArchetypes>;
+            using TTransitionMap = TFixedMap<uint64, hash32_t, PHX_ECS_ARCHETYPE_MGR_MAX_TRANSITIONS>;
+            using TOpenListMap = TFixedMap<hash32_t, uint32, MaxNumArchetypes>;
+
+            // The lists of an archetype are linked together through TArchetypeList::NextListId.
+            struct ArchetypeChain
+            {
+                uint32 HeadListId = Index<uint32>::None;
+                uint32 TailListId = Index<uint32>::None;
+                uint32 NumLists = 0;
+            };
+
+            using TArchetypeChainMap = TFixedMap<hash32_t, ArchetypeChain, MaxNumArchetypes>;
+
+            // The archetypes that passed the component filter of a query as of a version of the manager.
+            struct CachedQuery
+            {
+                uint32 Version = 0;
+                uint32 NumArchetypes = 0;
+                hash32_t Archetypes[MaxNumArchetypes] = {};
+            };
+
+            using TQueryCacheMap = TFixedMap<hash32_t, CachedQuery, PHX_ECS_ARCHETYPE_MGR_MAX_CACHED_QUERIES>;
 
             bool IsValid(TEntityHandle handle) const
             {
@@ -76,6 +107,12 @@ namespace Phoenix
                 return ArchetypeLists.GetNumOccupiedBlocks();
             }
 
+            // Gets the version of the set of archetype lists. Changes whenever a list is allocated or freed.
+            uint32 GetVersion() const
+            {
+                return Version;
+            }
+
             //
             // Archetype Definitions
             //
@@ -197,6 +234,54 @@ namespace Phoenix
                 return list->Acquire(entityId);
             }
 
+            // Acquires an archetype for each of the given entities. Instances are appended in contiguous runs to the
+            // end of the lists of the archetype, allocating new lists as needed. Calls onRange(list, startIndex,
+            // entityOffset, count) for every run where entityOffset is the index of the first entity of the run in
+            // entityIds. Returns the number of entities that were acquired.
+            template <class TCallback>
+            uint32 AcquireBatch(const FName& archetypeIdOrHash, TSpan<const EntityId> entityIds, const TCallback& onRange)
+            {
+                const TArchetypeDefinition* archetypeDef = GetArchetypeDefinition(archetypeIdOrHash);
+                if (!archetypeDef)
+                {
+                    return 0;
+                }
+
+                uint32 count = (uint32)entityIds.size();
+                uint32 numAcquired = 0;
+
+                auto acquireRange = [&](TArchetypeList& list)
+                {
+                    uint32 startIndex;
+                    uint32 n = list.AcquireRange(entityIds.data() + numAcquired, count - numAcquired, startIndex);
+                    if (n > 0)
+                    {
+                        onRange(list, startIndex, numAcquired, n);
+                        numAcquired += n;
+                    }
+                };
+
+                // Fill the remaining space at the end of the existing lists first.
+                FindListInChain(archetypeDef->GetArchetypeHash(), [&](TArchetypeList& list)
+                {
+                    acquireRange(list);
+                    return numAcquired == count;
+                });
+
+                while (numAcquired < count)
+                {
+                    TArchetypeList* list = AllocateArchetypeList(*archetypeDef);
+                    if (!list || list->GetInstanceCapacity() == 0)
+                    {
+                        break;
+                    }
+
+                    acquireRange(*list);
+                }
+
+                return numAcquired;
+            }
+
             // Release an archetype back to the pool
             bool Release(TEntityHandle handle)
             {
@@ -229,9 +314,11 @@ namespace Phoenix
                 {
                     newHandle = newList->Acquire(handle.GetEntityId());
 
-                    // Copy over any component data to the new archetype
+                    // Copy over the tags and any component data to the new archetype
                     if (currList)
                     {
+                        newList->SetTagBits(newHandle, currList->GetTagBits(handle));
+
                         currList->ForEachComponent(handle, [&](const ComponentDefinition& compDef, const void* currComp)
                         {
                             if (void* newComp = newList->GetComponent(newHandle, compDef.Id))
@@ -253,25 +340,19 @@ namespace Phoenix
 
             void* AddComponent(TEntityHandle& inOutHandle, const ComponentDefinition& componentDef)
             {
-                TArchetypeDefinition currArchDef;
-
-                if (const TArchetypeList* currList = FindOwningArchetypeList(inOutHandle))
-                {
-                    currArchDef = currList->GetDefinition();
-                }
+                const TArchetypeList* currList = FindOwningArchetypeList(inOutHandle);
+                const TArchetypeDefinition* currArchDef = currList ? &currList->GetDefinition() : nullptr;
 
-                TArchetypeDefinition newArchDef;
-                if (!TArchetypeDefinition::AddComponent(currArchDef, componentDef, newArchDef))
-                {
-                    // Failed to add the component to the archetype. Could be that the current archetype definition
-                    // already had that component or it can't add any more components.
-                    return nullptr;
-                }
+                const TArchetypeDefinition* archDef = FindOrAddTransition(AddTransitions, currArchDef, componentDef.Id,
+                    [&](const TArchetypeDefinition& baseArchDef, TArchetypeDefinition& outArchDef)
+                    {
+                        // Fails if the current archetype definition already had that component or
+                        // it can't add any more components.
+                        return TArchetypeDefinition::AddComponent(baseArchDef, componentDef, outArchDef);
+                    });
 
-                TArchetypeDefinition* archDef = ArchetypeDefinitions.FindOrAdd(newArchDef.GetArchetypeHash(), newArchDef);
                 if (!archDef)
                 {
-                    // Failed to add the new archetype, probably out of space.
                     return nullptr;
                 }
 
@@ -319,26 +400,36 @@ namespace Phoenix
 
             bool RemoveComponent(TEntityHandle& inOutHandle, const FName& componentId)
             {
-                TArchetypeDefinition currArchDef;
-
                 const TArchetypeList* currList = FindOwningArchetypeList(inOutHandle);
                 if (!currList)
                 {
                     return false;
                 }
 
-                TArchetypeDefinition newArchDef;
-                if (!TArchetypeDefinition::RemoveComponent(currArchDef, componentId, newArchDef))
+                const TArchetypeDefinition& currArchDef = currList->GetDefinition();
+                if (currArchDef.IndexOfComponent(componentId) == Index<uint16>::None)
                 {
-                    // Failed to remove the component from the archetype.
-                    // The current archetype definition must not have the component.
                     return false;
                 }
 
-                TArchetypeDefinition* archDef = ArchetypeDefinitions.FindOrAdd(newArchDef.GetArchetypeHash(), newArchDef);
+                // Removing the last component leaves the entity without an archetype. This is handled before taking
+                // the transition so an empty definition (hash 0, the empty key of the maps) is never registered.
+                if (currArchDef.GetNumComponents() == 1)
+                {
+                    EntityId entityId = inOutHandle.GetEntityId();
+                    RemoveAllComponents(inOutHandle);
+                    inOutHandle = TEntityHandle(entityId);
+                    return true;
+                }
+
+                const TArchetypeDefinition* archDef = FindOrAddTransition(RemoveTransitions, &currArchDef, componentId,
+                    [&](const TArchetypeDefinition& baseArchDef, TArchetypeDefinition& outArchDef)
+                    {
+                        return TArchetypeDefinition::RemoveComponent(baseArchDef, componentId, outArchDef);
+                    });
+
                 if (!archDef)
                 {
-                    // Failed to add the new archetype, probably out of space.
                     return false;
                 }
 
@@ -359,71 +450,67 @@ namespace Phoenix
                 return currList && currList->Release(inOutHandle);
             }
 
-            void* GetComponent(const TEntityHandle& handle, const FName& componentId)
+            // Gets the tag bits mirrored into the archetype list of an entity.
+            tagmask_t GetTagBits(const TEntityHandle& handle) const
             {
-                PHX_PROFILE_ZONE_SCOPED;
+                const TArchetypeList* list = FindOwningArchetypeList(handle);
+                return list ? list->GetTagBits(handle) : 0;
+            }
+
+            // Mirrors the tag bits of an entity into its archetype list so queries can filter by tag.
+            bool SetTagBits(const TEntityHandle& handle, tagmask_t tagBits)
+            {
+                TArchetypeList* list = FindOwningArchetypeList(handle);
+                return list && list->SetTagBits(handle, tagBits);
+            }
 
+            void* GetComponent(const TEntityHandle& handle, const FName& componentId)
+            {
                 TArchetypeList* list = FindOwningArchetypeList(handle);
-                if (!list || !list->IsValid(handle))
+                if (!list)
                 {
                     return nullptr;
                 }
 
-                return list->GetComponent(handle, componentId);
+                return list->GetComponentUnchecked(handle, componentId);
             }
 
             const void* GetComponent(const TEntityHandle& handle, const FName& componentId) const
             {
-                PHX_PROFILE_ZONE_SCOPED;
-
                 const TArchetypeList* list = FindOwningArchetypeList(handle);
-                if (!list || !list->IsValid(handle))
+                if (!list)
                 {
                     return nullptr;
                 }
 
-                return list->GetComponent(handle, componentId);
+                return list->GetComponentUnchecked(handle, componentId);
             }
 
             template <class T>
             T* GetComponent(const TEntityHandle& handle)
             {
-                PHX_PROFILE_ZONE_SCOPED;
-
-                TArchetypeList* list = FindOwningArchetypeList(handle);
-                if (!list || !list->IsValid(handle))
-                {
-                    return nullptr;
-                }
-
-                return list->template GetComponent<T>(handle);
+                return static_cast<T*>(GetComponent(handle, T::StaticTypeName));
             }
 
             template <class T>
             const T* GetComponent(const TEntityHandle& handle) const
             {
-                PHX_PROFILE_ZONE_SCOPED;
-
-                const TArchetypeList* list = FindOwningArchetypeList(handle);
-                if (!list || !list->IsValid(handle))
-                {
-                    return nullptr;
-                }
-
-                return list->template GetComponent<T>(handle);
+                return static_cast<const T*>(GetComponent(handle, T::StaticTypeName));
             }
 
             TArchetypeList* FindFirstArchetypeList(const FName& archetypeIdOrHash, bool includeFullLists = false)
             {
-                for (const TBlockHandle& handle : ArchetypeLists)
+                return FindListInChain(GetArchetypeHashOrSelf(archetypeIdOrHash), [&](const TArchetypeList& list)
                 {
-                    TArchetypeList* list = ArchetypeLists.template GetPtr<TArchetypeList>(handle);
-                    if (list && list->HasArchetypeDefinition(archetypeIdOrHash) && (includeFullLists || !list->IsFull()))
-                    {
-                        return list;
-                    }
-                }
-                return nullptr;
+                    return includeFullLists || !list.IsFull();
+                });
+            }
+
+            // Gets the number of lists that hold instances of the given archetype.
+            uint32 GetNumArchetypeLists(const FName& archetypeIdOrHash) const
+            {
+                const ArchetypeChain* chain = ArchetypeChains.GetPtr(GetArchetypeHashOrSelf(archetypeIdOrHash));
+                return chain ? chain->NumLists : 0;
             }
 
             TArchetypeList* FindOwningArchetypeList(const TEntityHandle& handle)
@@ -467,45 +554,79 @@ namespace Phoenix
             void ForEachArchetypeList(const FName& archetypeIdOrHash, const TFunction<void(TArchetypeList&)>& func)
             {
                 PHX_PROFILE_ZONE_SCOPED;
-                for (const TBlockHandle& handle : ArchetypeLists)
+                FindListInChain(GetArchetypeHashOrSelf(archetypeIdOrHash), [&](TArchetypeList& list)
                 {
-                    TArchetypeList* list = ArchetypeLists.template GetPtr<TArchetypeList>(handle);
-                    if (list && list->HasArchetypeDefinition(archetypeIdOrHash))
+                    func(list);
+                    return false;
+                });
+            }
+
+            // Calls func(list) for each archetype list whose archetype passes the component filter of the query.
+            // The archetypes that pass are cached per query and only filtered again once the version changes.
+            // Updates the cache so it must not be called from jobs running in parallel.
+            template <class TFunc>
+            void ForEachArchetypeList(const EntityQuery& query, const TFunc& func)
+            {
+                const CachedQuery* cachedQuery = FindOrAddCachedQuery(query);
+                if (!cachedQuery)
+                {
+                    // The cache is full so filter every list instead.
+                    for (const TBlockHandle& handle : ArchetypeLists)
                     {
-                        func(*list);
+                        TArchetypeList* list = ArchetypeLists.template GetPtr<TArchetypeList>(handle);
+                        if (list && query.PassesFilter(list->GetDefinition()))
+                        {
+                            func(*list);
+                        }
                     }
+                    return;
+                }
+
+                for (uint32 i = 0; i < cachedQuery->NumArchetypes; ++i)
+                {
+                    FindListInChain(cachedQuery->Archetypes[i], [&](TArchetypeList& list)
+                    {
+                        func(list);
+                        return false;
+                    });
                 }
             }
 
+            // Calls func for each entity that passes the query. Entities are also filtered by their tag bits when a
+            // tag filter resolved from the tags of the query is given.
             template <class ...TComponents>
-            void ForEachEntity(const EntityQuery& query, const TEntityQueryFunc<TComponents...>& func)
+            void ForEachEntity(
+                const EntityQuery& query,
+                const TEntityQueryFunc<TComponents...>& func,
+                const EntityTagFilter& tagFilter = {})
             {
-                for (const TBlockHandle& handle : ArchetypeLists)
+                ForEachArchetypeList(query, [&](TArchetypeList& list)
                 {
-                    TArchetypeList* list = ArchetypeLists.template GetPtr<TArchetypeList>(handle);
-                    if (list && query.PassesFilter(list->GetDefinition()))
+                    if (tagFilter.PassesGroupFilter(list.GetTagBits()))
                     {
-                        list->template ForEachEntity<TComponents...>([&](EntityId entityId, TComponents ...components)
+                        list.template ForEachEntity<TComponents...>([&](EntityId entityId, TComponents ...components)
                         {
                             func(entityId, Forward<TComponents>(components)...);
-                        });
+                        }, tagFilter);
                     }
-                }
+                });
             }
 
             template <class ...TComponents>
-            void ForEachEntity(const EntityQuery& query, const TEntityQueryBufferFunc<TComponents...>& func)
+            void ForEachEntity(
+                const EntityQuery& query,
+                const TEntityQueryBufferFunc<TComponents...>& func,
+                const EntityTagFilter& tagFilter = {})
             {
                 uint32 startingIndex = 0;
-                for (const TBlockHandle& handle : ArchetypeLists)
+                ForEachArchetypeList(query, [&](TArchetypeList& list)
                 {
-                    TArchetypeList* list = ArchetypeLists.template GetPtr<TArchetypeList>(handle);
-                    if (list && query.PassesFilter(list->GetDefinition()))
+                    if (tagFilter.PassesGroupFilter(list.GetTagBits()))
                     {
-                        func(EntityComponentSpan<TComponents...>::FromList(*list, startingIndex));
-                        startingIndex += list->GetNumInstances();
+                        func(EntityComponentSpan<TComponents...>::FromList(list, startingIndex, tagFilter));
+                        startingIndex += list.GetNumInstances();
                     }
-                }
+                });
             }
 
             template <class T>
@@ -532,44 +653,284 @@ namespace Phoenix
                 list->ForEachComponent(handle, callback);
             }
 
-            void Compact()
+            // Called for every entity whose archetype instance moved while compacting.
+            using TEntityMovedFunc = TFunction<void(EntityId, const TEntityHandle&)>;
+
+            // Densely packs the active instances of every archetype and frees any archetype lists left empty.
+            // Instances are first packed to the front of their own list and then moved from the last lists of an
+            // archetype into the free space of earlier lists of the same archetype. Entity handles held by the
+            // caller must be updated from onEntityMoved.
+            void Compact(const TEntityMovedFunc& onEntityMoved)
             {
+                PHX_PROFILE_ZONE_SCOPED;
+
+                for (const TBlockHandle& handle : ArchetypeLists)
+                {
+                    if (TArchetypeList* list = ArchetypeLists.template GetPtr<TArchetypeList>(handle))
+                    {
+                        list->Compact(onEntityMoved);
+                    }
+                }
+
+                TFixedArray<TArchetypeList*, MaxNumArchetypeLists> lists;
+                for (auto && [archetypeHash, chain] : ArchetypeChains)
+                {
+                    lists.Reset();
+                    FindListInChain(archetypeHash, [&](TArchetypeList& list)
+                    {
+                        lists.PushBack(&list);
+                        return false;
+                    });
+
+                    if (lists.IsEmpty())
+                    {
+                        continue;
+                    }
+
+                    // Move instances from the back of the chain into the free space at the front of the chain.
+                    uint32 dst = 0;
+                    uint32 src = (uint32)lists.Num() - 1;
+                    while (dst < src)
+                    {
+                        if (lists[dst]->IsFull())
+                        {
+                            ++dst;
+                            continue;
+                        }
+
+                        if (lists[src]->GetNumActiveInstances() == 0)
+                        {
+                            --src;
+                            continue;
+                        }
+
+                        TEntityHandle handle = lists[dst]->TakeLastInstance(*lists[src]);
+                        PHX_ASSERT(handle.GetEntityId() != EntityId::Invalid);
+                        onEntityMoved(handle.GetEntityId(), handle);
+                    }
+                }
+
                 // Free any archetype lists with no active instances.
+                FreeEmptyArchetypeLists();
+            }
+
+            // Frees any archetype lists with no active instances without moving any instances.
+            void Compact()
+            {
+                FreeEmptyArchetypeLists();
+            }
+
+        private:
+
+            void FreeEmptyArchetypeLists()
+            {
                 for (const TBlockHandle& handle : ArchetypeLists)
                 {
                     TArchetypeList* list = ArchetypeLists.template GetPtr<TArchetypeList>(handle);
                     if (list && list->GetNumActiveInstances() == 0)
                     {
                         ArchetypeLists.Deallocate(handle);
+                        ++Version;
                     }
                 }
 
                 ArchetypeLists.Compact();
-            }
 
-        private:
+                RebuildArchetypeChains();
+                OpenLists.Reset();
+            }
 
-            TArchetypeList* FindOrAddArchetypeList(const FName& archetypeIdOrHash)
+            // Gets the archetypes that pass the component filter of a query, filtering every archetype that has
+            // lists if the set of lists changed since the query was last cached.
+            // Returns nullptr if the query can't be cached.
+            const CachedQuery* FindOrAddCachedQuery(const EntityQuery& query)
             {
-                TArchetypeList* list = FindFirstArchetypeList(archetypeIdOrHash, false);
-                if (list)
+                hash32_t queryHash = query.GetComponentFilterHash();
+                if (queryHash == 0)
                 {
-                    return list;
+                    return nullptr;
                 }
-                
+
+                CachedQuery* cachedQuery = QueryCache.FindOrAddDefaulted(queryHash);
+                if (!cachedQuery || cachedQuery->Version == Version)
+                {
+                    return cachedQuery;
+                }
+
+                PHX_PROFILE_ZONE_SCOPED;
+
+                cachedQuery->Version = Version;
+                cachedQuery->NumArchetypes = 0;
+
+                for (auto && [archetypeHash, chain] : ArchetypeChains)
+                {
+                    const TArchetypeList* head = ArchetypeLists.template GetPtr<TArchetypeList>(TBlockHandle { chain.HeadListId });
+                    if (head && query.PassesFilter(head->GetDefinition()))
+                    {
+                        cachedQuery->Archetypes[cachedQuery->NumArchetypes++] = archetypeHash;
+                    }
+                }
+
+                return cachedQuery;
+            }
+
+            TArchetypeList* FindOrAddArchetypeList(const FName& archetypeIdOrHash)
+            {
                 const TArchetypeDefinition* archetypeDef = GetArchetypeDefinition(archetypeIdOrHash);
                 if (!archetypeDef)
                 {
                     return nullptr;
                 }
-                
-                TBlockHandle handle = ArchetypeLists.template Allocate<TArchetypeList>(archetypeDef->GetArchetypeHash(), *archetypeDef);
-                list = ArchetypeLists.template GetPtr<TArchetypeList>(handle);
+
+                hash32_t archetypeHash = archetypeDef->GetArchetypeHash();
+
+                // Try the last list of the archetype that had room before scanning every list.
+                if (const uint32* listId = OpenLists.GetPtr(archetypeHash))
+                {
+                    TArchetypeList* list = ArchetypeLists.template GetPtr<TArchetypeList>(TBlockHandle { *listId });
+                    if (list && list->HasArchetypeDefinition(archetypeHash) && !list->IsFull())
+                    {
+                        return list;
+                    }
+                }
+
+                TArchetypeList* list = FindFirstArchetypeList(archetypeHash, false);
+                if (!list)
+                {
+                    list = AllocateArchetypeList(*archetypeDef);
+                }
+
+                if (list && archetypeHash != 0)
+                {
+                    OpenLists.Insert(archetypeHash, list->GetId());
+                }
+
+                return list;
+            }
+
+            // Gets the archetype that results from adding or removing a component from an archetype. The destination
+            // archetype is created by makeArchDef the first time the transition is taken and then cached in the given
+            // transition map. A null currArchDef represents an entity without an archetype.
+            // Returns nullptr if the transition isn't possible or the destination archetype couldn't be added.
+            template <class TFunc>
+            const TArchetypeDefinition* FindOrAddTransition(
+                TTransitionMap& transitions,
+                const TArchetypeDefinition* currArchDef,
+                const FName& componentId,
+                const TFunc& makeArchDef)
+            {
+                hash32_t currArchHash = currArchDef ? currArchDef->GetArchetypeHash() : 0;
+                uint64 key = (uint64(currArchHash) << 32) | (hash32_t)componentId;
+
+                if (const hash32_t* archHash = transitions.GetPtr(key))
+                {
+                    if (const TArchetypeDefinition* archDef = ArchetypeDefinitions.GetPtr(*archHash))
+                    {
+                        return archDef;
+                    }
+                }
+
+                TArchetypeDefinition newArchDef;
+                if (!makeArchDef(currArchDef ? *currArchDef : TArchetypeDefinition(), newArchDef))
+                {
+                    return nullptr;
+                }
+
+                TArchetypeDefinition* archDef = ArchetypeDefinitions.FindOrAdd(newArchDef.GetArchetypeHash(), newArchDef);
+                if (!archDef)
+                {
+                    // Failed to add the new archetype, probably out of space.
+                    return nullptr;
+                }
+
+                // The transition map is only a cache so it's fine if the edge can't be added.
+                transitions.Insert(key, archDef->GetArchetypeHash());
+
+                return archDef;
+            }
+
+            TArchetypeList* AllocateArchetypeList(const TArchetypeDefinition& archetypeDef)
+            {
+                TBlockHandle handle = ArchetypeLists.template Allocate<TArchetypeList>(archetypeDef.GetArchetypeHash(), archetypeDef);
+                TArchetypeList* list = ArchetypeLists.template GetPtr<TArchetypeList>(handle);
+                if (!list)
+                {
+                    return nullptr;
+                }
+
                 list->SetId(handle.Id);
+                LinkArchetypeList(*list);
+
+                ++Version;
 
                 return list;
             }
 
+            // Appends a list to the end of the chain of lists of its archetype.
+            void LinkArchetypeList(TArchetypeList& list)
+            {
+                list.SetNextListId(Index<uint32>::None);
+
+                ArchetypeChain* chain = ArchetypeChains.FindOrAddDefaulted(list.GetDefinition().GetArchetypeHash());
+                if (!chain)
+                {
+                    return;
+                }
+
+                if (TArchetypeList* tail = ArchetypeLists.template GetPtr<TArchetypeList>(TBlockHandle { chain->TailListId }))
+                {
+                    tail->SetNextListId(list.GetId());
+                }
+                else
+                {
+                    chain->HeadListId = list.GetId();
+                }
+
+                chain->TailListId = list.GetId();
+                ++chain->NumLists;
+            }
+
+            void RebuildArchetypeChains()
+            {
+                ArchetypeChains.Reset();
+                for (const TBlockHandle& handle : ArchetypeLists)
+                {
+                    if (TArchetypeList* list = ArchetypeLists.template GetPtr<TArchetypeList>(handle))
+                    {
+                        LinkArchetypeList(*list);
+                    }
+                }
+            }
+
+            // Walks the chain of lists of an archetype and returns the first list for which pred(list) returns true.
+            template <class TPredicate>
+            TArchetypeList* FindListInChain(hash32_t archetypeHash, const TPredicate& pred)
+            {
+                const ArchetypeChain* chain = ArchetypeChains.GetPtr(archetypeHash);
+                if (!chain)
+                {
+                    return nullptr;
+                }
+
+                uint32 listId = chain->HeadListId;
+                while (TArchetypeList* list = ArchetypeLists.template GetPtr<TArchetypeList>(TBlockHandle { listId }))
+                {
+                    // Read the next id first in case pred changes the list.
+                    listId = list->GetNextListId();
+                    if (pred(*list))
+                    {
+                        return list;
+                    }
+                }
+                return nullptr;
+            }
+
+            hash32_t GetArchetypeHashOrSelf(const FName& archetypeIdOrHash) const
+            {
+                const TArchetypeDefinition* archetypeDef = GetArchetypeDefinition(archetypeIdOrHash);
+                return archetypeDef ? archetypeDef->GetArchetypeHash() : (hash32_t)archetypeIdOrHash;
+            }
+
             // A mapping of component id to component definition.
             TComponentDefMap ComponentDefinitions;
 
@@ -577,6 +938,23 @@ namespace Phoenix
             TArchetypeDefMap ArchetypeDefinitions;
 
             TArchetypeLists ArchetypeLists;
+
+            // Cached edges of the archetype graph. Maps (archetype hash, component id) to the hash of the archetype
+            // an entity ends up in after adding or removing that component.
+            TTransitionMap AddTransitions;
+            TTransitionMap RemoveTransitions;
+
+            // A mapping of archetype hash to the id of the last list of the archetype that had room for an instance.
+            TOpenListMap OpenLists;
+
+            // A mapping of archetype hash to the chain of lists holding instances of that archetype.
+            TArchetypeChainMap ArchetypeChains;
+
+            // Incremented whenever a list is allocated or freed. Starts at 1 so that new cache entries are stale.
+            uint32 Version = 1;
+
+            // A mapping of query component filter hash to the archetypes that passed the filter.
+            TQueryCacheMap QueryCache;
         };
 
         using ArchetypeManager = TArchetypeManager<>;
@@ -3,6 +3,7 @@
 
 #include "DLLExport.h"
 #include "ArchetypeHandle.h"
+#include "EntityTag.h"
 #include "Name.h"
 
 namespace Phoenix
@@ -13,7 +14,15 @@ namespace Phoenix
         {
             ArchetypeHandle Handle;
             FName Kind;
-            int32 TagHead = INDEX_NONE;
+
+            // The bits of every tag the entity has. Mirrored into the archetype list of the entity.
+            tagmask_t TagBits = 0;
+
+            // The generation of the entity slot. Bumped every time the slot is released.
+            uint32 Generation = 0;
+
+            // The index of the next free entity slot while this slot is not in use.
+            uint32 NextFree = Index<uint32>::None;
 
             constexpr EntityId GetId() const
             {
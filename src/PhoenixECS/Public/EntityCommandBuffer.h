@@ -0,0 +1,150 @@
+
+#pragma once
+
+#include <atomic>
+#include <cstring>
+
+#include "DLLExport.h"
+#include "EntityId.h"
+#include "Name.h"
+#include "Platform.h"
+#include "Containers/FixedArray.h"
+
+#ifndef PHX_ECS_MAX_ENTITY_COMMANDS
+#define PHX_ECS_MAX_ENTITY_COMMANDS 4096
+#endif
+
+#ifndef PHX_ECS_ENTITY_COMMAND_PAYLOAD_SIZE
+#define PHX_ECS_ENTITY_COMMAND_PAYLOAD_SIZE 64
+#endif
+
+namespace Phoenix
+{
+    namespace ECS
+    {
+        enum class EEntityCommandType : uint8
+        {
+            AcquireEntity,
+            ReleaseEntity,
+            AddComponent,
+            SetComponent,
+            RemoveComponent,
+            AddTag,
+            RemoveTag,
+        };
+
+        struct PHOENIXECS_API EntityCommand
+        {
+            // Commands are played back in ascending order of their sort key.
+            uint64 SortKey = 0;
+
+            EEntityCommandType Type = EEntityCommandType::AcquireEntity;
+
+            // The entity the command applies to. Can be a placeholder returned from AcquireEntity.
+            EntityId EntityId;
+
+            // The kind, component id or tag name depending on the type of command.
+            FName Name;
+
+            // The raw component data for SetComponent commands.
+            uint16 PayloadSize = 0;
+            alignas(16) uint8 Payload[PHX_ECS_ENTITY_COMMAND_PAYLOAD_SIZE] = {};
+
+            bool operator<(const EntityCommand& other) const;
+        };
+
+        // Records structural changes (acquiring/releasing entities, adding/removing components and tags) from jobs
+        // that run in parallel so they can be applied later at a sync point. Recording is lock-free and commands are
+        // sorted before being played back so the result doesn't depend on the order jobs happened to run in.
+        struct PHOENIXECS_API EntityCommandBuffer
+        {
+            static constexpr size_t Capacity = PHX_ECS_MAX_ENTITY_COMMANDS;
+
+            // Reserves a new command. Returns nullptr if the buffer is full.
+            EntityCommand* Record(uint64 sortKey, EEntityCommandType type, EntityId entityId, const FName& name);
+
+            // Creates a placeholder id for an entity that will be acquired when the commands are played back.
+            EntityId CreatePlaceholder();
+
+            // Gets the entity id that a placeholder was resolved to during playback.
+            // Ids that are not placeholders are returned as is.
+            EntityId Resolve(EntityId entityId) const;
+
+            // Maps a placeholder to the id of the entity that was acquired for it.
+            void SetResolved(EntityId placeholder, EntityId entityId);
+
+            // Sorts the recorded commands by their sort keys. Must not be called while commands are being recorded.
+            void Sort();
+
+            // Removes all recorded commands and placeholders.
+            void Reset();
+
+            uint32 GetNumCommands() const;
+
+            const EntityCommand* begin() const;
+            const EntityCommand* end() const;
+
+            TFixedArray<EntityCommand, Capacity> Commands;
+            TFixedArray<EntityId, Capacity> ResolvedPlaceholders;
+            TAtomic<uint32> NumCommands = 0;
+            TAtomic<uint32> NumPlaceholders = 0;
+        };
+
+        // Records commands into an EntityCommandBuffer on behalf of a single source, typically the entity that a job
+        // is currently processing. Commands are ordered by source key and then by the order they were recorded in
+        // by the writer, so each source should only be written to by one writer per step.
+        class PHOENIXECS_API EntityCommandWriter
+        {
+        public:
+
+            EntityCommandWriter(EntityCommandBuffer& buffer, uint32 sourceKey);
+
+            // Acquires a new entity of the given kind. Returns a placeholder id that can be used as the target of
+            // other commands from the same buffer or EntityId::Invalid if the buffer is full.
+            EntityId AcquireEntity(const FName& kind);
+
+            bool ReleaseEntity(EntityId entityId);
+
+            bool AddComponent(EntityId entityId, const FName& componentId);
+
+            // Adds the component to the entity if needed and then copies the value into it.
+            // The component type must already be registered with the archetype manager of the world.
+            template <class T>
+            bool SetComponent(EntityId entityId, const T& value)
+            {
+                static_assert(sizeof(T) <= PHX_ECS_ENTITY_COMMAND_PAYLOAD_SIZE, "Component is too large to be set from a command.");
+                static_assert(alignof(T) <= 16, "Component alignment exceeds the alignment of the command payload.");
+
+                EntityCommand* command = Record(EEntityCommandType::SetComponent, entityId, T::StaticTypeName);
+                if (!command)
+                {
+                    return false;
+                }
+
+                command->PayloadSize = sizeof(T);
+                memcpy(command->Payload, &value, sizeof(T));
+                return true;
+            }
+
+            bool RemoveComponent(EntityId entityId, const FName& componentId);
+
+            template <class T>
+            bool RemoveComponent(EntityId entityId)
+            {
+                return RemoveComponent(entityId, T::StaticTypeName);
+            }
+
+            bool AddTag(EntityId entityId, const FName& tagName);
+
+            bool RemoveTag(EntityId entityId, const FName& tagName);
+
+        private:
+
+            EntityCommand* Record(EEntityCommandType type, EntityId entityId, const FName& name);
+
+            EntityCommandBuffer& Buffer;
+            uint32 SourceKey = 0;
+            uint32 Sequence = 0;
+        };
+    }
+}
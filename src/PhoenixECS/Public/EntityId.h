@@ -10,13 +10,45 @@ namespace Phoenix
     {
         typedef uint32 entityid_t;
         
+        // Entity ids are made up of the index of the entity slot in the low bits and the generation of the slot
+        // in the high bits. The generation is bumped whenever a slot is released so that stale ids held onto by
+        // scripts or the blackboard never alias a newer entity occupying the same slot.
         struct PHOENIXECS_API EntityId
         {
             static const EntityId Invalid;
 
+            static constexpr uint32 IndexBits = 16;
+            static constexpr uint32 GenerationBits = 32 - IndexBits;
+            static constexpr entityid_t IndexMask = (1u << IndexBits) - 1;
+            static constexpr entityid_t GenerationMask = (1u << GenerationBits) - 1;
+
+            // The generation reserved for placeholder ids handed out by entity command buffers.
+            // Entity slots never reach this generation.
+            static constexpr uint32 PlaceholderGeneration = GenerationMask;
+
             constexpr EntityId() : Id(0) {}
             constexpr EntityId(entityid_t raw) : Id(raw) {}
 
+            static constexpr EntityId Make(uint32 index, uint32 generation)
+            {
+                return EntityId(((generation & GenerationMask) << IndexBits) | (index & IndexMask));
+            }
+
+            constexpr uint32 GetIndex() const
+            {
+                return Id & IndexMask;
+            }
+
+            constexpr uint32 GetGeneration() const
+            {
+                return Id >> IndexBits;
+            }
+
+            constexpr bool IsPlaceholder() const
+            {
+                return GetGeneration() == PlaceholderGeneration;
+            }
+
             operator entityid_t() const;
             EntityId& operator=(const entityid_t& id);
 
@@ -6,8 +6,11 @@
 
 #include "Platform.h"
 #include "ArchetypeDefinition.h"
+#include "Hashing.h"
+#include "EntityTag.h"
 #include "Name.h"
 #include "Optional.h"
+#include "Parallel.h"
 #include "Profiling.h"
 
 namespace Phoenix
@@ -70,8 +73,6 @@ namespace Phoenix
             template <class TArchetypeDefinition = ArchetypeDefinition>
             bool PassesFilter(const TArchetypeDefinition& definition) const
             {
-                PHX_PROFILE_ZONE_SCOPED;
-
                 // None
                 if (!ComponentsNone.Items.empty())
                 {
@@ -137,8 +138,60 @@ namespace Phoenix
                 return true;
             }
 
+            // Returns true if the archetype of the list passes the filter and the list may contain entities that
+            // pass the tag filter. Entities within the list still need to be tested against the tag filter.
+            template <class TArchetypeList>
+            bool PassesFilter(const TArchetypeList& list, const EntityTagFilter& tagFilter) const
+            {
+                return tagFilter.PassesGroupFilter(list.GetTagBits()) && PassesFilter(list.GetDefinition());
+            }
+
+            bool HasTagFilter() const
+            {
+                return !TagsAll.Items.empty() || !TagsAny.Items.empty() || !TagsNone.Items.empty();
+            }
+
+            // Resolves the tags of the query into a filter of tag bits using the tag bits assigned by a tag list.
+            template <class TTagList>
+            EntityTagFilter CreateTagFilter(const TTagList& tagList) const
+            {
+                if (!HasTagFilter())
+                {
+                    return {};
+                }
+                return tagList.CreateFilter(TagsAll.Items, TagsAny.Items, TagsNone.Items);
+            }
+
+            // Gets a hash of the component requirements of the query. Queries with the same hash match the same
+            // archetypes so the hash is used to cache the archetypes that pass the filter.
+            hash32_t GetComponentFilterHash() const
+            {
+                return ComponentFilterHash;
+            }
+
+            // Adds the components that the query reads and writes to the access set. Components that are only used
+            // to exclude archetypes are never accessed.
+            void GetComponentAccess(TaskAccess& outAccess) const
+            {
+                for (const EntityQueryFilterComponentSet* set : { &ComponentsAll, &ComponentsAny })
+                {
+                    for (auto && [id, access] : set->Items)
+                    {
+                        if ((uint8)access & (uint8)EComponentAccess::Write)
+                        {
+                            outAccess.AddWrite(id);
+                        }
+                        else if ((uint8)access & (uint8)EComponentAccess::Read)
+                        {
+                            outAccess.AddRead(id);
+                        }
+                    }
+                }
+            }
+
             void Reset()
             {
+                ComponentFilterHash = 0;
                 ArchetypeId.Reset();
                 EntityName.Reset();
                 ComponentsAll.Items.clear();
@@ -153,6 +206,22 @@ namespace Phoenix
 
             friend class EntityQueryBuilder;
 
+            void UpdateComponentFilterHash()
+            {
+                hash32_t hash = Hashing::basis32;
+                for (const EntityQueryFilterComponentSet* set : { &ComponentsAll, &ComponentsAny, &ComponentsNone })
+                {
+                    // Separate the sets so that moving a component from one set to another changes the hash.
+                    hash = Hashing::FNV1A32((uint32)set->Items.size(), hash);
+                    for (auto && [id, access] : set->Items)
+                    {
+                        hash = Hashing::FNV1A32((hash32_t)id, hash);
+                    }
+                }
+                ComponentFilterHash = hash;
+            }
+
+            hash32_t ComponentFilterHash = 0;
             TOptional<FName> ArchetypeId;
             TOptional<FName> EntityName;
             EntityQueryFilterComponentSet ComponentsAll;
@@ -243,6 +312,7 @@ namespace Phoenix
                 Query.ComponentsAll.AddAll(set);
                 Query.ComponentsAny.RemoveAll(set);
                 Query.ComponentsNone.RemoveAll(set);
+                Query.UpdateComponentFilterHash();
                 return *this;
             }
 
@@ -254,11 +324,21 @@ namespace Phoenix
                 return RequireAllComponents(set);
             }
 
+            // Requires all of the components with the access implied by each type, where const T& is read only.
+            template <class ...TComponents>
+            EntityQueryBuilder& RequireAllComponentRefs()
+            {
+                EntityQueryFilterComponentSet set;
+                ((set.Items.push_back(std::make_tuple(Underlying_T<TComponents>::StaticTypeName, ComponentAccessFromT<TComponents>::ComponentAccess))), ...);
+                return RequireAllComponents(set);
+            }
+
             EntityQueryBuilder& RequireAnyComponents(const EntityQueryFilterComponentSet& set)
             {
                 Query.ComponentsAny.AddAll(set);
                 Query.ComponentsAll.RemoveAll(set);
                 Query.ComponentsNone.RemoveAll(set);
+                Query.UpdateComponentFilterHash();
                 return *this;
             }
 
@@ -275,6 +355,7 @@ namespace Phoenix
                 Query.ComponentsNone.AddAll(set);
                 Query.ComponentsAll.RemoveAll(set);
                 Query.ComponentsAny.RemoveAll(set);
+                Query.UpdateComponentFilterHash();
                 return *this;
             }
 
@@ -283,7 +364,7 @@ namespace Phoenix
             {
                 EntityQueryFilterComponentSet set;
                 ((set.Items.push_back(std::make_tuple(Underlying_T<TComponents>::StaticTypeName, access))), ...);
-                return RequireAnyComponents(set);
+                return RequireNoneComponents(set);
             }
 
         private:
@@ -3,15 +3,54 @@
 
 #include "DLLExport.h"
 #include "Name.h"
+#include "Platform.h"
 
 namespace Phoenix
 {
     namespace ECS
     {
+        // Every tag is assigned a bit the first time it is added to an entity.
+        // The tags of an entity are stored as a mask of those bits.
+        typedef uint64 tagmask_t;
+
         struct PHOENIXECS_API EntityTag
         {
             FName TagName;
-            int32 Next = INDEX_NONE;
+            uint8 Bit = Index<uint8>::None;
+        };
+
+        // The tag requirements of a query resolved into masks of tag bits.
+        // An empty filter passes every entity.
+        struct PHOENIXECS_API EntityTagFilter
+        {
+            tagmask_t All = 0;
+            tagmask_t Any = 0;
+            tagmask_t None = 0;
+
+            // Creates a filter that no entity can pass, used when a required tag was never assigned a bit.
+            static constexpr EntityTagFilter MatchNothing()
+            {
+                // No mask can contain every bit and none of the bits at the same time.
+                return { ~tagmask_t(0), 0, ~tagmask_t(0) };
+            }
+
+            constexpr bool IsEmpty() const
+            {
+                return (All | Any | None) == 0;
+            }
+
+            // Returns true if an entity with the given tag bits passes the filter.
+            constexpr bool PassesFilter(tagmask_t tagBits) const
+            {
+                return (tagBits & All) == All && (tagBits & None) == 0 && (Any == 0 || (tagBits & Any) != 0);
+            }
+
+            // Returns true if any entity in a group whose combined tag bits are given could pass the filter.
+            // Used to skip whole archetype lists without visiting their entities.
+            constexpr bool PassesGroupFilter(tagmask_t combinedTagBits) const
+            {
+                return (combinedTagBits & All) == All && (All & None) == 0 && (Any == 0 || (combinedTagBits & Any) != 0);
+            }
         };
     }
-}
\ No newline at end of file
+}
@@ -3,6 +3,7 @@
 
 #include "DLLExport.h"
 #include "Entity.h"
+#include "EntityCommandBuffer.h"
 #include "Features.h"
 #include "FixedTagList.h"
 #include "ArchetypeManager.h"
@@ -17,8 +18,16 @@
 #define PHX_ECS_MAX_ENTITIES INT16_MAX
 #endif
 
+// The maximum number of distinct tags in use at the same time, at most 64. Each tag is assigned one bit of the tag
+// mask of an entity while any entity has the tag. Adding another tag once every bit is in use asserts and fails.
 #ifndef PHX_ECS_MAX_TAGS
-#define PHX_ECS_MAX_TAGS (INT16_MAX << 1)
+#define PHX_ECS_MAX_TAGS 64
+#endif
+
+// The target number of archetype instances processed by a single task of a parallel job.
+// Small archetype lists are batched together until they reach this size.
+#ifndef PHX_ECS_JOB_BATCH_SIZE
+#define PHX_ECS_JOB_BATCH_SIZE 512
 #endif
 
 namespace Phoenix
@@ -44,6 +53,9 @@ namespace Phoenix
 
             TFixedArray<EntityTransform, PHX_ECS_MAX_ENTITIES> SortedEntities;
             TAtomic<uint32> SortedEntityCount = 0;
+
+            // Structural changes recorded by jobs during the step. Played back at the end of the step.
+            EntityCommandBuffer Commands;
         };
 
         struct PHOENIXECS_API FeatureECSCtorArgs
@@ -67,6 +79,7 @@ namespace Phoenix
                 FEATURE_CHANNEL(FeatureChannels::DebugRender)
                 PHX_REGISTER_FIELD(bool, bDebugDrawMortonCodeBoundaries)
                 PHX_REGISTER_FIELD(bool, bDebugDrawEntityZCodes)
+                PHX_REGISTER_FIELD(bool, bPackArchetypeLists)
             PHX_FEATURE_END()
 
         public:
@@ -120,8 +133,99 @@ namespace Phoenix
             static EntityId AcquireEntity(WorldRef world, const FName& kind);
             static bool ReleaseEntity(WorldRef world, EntityId entityId);
 
+            // Acquires up to count entities of the given kind and appends their ids to outEntityIds.
+            // Returns the number of entities that were acquired.
+            static uint32 AcquireEntities(WorldRef world, const FName& kind, uint32 count, TArray<EntityId>& outEntityIds);
+
+            // Releases each of the given entities. Returns the number of entities that were released.
+            static uint32 ReleaseEntities(WorldRef world, TSpan<const EntityId> entityIds);
+
+            // Spawns count entities of the given kind directly into contiguous instances of the archetype of the kind
+            // and calls initializer for each new entity with its components. If the kind is not a registered archetype
+            // then an archetype made up of the components of the initializer is registered for it.
+            // Appends the ids of the new entities to outEntityIds and returns the number of entities that were spawned.
+            template <class ...TComponents>
+            static uint32 SpawnBatch(
+                WorldRef world,
+                const FName& kind,
+                uint32 count,
+                TArray<EntityId>& outEntityIds,
+                const std::type_identity_t<TEntityQueryFunc<TComponents...>>& initializer)
+            {
+                PHX_PROFILE_ZONE_SCOPED;
+
+                FeatureECSDynamicBlock* block = world.GetBlock<FeatureECSDynamicBlock>();
+                if (!block)
+                {
+                    return 0;
+                }
+
+                const ArchetypeDefinition* archetypeDef = block->ArchetypeManager.GetArchetypeDefinition(kind);
+                if (!archetypeDef)
+                {
+                    ArchetypeDefinition newArchetypeDef = ArchetypeDefinition::Create<Underlying_T<TComponents>...>(kind);
+                    if (!block->ArchetypeManager.RegisterArchetypeDefinition(newArchetypeDef))
+                    {
+                        return 0;
+                    }
+                    archetypeDef = block->ArchetypeManager.GetArchetypeDefinitionByHash(newArchetypeDef.GetArchetypeHash());
+                }
+
+                // Every component passed to the initializer must be part of the archetype.
+                if (((archetypeDef->IndexOfComponent(Underlying_T<TComponents>::StaticTypeName) == Index<uint16>::None) || ...))
+                {
+                    return 0;
+                }
+
+                size_t start = outEntityIds.size();
+                outEntityIds.resize(start + count);
+
+                uint32 numEntities = block->Entities.Acquire(kind, count, outEntityIds.data() + start);
+                TSpan<const EntityId> entityIds(outEntityIds.data() + start, numEntities);
+
+                using SpanType = EntityComponentSpan<TComponents...>;
+                typename SpanType::LayoutType layout;
+                bool bLayoutResolved = false;
+
+                uint32 numSpawned = block->ArchetypeManager.AcquireBatch(
+                    archetypeDef->GetArchetypeHash(),
+                    entityIds,
+                    [&](ArchetypeList& list, uint32 startIndex, uint32 entityOffset, uint32 n)
+                    {
+                        // Every list of the archetype shares the same layout.
+                        if (!bLayoutResolved)
+                        {
+                            layout = SpanType::LayoutType::Resolve(list);
+                            bLayoutResolved = true;
+                        }
+
+                        SpanType span = SpanType::FromList(list, 0, layout);
+                        for (uint32 i = 0; i < n; ++i)
+                        {
+                            EntityId entityId = entityIds[entityOffset + i];
+                            block->Entities.GetEntityRef(entityId).Handle = list.GetHandleAt(startIndex + i);
+
+                            std::apply([&](EntityId, uint32, auto&&... components)
+                            {
+                                initializer(entityId, components...);
+                            }, span[startIndex + i]);
+                        }
+                    });
+
+                // Give back any entities that didn't fit into the archetype lists.
+                block->Entities.Release(entityIds.subspan(numSpawned));
+
+                outEntityIds.resize(start + numSpawned);
+
+                return numSpawned;
+            }
+
             static bool SetEntityKind(WorldRef world, EntityId entityId, const FName& kind);
 
+            // Gets the command buffer that jobs can record structural changes into while running in parallel.
+            // Recorded commands are played back in OnPostWorldUpdate after all jobs have finished.
+            static EntityCommandBuffer& GetCommandBuffer(WorldRef world);
+
             template <class ...TComponents>
             static void ForEachEntity(WorldRef world, const EntityQuery& query, const TEntityQueryFunc<TComponents...>& func)
             {
@@ -131,7 +235,7 @@ namespace Phoenix
                     return;
                 }
 
-                return block->ArchetypeManager.ForEachEntity<TComponents...>(query, func);
+                return block->ArchetypeManager.ForEachEntity<TComponents...>(query, func, query.CreateTagFilter(block->Tags));
             }
 
             template <class ...TComponents>
@@ -143,7 +247,7 @@ namespace Phoenix
                     return;
                 }
 
-                return block->ArchetypeManager.ForEachEntity<TComponents...>(query, func);
+                return block->ArchetypeManager.ForEachEntity<TComponents...>(query, func, query.CreateTagFilter(block->Tags));
             }
 
             //
@@ -153,9 +257,12 @@ namespace Phoenix
             static bool RegisterArchetypeDefinition(WorldRef world, const ArchetypeDefinition& definition);
 
             template <class ...TComponents>
-            static bool RegisterArchetypeDefinition(WorldRef world, const FName& id = FName::None)
+            static bool RegisterArchetypeDefinition(
+                WorldRef world,
+                const FName& id = FName::None,
+                EArchetypeLayout layout = EArchetypeLayout::Interleaved)
             {
-                return RegisterArchetypeDefinition(world, ArchetypeDefinition::Create<TComponents...>(id));
+                return RegisterArchetypeDefinition(world, ArchetypeDefinition::Create<TComponents...>(id, layout));
             }
 
             static bool UnregisterArchetypeDefinition(WorldRef world, const ArchetypeDefinition& definition);
@@ -178,16 +285,38 @@ namespace Phoenix
             template <class T>
             static T* GetComponent(WorldRef world, EntityId entityId)
             {
-                IComponent* comp = GetComponent(world, entityId, T::StaticTypeName);
-                return static_cast<T*>(comp);
+                FeatureECSDynamicBlock* block = world.GetBlock<FeatureECSDynamicBlock>();
+                if (!block)
+                {
+                    return nullptr;
+                }
+
+                Entity* entity = block->Entities.GetEntityPtr(entityId);
+                if (!entity)
+                {
+                    return nullptr;
+                }
+
+                return block->ArchetypeManager.GetComponent<T>(entity->Handle);
             }
 
             // Gets the pointer to a component on an entity if it exists.
             template <class T>
             static const T* GetComponent(WorldConstRef world, EntityId entityId)
             {
-                const IComponent* comp = GetComponent(world, entityId, T::StaticTypeName);
-                return static_cast<const T*>(comp);
+                const FeatureECSDynamicBlock* block = world.GetBlock<FeatureECSDynamicBlock>();
+                if (!block)
+                {
+                    return nullptr;
+                }
+
+                const Entity* entity = block->Entities.GetEntityPtr(entityId);
+                if (!entity)
+                {
+                    return nullptr;
+                }
+
+                return block->ArchetypeManager.GetComponent<T>(entity->Handle);
             }
 
             // Gets a reference to a component on an entity if it exists.
@@ -225,7 +354,9 @@ namespace Phoenix
                     return nullptr;
                 }
 
-                return block->ArchetypeManager.AddComponent<T>(entity->Handle, defaultValue);
+                T* component = block->ArchetypeManager.AddComponent<T>(entity->Handle, defaultValue);
+                block->ArchetypeManager.SetTagBits(entity->Handle, entity->TagBits);
+                return component;
             }
 
             // Adds a new component to an entity.
@@ -244,7 +375,9 @@ namespace Phoenix
                     return nullptr;
                 }
 
-                return block->ArchetypeManager.EmplaceComponent<T, TArgs...>(entity->Handle, args...);
+                T* component = block->ArchetypeManager.EmplaceComponent<T, TArgs...>(entity->Handle, args...);
+                block->ArchetypeManager.SetTagBits(entity->Handle, entity->TagBits);
+                return component;
             }
 
             // Removes a component from an entity.
@@ -330,6 +463,8 @@ namespace Phoenix
             // Blackboard helpers
             //
 
+            // Only the index and the low 8 bits of the generation of the entity fit into a blackboard key, so a
+            // stale id can alias the key of a live entity. The helpers below ignore entities that aren't alive.
             static Blackboard::blackboard_key_t CreateBlackboardKey(
                 const EntityId& id,
                 const FName& key,
@@ -361,6 +496,11 @@ namespace Phoenix
                 const FName& key,
                 const T& value)
             {
+                if (!IsEntityValid(world, id))
+                {
+                    return false;
+                }
+
                 Blackboard::WorldBlackboard& blackboard = Blackboard::FeatureBlackboard::GetBlackboard(world);
                 Blackboard::blackboard_key_t fullKey = CreateBlackboardKey(id, key);
                 return blackboard.SetValue<T>(fullKey, value);
@@ -380,6 +520,11 @@ namespace Phoenix
                 const FName& key,
                 T& outValue)
             {
+                if (!IsEntityValid(world, id))
+                {
+                    return false;
+                }
+
                 const Blackboard::WorldBlackboard& blackboard = Blackboard::FeatureBlackboard::GetBlackboard(world);
                 Blackboard::blackboard_key_t fullKey = CreateBlackboardKey(id, key);
                 return blackboard.GetValue<T>(fullKey, outValue);
@@ -392,6 +537,11 @@ namespace Phoenix
                 const FName& key,
                 bool checkType = true)
             {
+                if (!IsEntityValid(world, id))
+                {
+                    return false;
+                }
+
                 Blackboard::WorldBlackboard& blackboard = Blackboard::FeatureBlackboard::GetBlackboard(world);
                 Blackboard::blackboard_key_t fullKey = CreateBlackboardKey(id, key);
                 return blackboard.RemoveValue<T>(fullKey, checkType);
@@ -404,64 +554,104 @@ namespace Phoenix
             template <class TJob>
             static void Schedule(WorldRef world, const TJob& job)
             {
-                TSharedPtr<TaskQueue> taskQueue = TaskQueue::GetTaskQueue((uint32)world.GetName());
+                TaskQueue* taskQueue = world.GetTaskQueue();
 
                 FeatureECSDynamicBlock& dynamicBlock = world.GetBlockRef<FeatureECSDynamicBlock>();
                 WorldPtr worldPtr = &world;
 
-                uint32 startIndex = 0;
-                dynamicBlock.ArchetypeManager.ForEachArchetypeList([&](auto& list)
+                ForEachCompiledList(dynamicBlock, job, [&](ArchetypeList& list, auto&& execute)
                 {
-                    if (job.GetQuery().PassesFilter(list.GetDefinition()))
+                    TJob jobInstance = job;
+                    auto wrapper = [=]() mutable
                     {
-                        TJob jobInstance = job;
-                        auto listPtr = &list;
-                        auto wrapper = [=]() mutable
-                        {
-                            static_cast<IEntityJobBase*>(&jobInstance)->Execute(*worldPtr, *listPtr, startIndex);
-                        };
+                        execute(jobInstance, *worldPtr);
+                    };
 
-                        taskQueue->Enqueue(std::move(wrapper));
-
-                        startIndex += list.GetNumInstances();
-                    }
+                    taskQueue->Enqueue(std::move(wrapper));
                 });
             }
 
+            // Runs copies of the job over the matching archetype lists in parallel. The job only waits for the tasks
+            // scheduled before it whose access conflicts with the access of the job.
             template <class TJob>
             static void ScheduleParallel(WorldRef world, const TJob& job)
             {
                 PHX_PROFILE_ZONE_SCOPED;
 
-                TSharedPtr<TaskQueue> taskQueue = TaskQueue::GetTaskQueue((uint32)world.GetName());
+                using TRunBatch = void (*)(TJob&, WorldRef, const uint8*, uint32);
+
+                TaskQueue* taskQueue = world.GetTaskQueue();
 
                 FeatureECSDynamicBlock& dynamicBlock = world.GetBlockRef<FeatureECSDynamicBlock>();
                 WorldPtr worldPtr = &world;
 
+                // Only waits for the jobs scheduled before it that touch the same components or blocks.
+                taskgroupid_t groupId = taskQueue->AddEmptyGroup(job.GetAccess());
+                std::vector<Task>& taskGroup = taskQueue->GetGroupTasks(groupId);
+
+                // The executes of every list and the job copies are kept in the scratch memory of the queue until it
+                // is flushed. Each task only holds a batch of them so it stays small enough to be stored inline.
                 uint32 numArchetypeLists = dynamicBlock.ArchetypeManager.GetNumArchetypeLists();
-                std::vector<Task>& taskGroup = taskQueue->BeginGroup(numArchetypeLists);
+                uint8* executes = nullptr;
+                size_t executeSize = 0;
+                TRunBatch runBatch = nullptr;
+                uint32 numExecutes = 0;
 
-                uint32 startIndex = 0;
-                dynamicBlock.ArchetypeManager.ForEachArchetypeList([&](ArchetypeList& list)
+                // Lists are batched into tasks of roughly PHX_ECS_JOB_BATCH_SIZE instances so that the number of
+                // tasks doesn't depend on how many instances fit into a single archetype list.
+                uint32 batchStart = 0;
+                uint32 batchSize = 0;
+
+                auto pushBatch = [&]()
                 {
-                    if (job.GetQuery().PassesFilter(list.GetDefinition()))
+                    PHX_PROFILE_ZONE_SCOPED_N("PushTaskToTaskGroup");
+
+                    TJob* jobInstance = taskQueue->NewScratch<TJob>(job);
+                    const uint8* batch = executes + batchStart * executeSize;
+                    uint32 batchCount = numExecutes - batchStart;
+
+                    taskGroup.emplace_back([jobInstance, batch, batchCount, runBatch, worldPtr]
                     {
-                        PHX_PROFILE_ZONE_SCOPED_N("PushTaskToTaskGroup");
+                        runBatch(*jobInstance, *worldPtr, batch, batchCount);
+                    });
 
-                        TJob jobInstance = job;
-                        auto listPtr = &list;
-                        auto wrapper = [=]() mutable
+                    batchStart = numExecutes;
+                    batchSize = 0;
+                };
+
+                ForEachCompiledList(dynamicBlock, job, [&](ArchetypeList& list, auto&& execute)
+                {
+                    using TExecute = std::decay_t<decltype(execute)>;
+                    static_assert(std::is_trivially_destructible_v<TExecute>, "Executes are never destroyed.");
+
+                    if (!executes)
+                    {
+                        executes = static_cast<uint8*>(taskQueue->AllocateScratch(sizeof(TExecute) * numArchetypeLists, alignof(TExecute)));
+                        executeSize = sizeof(TExecute);
+                        runBatch = [](TJob& jobInstance, WorldRef world, const uint8* batch, uint32 batchCount)
                         {
-                            static_cast<IEntityJobBase*>(&jobInstance)->Execute(*worldPtr, *listPtr, startIndex);
+                            for (uint32 i = 0; i < batchCount; ++i)
+                            {
+                                reinterpret_cast<const TExecute*>(batch)[i](jobInstance, world);
+                            }
                         };
+                    }
 
-                        taskGroup.emplace_back(std::move(wrapper));
+                    PHX_ASSERT(numExecutes < numArchetypeLists);
+                    new (executes + numExecutes * executeSize) TExecute(execute);
+                    ++numExecutes;
 
-                        startIndex += list.GetNumInstances();
+                    batchSize += list.GetNumActiveInstances();
+                    if (batchSize >= PHX_ECS_JOB_BATCH_SIZE)
+                    {
+                        pushBatch();
                     }
                 });
 
-                taskQueue->EndGroup();
+                if (numExecutes > batchStart)
+                {
+                    pushBatch();
+                }
             }
 
             static void QueryEntitiesInRange(WorldConstRef& world, const Vec2& pos, Distance range, TArray<EntityTransform>& outEntities);
@@ -469,11 +659,63 @@ namespace Phoenix
             bool bDebugDrawMortonCodeBoundaries = false;
             bool bDebugDrawEntityZCodes = false;
 
+            // When enabled, the active instances of each archetype are densely packed once per step so that
+            // iteration cost scales with the number of live entities rather than the peak number of entities.
+            bool bPackArchetypeLists = true;
+
         private:
 
             static void SortEntitiesByZCode(WorldRef world);
 
-            static void CompactWorldBuffer(WorldRef world);
+            static void CompactWorldBuffer(WorldRef world, bool packArchetypeLists);
+
+            static void PlaybackCommands(WorldRef world);
+
+            // Calls func(list, execute) for each archetype list that passes the query of the job, where
+            // execute(jobInstance, world) runs a copy of the job over that list. The lists that pass the query are
+            // cached by the archetype manager. Jobs that declare a compiled query type get their spans created up
+            // front so component offsets are resolved once per archetype and entities that don't pass the tags of
+            // the query are skipped.
+            template <class TJob, class TFunc>
+            static void ForEachCompiledList(FeatureECSDynamicBlock& block, const TJob& job, const TFunc& func)
+            {
+                uint32 startIndex = 0;
+                EntityTagFilter tagFilter = job.GetQuery().CreateTagFilter(block.Tags);
+
+                if constexpr (requires { typename TJob::CompiledQueryType; })
+                {
+                    typename TJob::CompiledQueryType compiledQuery(job.GetQuery(), tagFilter);
+                    block.ArchetypeManager.ForEachArchetypeList(job.GetQuery(), [&](ArchetypeList& list)
+                    {
+                        if (compiledQuery.PassesTagFilter(list))
+                        {
+                            auto span = compiledQuery.CreateSpan(list, startIndex);
+                            func(list, [span](TJob& jobInstance, WorldRef world)
+                            {
+                                jobInstance.ExecuteSpan(world, span);
+                            });
+
+                            startIndex += list.GetNumInstances();
+                        }
+                    });
+                }
+                else
+                {
+                    block.ArchetypeManager.ForEachArchetypeList(job.GetQuery(), [&](ArchetypeList& list)
+                    {
+                        if (tagFilter.PassesGroupFilter(list.GetTagBits()))
+                        {
+                            ArchetypeList* listPtr = &list;
+                            func(list, [listPtr, startIndex](TJob& jobInstance, WorldRef world)
+                            {
+                                static_cast<IEntityJobBase*>(&jobInstance)->Execute(world, *listPtr, startIndex);
+                            });
+
+                            startIndex += list.GetNumInstances();
+                        }
+                    });
+                }
+            }
 
             TArray<TSharedPtr<ISystem>> Systems;
             TSharedPtr<ThreadPool> JobThreadPool;
@@ -8,6 +8,8 @@ namespace Phoenix
 {
     namespace ECS
     {
+        // Entity slots are handed out from an intrusive free list so acquiring and releasing entities is O(1).
+        // Slot 0 is reserved so that EntityId::Invalid never refers to an entity.
         template <size_t N>
         class FixedEntityList
         {
@@ -15,6 +17,8 @@ namespace Phoenix
 
             static constexpr size_t Capacity = N;
 
+            static_assert(Capacity <= EntityId::IndexMask + 1, "FixedEntityList capacity exceeds the range of EntityId indices.");
+
             constexpr size_t GetSize() const
             {
                 return Entities.Num();
@@ -32,7 +36,7 @@ namespace Phoenix
 
             static constexpr int32 GetEntityIndex(EntityId entityId)
             {
-                return entityId % Capacity;
+                return entityId.GetIndex();
             }
             
             constexpr Entity* GetEntityPtr(EntityId entityId)
@@ -69,34 +73,39 @@ namespace Phoenix
 
             constexpr EntityId Acquire(const FName& kind)
             {
-                // Find the first invalid entity index
-                uint32 entityIdx = 1;
-                for (; entityIdx < Capacity; ++entityIdx)
-                {
-                    if (Entities[entityIdx].GetId() == EntityId::Invalid)
-                    {
-                        break;
-                    }
-                }
-
-                if (entityIdx == Capacity)
+                uint32 entityIdx = AllocateSlot();
+                if (entityIdx == Index<uint32>::None)
                 {
                     return EntityId::Invalid;
                 }
 
-                if (!Entities.IsValidIndex(entityIdx))
-                {
-                    Entities.SetNum(entityIdx + 1);
-                }
-
                 Entity& entity = Entities[entityIdx];
+                EntityId entityId = EntityId::Make(entityIdx, entity.Generation);
                 entity.Kind = kind;
-                entity.Handle = ArchetypeHandle(entityIdx);
-                entity.TagHead = INDEX_NONE;
+                entity.Handle = ArchetypeHandle(entityId);
+                entity.TagBits = 0;
+                entity.NextFree = Index<uint32>::None;
 
                 ++NumActiveEntities;
 
-                return entityIdx;
+                return entityId;
+            }
+
+            // Acquires up to count entities of the given kind and writes their ids to outEntityIds.
+            // Returns the number of entities that were acquired.
+            constexpr uint32 Acquire(const FName& kind, uint32 count, EntityId* outEntityIds)
+            {
+                uint32 numAcquired = 0;
+                for (; numAcquired < count; ++numAcquired)
+                {
+                    EntityId entityId = Acquire(kind);
+                    if (entityId == EntityId::Invalid)
+                    {
+                        break;
+                    }
+                    outEntityIds[numAcquired] = entityId;
+                }
+                return numAcquired;
             }
 
             constexpr bool Release(EntityId entityId)
@@ -106,20 +115,65 @@ namespace Phoenix
                     return false;
                 }
 
-                int32 index = GetEntityIndex(entityId);
+                uint32 index = GetEntityIndex(entityId);
                 Entity& entity = Entities[index];
                 entity.Kind = FName::None;
                 entity.Handle = ArchetypeHandle();
 
+                // Bump the generation so that the released id no longer matches the slot.
+                // The placeholder generation is skipped so that slots never produce a placeholder id.
+                entity.Generation = (entity.Generation + 1) % EntityId::PlaceholderGeneration;
+
+                entity.NextFree = FreeHead;
+                FreeHead = index;
+
                 --NumActiveEntities;
 
                 return true;
             }
 
+            // Releases each of the given entities. Returns the number of entities that were released.
+            constexpr uint32 Release(TSpan<const EntityId> entityIds)
+            {
+                uint32 numReleased = 0;
+                for (EntityId entityId : entityIds)
+                {
+                    numReleased += Release(entityId) ? 1 : 0;
+                }
+                return numReleased;
+            }
+
         private:
 
+            // Returns the index of a free entity slot or Index<uint32>::None if the list is full.
+            constexpr uint32 AllocateSlot()
+            {
+                if (FreeHead != Index<uint32>::None)
+                {
+                    uint32 index = FreeHead;
+                    FreeHead = Entities[index].NextFree;
+                    return index;
+                }
+
+                // Reserve slot 0 for EntityId::Invalid.
+                if (Entities.IsEmpty())
+                {
+                    Entities.SetNum(1);
+                }
+
+                if (Entities.Num() == Capacity)
+                {
+                    return Index<uint32>::None;
+                }
+
+                uint32 index = (uint32)Entities.Num();
+                Entities.SetNum(index + 1);
+                return index;
+            }
+
             TFixedArray<Entity, Capacity> Entities;
             size_t NumActiveEntities = 0;
+            uint32 FreeHead = Index<uint32>::None;
         };
     }
 }
@@ -1,187 +1,211 @@
 ﻿
 #pragma once
 
+#include <bit>
+
+#include "Entity.h"
 #include "EntityId.h"
 #include "EntityTag.h"
 #include "Containers/FixedArray.h"
+#include "Containers/FixedMap.h"
 
 namespace Phoenix
 {
     namespace ECS
     {
+        // Assigns every tag a bit the first time it is used and stores the tags of each entity as a mask of those
+        // bits on the entity. Testing, adding and removing tags are all constant time bit operations.
+        // Each bit counts the entities that have its tag and is freed for other tags once the last of them loses it,
+        // so N limits the number of distinct tags in use at the same time.
         template <size_t N>
         class FixedTagList
         {
         public:
 
+            static_assert(N <= sizeof(tagmask_t) * 8, "Tag bits must fit into a tagmask_t.");
+
             static constexpr size_t Capacity = N;
 
+            // Gets the number of tags that have been assigned a bit.
             constexpr size_t GetSize() const
             {
-                return Tags.Num();
+                return (size_t)std::popcount(UsedBits);
             }
 
+            // Gets the number of tags added to entities.
             constexpr size_t GetNumActive() const
             {
                 return NumActiveTags;
             }
 
+            // Gets the bit mask of a tag. Returns 0 if no entity has the tag.
+            tagmask_t GetTagMask(const FName& tagName) const
+            {
+                const uint8* bit = TagBits.GetPtr(tagName);
+                return bit ? tagmask_t(1) << *bit : 0;
+            }
+
             bool HasTag(const Entity& entity, const FName& tagName) const
             {
-                bool foundTag = false;
-                ForEachTag(entity, [&](const EntityTag& tag, int32)
-                {
-                    if (tag.TagName == tagName)
-                    {
-                        foundTag = true;
-                        return false;
-                    }
-                    return true;
-                });
-                return foundTag;
+                return (entity.TagBits & GetTagMask(tagName)) != 0;
             }
 
+            // Adds the tag to the entity. Returns false if the entity already has the tag or if every bit is in use
+            // by other tags.
             bool AddTag(Entity& entity, const FName& tagName)
             {
-                int32 newTagIndex = INDEX_NONE;
+                tagmask_t mask = FindOrAddTagMask(tagName);
 
-                // Find the next available tag index
+                // Entity already has the tag, don't add duplicates
+                if (mask == 0 || (entity.TagBits & mask) != 0)
                 {
-                    for (size_t i = 1; i < Capacity; ++i)
-                    {
-                        if (Tags[i].TagName == FName::None)
-                        {
-                            newTagIndex = (int32)i;
-                            break;
-                        }
-                    }
-
-                    if (newTagIndex == INDEX_NONE)
-                    {
-                        return false;
-                    }
+                    return false;
                 }
 
-                if (entity.TagHead == INDEX_NONE)
+                entity.TagBits |= mask;
+                ++TagRefCounts[std::countr_zero(mask)];
+                ++NumActiveTags;
+
+                return true;
+            }
+
+            bool RemoveTag(Entity& entity, const FName& tagName)
+            {
+                tagmask_t mask = GetTagMask(tagName);
+                if ((entity.TagBits & mask) == 0)
                 {
-                    entity.TagHead = newTagIndex;
+                    return false;
                 }
-                else
-                {
-                    // Find the tail tag and update it's next
-                    int32 tagIter = entity.TagHead;
-                    while (Tags[tagIter].Next != INDEX_NONE)
-                    {
-                        // Entity already has the tag, don't add duplicates
-                        if (Tags[tagIter].TagName == tagName)
-                        {
-                            return false;
-                        }
 
-                        tagIter = Tags[tagIter].Next;
-                    }
-                    Tags[tagIter].Next = newTagIndex;
-                }
+                entity.TagBits &= ~mask;
+                ReleaseBit((uint8)std::countr_zero(mask));
+                --NumActiveTags;
+
+                return true;
+            }
+
+            uint32 RemoveAllTags(Entity& entity)
+            {
+                uint32 numTagsRemoved = (uint32)std::popcount(entity.TagBits);
 
-                // Make room for the new tag if necessary
-                if (!Tags.IsValidIndex(newTagIndex))
+                tagmask_t tagBits = entity.TagBits;
+                while (tagBits != 0)
                 {
-                    Tags.SetNum(newTagIndex + 1);
+                    ReleaseBit((uint8)std::countr_zero(tagBits));
+                    tagBits &= tagBits - 1;
                 }
 
-                EntityTag& tag = Tags[newTagIndex];
-                tag.Next = INDEX_NONE;
-                tag.TagName = tagName;
+                NumActiveTags -= numTagsRemoved;
+                entity.TagBits = 0;
 
-                ++NumActiveTags;
-
-                return true;
+                return numTagsRemoved;
             }
 
-            bool RemoveTag(Entity& entity, FName tagName)
+            // Calls callback(tag, bit) for each tag of the entity until the callback returns false.
+            template <class TCallback>
+            void ForEachTag(const Entity& entity, const TCallback& callback) const
             {
-                int32 prevTagIndex = INDEX_NONE;
-                int32 tagIndex = INDEX_NONE;
-                ForEachTag(entity, [&, tagName](const EntityTag& tag, uint32 index)
+                tagmask_t tagBits = entity.TagBits;
+                while (tagBits != 0)
                 {
-                    tagIndex = index;
-                    if (tag.TagName == tagName)
+                    int32 bit = std::countr_zero(tagBits);
+                    if (!callback(Tags[bit], bit))
                     {
-                        return false;
+                        return;
                     }
-                    prevTagIndex = tagIndex;
-                    return true;
-                });
-
-                if (tagIndex == INDEX_NONE)
-                {
-                    return false;
+                    tagBits &= tagBits - 1;
                 }
+            }
 
-                EntityTag& tagToRemove = Tags[tagIndex];
+            // Resolves the tags of a query into a filter of tag bits.
+            template <class TTagSet>
+            EntityTagFilter CreateFilter(const TTagSet& all, const TTagSet& any, const TTagSet& none) const
+            {
+                EntityTagFilter filter;
 
-                if (prevTagIndex != INDEX_NONE)
+                for (const FName& tagName : all)
                 {
-                    EntityTag& prevTag = Tags[prevTagIndex];
-                    prevTag.Next = tagToRemove.Next;
+                    tagmask_t mask = GetTagMask(tagName);
+
+                    // No entity can have a tag that was never assigned a bit.
+                    if (mask == 0)
+                    {
+                        return EntityTagFilter::MatchNothing();
+                    }
+
+                    filter.All |= mask;
                 }
 
-                if (entity.TagHead == tagIndex)
+                for (const FName& tagName : any)
                 {
-                    entity.TagHead = prevTagIndex;
+                    filter.Any |= GetTagMask(tagName);
                 }
 
-                // Reset tag data
-                tagToRemove.TagName = FName::None;
-                tagToRemove.Next = INDEX_NONE;
+                if (filter.Any == 0 && std::begin(any) != std::end(any))
+                {
+                    return EntityTagFilter::MatchNothing();
+                }
 
-                --NumActiveTags;
+                for (const FName& tagName : none)
+                {
+                    filter.None |= GetTagMask(tagName);
+                }
 
-                return true;
-                
+                return filter;
             }
 
-            uint32 RemoveAllTags(Entity& entity)
-            {
-                int32 tagIndex = entity.TagHead;
+        private:
 
-                uint32 numTagsRemoved = 0;
-                while (tagIndex != INDEX_NONE)
+            // Gets the bit mask of a tag, assigning the lowest free bit to the tag if it doesn't have one yet.
+            // Returns 0 if there are no bits left.
+            tagmask_t FindOrAddTagMask(const FName& tagName)
+            {
+                if (tagmask_t mask = GetTagMask(tagName))
                 {
-                    EntityTag& tag = Tags[tagIndex];
-
-                    tagIndex = tag.Next;
-                    numTagsRemoved++;
-                    --NumActiveTags;
+                    return mask;
+                }
 
-                    // Reset tag data
-                    tag.TagName = FName::None;
-                    tag.Next = INDEX_NONE;
+                if (tagName == FName::None)
+                {
+                    return 0;
                 }
 
-                entity.TagHead = INDEX_NONE;
+                if (GetSize() == Capacity)
+                {
+                    PHX_ASSERT(!"Out of tag bits, too many distinct tags are in use. Raise PHX_ECS_MAX_TAGS (up to 64).");
+                    return 0;
+                }
 
-                return numTagsRemoved;
+                uint8 bit = (uint8)std::countr_one(UsedBits);
+                UsedBits |= tagmask_t(1) << bit;
+                Tags[bit] = { tagName, bit };
+                TagRefCounts[bit] = 0;
+                TagBits.Insert(tagName, bit);
+                return tagmask_t(1) << bit;
             }
 
-            template <class TCallback>
-            void ForEachTag(const Entity& entity, const TCallback& callback) const
+            // Frees the bit once no entity has its tag anymore so another tag can use it.
+            void ReleaseBit(uint8 bit)
             {
-                int32 tagIndex = entity.TagHead;
-                while (tagIndex != INDEX_NONE)
+                PHX_ASSERT(TagRefCounts[bit] > 0);
+                if (--TagRefCounts[bit] > 0)
                 {
-                    const EntityTag& tag = Tags[tagIndex];
-                    if (!callback(tag, tagIndex))
-                    {
-                        return;
-                    }
-                    tagIndex = tag.Next;
+                    return;
                 }
+
+                TagBits.Remove(Tags[bit].TagName);
+                Tags[bit] = EntityTag();
+                UsedBits &= ~(tagmask_t(1) << bit);
             }
 
-        private:
+            static constexpr size_t TagBitsCapacity = std::bit_ceil(Capacity * 2);
+
+            // Indexed by bit.
+            EntityTag Tags[Capacity];
+            uint32 TagRefCounts[Capacity] = {};
+            tagmask_t UsedBits = 0;
 
-            TFixedArray<EntityTag, Capacity> Tags;
+            TFixedMap<FName, uint8, TagBitsCapacity> TagBits;
             size_t NumActiveTags = 0;
         };
     }
@@ -5,11 +5,103 @@
 #include "EntityId.h"
 #include "Worlds.h"
 #include "ArchetypeManager.h"
+#include "Containers/FixedMap.h"
 
 namespace Phoenix
 {
     namespace ECS
     {
+        // An entity query over a fixed set of components that resolves the filter result and component layout
+        // of each archetype it encounters only once. Every list of an archetype shares the same layout so
+        // creating spans over many lists of the same archetype does no component lookups after the first.
+        // Lists are also filtered by the tag filter of the query and spans skip entities that don't pass it.
+        template <class ...TComponents>
+        class TCompiledEntityQuery
+        {
+        public:
+
+            using SpanType = EntityComponentSpan<TComponents...>;
+            using LayoutType = typename SpanType::LayoutType;
+
+            TCompiledEntityQuery(const EntityQuery& query, const EntityTagFilter& tagFilter = {})
+                : Query(query)
+                , TagFilter(tagFilter)
+            {
+            }
+
+            const EntityQuery& GetQuery() const
+            {
+                return Query;
+            }
+
+            // Returns true if the archetype of the list passes the query filter and the list may contain entities
+            // that pass the tag filter.
+            bool PassesFilter(const ArchetypeList& list)
+            {
+                if (!PassesTagFilter(list))
+                {
+                    return false;
+                }
+
+                CompiledArchetype* compiled = Compile(list);
+                if (!compiled)
+                {
+                    return false;
+                }
+
+                if (!compiled->bFilterEvaluated)
+                {
+                    compiled->bPassesFilter = Query.PassesFilter(list.GetDefinition());
+                    compiled->bFilterEvaluated = true;
+                }
+                return compiled->bPassesFilter;
+            }
+
+            // Returns true if the list may contain entities that pass the tag filter. Used for lists that are
+            // already known to pass the component filter of the query.
+            bool PassesTagFilter(const ArchetypeList& list) const
+            {
+                return TagFilter.PassesGroupFilter(list.GetTagBits());
+            }
+
+            // Creates a span over the list using the layout compiled for the archetype of the list.
+            SpanType CreateSpan(ArchetypeList& list, uint32 startIndex)
+            {
+                if (const CompiledArchetype* compiled = Compile(list))
+                {
+                    return SpanType::FromList(list, startIndex, compiled->Layout, TagFilter);
+                }
+                return SpanType::FromList(list, startIndex, TagFilter);
+            }
+
+        private:
+
+            struct CompiledArchetype
+            {
+                // The filter is only evaluated on demand since lists from a cached query are known to pass it.
+                bool bFilterEvaluated = false;
+                bool bPassesFilter = false;
+                LayoutType Layout;
+            };
+
+            CompiledArchetype* Compile(const ArchetypeList& list)
+            {
+                hash32_t archetypeHash = list.GetDefinition().GetArchetypeHash();
+                if (CompiledArchetype* compiled = CompiledArchetypes.GetPtr(archetypeHash))
+                {
+                    return compiled;
+                }
+
+                CompiledArchetype compiled;
+                compiled.Layout = LayoutType::Resolve(list);
+                return CompiledArchetypes.FindOrAdd(archetypeHash, compiled);
+            }
+
+            const EntityQuery& Query;
+            EntityTagFilter TagFilter;
+            TFixedMap<hash32_t, CompiledArchetype, PHX_ECS_ARCHETYPE_MGR_MAX_ARCHETYPE_DEFS * 2> CompiledArchetypes;
+        };
+
         struct IEntityJobBase
         {
             virtual ~IEntityJobBase() = default;
@@ -18,6 +110,15 @@ namespace Phoenix
             {
                 return Query;
             }
+
+            // Gets everything the job reads and writes: the components of its query plus anything else declared
+            // by the job. Jobs whose access doesn't conflict are allowed to run at the same time.
+            TaskAccess GetAccess() const
+            {
+                TaskAccess access = Access;
+                Query.GetComponentAccess(access);
+                return access;
+            }
             
             virtual void Execute(WorldRef world, ArchetypeList& list, uint32 startIndex)
             {
@@ -26,28 +127,54 @@ namespace Phoenix
 
         protected:
 
+            // Declares that the job reads something other than the components of its query, e.g. a world block.
+            template <class T>
+            void DeclareRead()
+            {
+                Access.AddRead(T::StaticTypeName);
+            }
+
+            // Declares that the job writes to something other than the components of its query, e.g. a world block.
+            template <class T>
+            void DeclareWrite()
+            {
+                Access.AddWrite(T::StaticTypeName);
+            }
+
             WorldPtr World = nullptr;
             EntityQuery Query;
+            TaskAccess Access;
         };
 
         template <class ...TComponents>
         struct IEntityJob : IEntityJobBase
         {
+            using SpanType = EntityComponentSpan<TComponents...>;
+            using CompiledQueryType = TCompiledEntityQuery<TComponents...>;
+
             IEntityJob()
             {
                 EntityQueryBuilder builder;
-                builder.RequireAllComponents<TComponents...>();
+                builder.RequireAllComponentRefs<TComponents...>();
                 Query = builder.GetQuery();
             }
 
             void Execute(WorldRef world, ArchetypeList& list, uint32 startIndex) final
             {
-                IEntityJobBase::Execute(world, list, startIndex);
+                ExecuteSpan(world, SpanType::FromList(list, startIndex));
+            }
+
+            // Executes the job over a span that was created from a compiled query.
+            void ExecuteSpan(WorldRef world, const SpanType& span)
+            {
+                World = &world;
 
-                auto span = EntityComponentSpan<TComponents...>::FromList(list, startIndex);
                 for (const auto& tuple : span)
                 {
-                    std::apply(&Execute, tuple);
+                    std::apply([this](EntityId entityId, uint32, TComponents ...components)
+                    {
+                        Execute(entityId, std::forward<TComponents>(components)...);
+                    }, tuple);
                 }
             }
             
@@ -57,18 +184,25 @@ namespace Phoenix
         template <class ...TComponents>
         struct IBufferJob : IEntityJobBase
         {
+            using SpanType = EntityComponentSpan<TComponents...>;
+            using CompiledQueryType = TCompiledEntityQuery<TComponents...>;
+
             IBufferJob()
             {
                 EntityQueryBuilder builder;
-                builder.RequireAllComponents<TComponents...>();
+                builder.RequireAllComponentRefs<TComponents...>();
                 Query = builder.GetQuery();
             }
             
             void Execute(WorldRef world, ArchetypeList& list, uint32 startIndex) final
             {
-                IEntityJobBase::Execute(world, list, startIndex);
+                ExecuteSpan(world, SpanType::FromList(list, startIndex));
+            }
 
-                auto span = EntityComponentSpan<TComponents...>::FromList(list, startIndex);
+            // Executes the job over a span that was created from a compiled query.
+            void ExecuteSpan(WorldRef world, const SpanType& span)
+            {
+                World = &world;
                 Execute(span);
             }
             
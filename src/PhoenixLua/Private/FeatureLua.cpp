@@ -82,31 +82,24 @@ void FeatureLua::Initialize()
             return 0;
         }
 
-        size_t i = 0;
-        for (; i < count; ++i)
-        {
-            ECS::EntityId entityId = ECS::FeatureECS::AcquireEntity(*world, kind);
-            if (entityId == ECS::EntityId::Invalid)
-                break;
-
-            if (ECS::TransformComponent* transformComp = ECS::FeatureECS::AddComponent<ECS::TransformComponent>(*world, entityId))
-            {
-                transformComp->Transform.Position.X = x;
-                transformComp->Transform.Position.Y = y;
-                transformComp->Transform.Rotation = facing;
-            }
-
-            if (Physics::BodyComponent* bodyComp = ECS::FeatureECS::AddComponent<Physics::BodyComponent>(*world, entityId))
+        TArray<ECS::EntityId> entityIds;
+        return ECS::FeatureECS::SpawnBatch<ECS::TransformComponent&, Physics::BodyComponent&>(
+            *world,
+            kind,
+            (uint32)count,
+            entityIds,
+            [&](ECS::EntityId, ECS::TransformComponent& transformComp, Physics::BodyComponent& bodyComp)
             {
-                bodyComp->CollisionMask = 1;
-                bodyComp->Radius = 0.6; // Lancer :)
-                bodyComp->InvMass = OneDivBy<Value>(1.0f);
-                bodyComp->LinearDamping = 5.f;
-                SetFlagRef(bodyComp->Flags, Physics::EBodyFlags::Awake, true);
-            }
-        }
-
-        return i;
+                transformComp.Transform.Position.X = x;
+                transformComp.Transform.Position.Y = y;
+                transformComp.Transform.Rotation = facing;
+
+                bodyComp.CollisionMask = 1;
+                bodyComp.Radius = 0.6; // Lancer :)
+                bodyComp.InvMass = OneDivBy<Value>(1.0f);
+                bodyComp.LinearDamping = 5.f;
+                SetFlagRef(bodyComp.Flags, Physics::EBodyFlags::Awake, true);
+            });
     };
 
     auto physics = phoenix["Physics"].get_or_create<sol::table>();
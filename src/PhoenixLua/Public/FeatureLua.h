@@ -38,6 +38,7 @@ namespace Phoenix
             FEATURE_CHANNEL(FeatureChannels::HandleWorldAction)
             FEATURE_CHANNEL(FeatureChannels::PostHandleWorldAction)
             FEATURE_CHANNEL(FeatureChannels::DebugRender)
+            FEATURE_SERIAL_WORLD_UPDATES()
         PHX_FEATURE_END()
 
         void Initialize() override;
@@ -31,25 +31,27 @@ bool FeaturePhysics::OnHandleWorldAction(WorldRef world, const FeatureActionArgs
     // TODO (jfarris): move this to script
     if (action.Action.Verb == "spawn_entity"_n)
     {   
-        for (uint32 i = 0; i < action.Action.Data[4].UInt32; ++i)
+        TArray<EntityId> entityIds;
+        FeatureECS::SpawnBatch<TransformComponent&, BodyComponent&>(
+            world,
+            action.Action.Data[0].Name,
+            action.Action.Data[4].UInt32,
+            entityIds,
+            [&](EntityId, TransformComponent& transformComp, BodyComponent& bodyComp)
+            {
+                transformComp.Transform.Position.X = action.Action.Data[1].Distance;
+                transformComp.Transform.Position.Y = action.Action.Data[2].Distance;
+                transformComp.Transform.Rotation = action.Action.Data[3].Degrees;
+
+                bodyComp.CollisionMask = 1;
+                bodyComp.Radius = 0.6; // Lancer :)
+                bodyComp.InvMass = OneDivBy<Value>(1.0f);
+                bodyComp.LinearDamping = 5.f;
+                SetFlagRef(bodyComp.Flags, EBodyFlags::Awake, true);
+            });
+
+        for (EntityId entityId : entityIds)
         {
-            EntityId entityId = FeatureECS::AcquireEntity(world, action.Action.Data[0].Name);
-            if (entityId == EntityId::Invalid)
-                break;
-
-            TransformComponent* transformComp = FeatureECS::GetComponent<TransformComponent>(world, entityId);
-            PHX_ASSERT(transformComp);
-            transformComp->Transform.Position.X = action.Action.Data[1].Distance;
-            transformComp->Transform.Position.Y = action.Action.Data[2].Distance;
-            transformComp->Transform.Rotation = action.Action.Data[3].Degrees;
-
-            BodyComponent* bodyComp = FeatureECS::GetComponent<BodyComponent>(world, entityId);
-            bodyComp->CollisionMask = 1;
-            bodyComp->Radius = 0.6; // Lancer :)
-            bodyComp->InvMass = OneDivBy<Value>(1.0f);
-            bodyComp->LinearDamping = 5.f;
-            SetFlagRef(bodyComp->Flags, EBodyFlags::Awake, true);
-
             Color color;
             color.R = rand() % 255;
             color.G = rand() % 255;
@@ -90,6 +92,7 @@ void FeaturePhysics::QueryEntitiesInRange(
     PHX_PROFILE_ZONE_SCOPED;
 
     const FeaturePhysicsScratchBlock& scratchBlock = world.GetBlockRef<FeaturePhysicsScratchBlock>();
+    const FeaturePhysicsDynamicBlock& dynamicBlock = world.GetBlockRef<FeaturePhysicsDynamicBlock>();
 
     TMortonCodeRangeArray ranges;
     
@@ -107,6 +110,30 @@ void FeaturePhysics::QueryEntitiesInRange(
         {
             outEntities.push_back(entityBody);
         });
+
+    ForEachInMortonCodeRanges<SleepingBody, &SleepingBody::ZCode>(
+        dynamicBlock.SleepingBodies,
+        ranges,
+        [&](const SleepingBody& sleepingBody)
+        {
+            if (sleepingBody.Island == Index<uint32>::None)
+            {
+                return;
+            }
+
+            const TransformComponent* transformComp = FeatureECS::GetComponent<TransformComponent>(world, sleepingBody.EntityId);
+            const BodyComponent* bodyComp = FeatureECS::GetComponent<BodyComponent>(world, sleepingBody.EntityId);
+
+            // Woken bodies are already in the sorted entities
+            if (transformComp && bodyComp && !HasAnyFlags(bodyComp->Flags, EBodyFlags::Awake))
+            {
+                outEntities.push_back(EntityBody{
+                    sleepingBody.EntityId,
+                    const_cast<TransformComponent*>(transformComp),
+                    const_cast<BodyComponent*>(bodyComp),
+                    sleepingBody.ZCode });
+            }
+        });
 }
 
 void FeaturePhysics::AddExplosionForceToEntitiesInRange(WorldRef world, const Vec2& pos, Distance range, Value force)
@@ -126,6 +153,7 @@ void FeaturePhysics::AddExplosionForceToEntitiesInRange(WorldRef world, const Ve
             Value t = 1.0f - dist / range;
             Value f = force / entityBody.BodyComponent->InvMass;
             entityBody.BodyComponent->LinearVelocity += dir.Normalized() * f * t;
+            WakeBody(*entityBody.BodyComponent);
         }
     }
 }
@@ -139,6 +167,32 @@ void FeaturePhysics::AddForce(WorldRef world, EntityId entityId, const Vec2& for
     }
 
     bodyComponent->LinearVelocity += force;
+    WakeBody(*bodyComponent);
+}
+
+bool FeaturePhysics::AddCollisionLine(WorldRef world, const Line2& line)
+{
+    FeaturePhysicsScratchBlock& scratchBlock = world.GetBlockRef<FeaturePhysicsScratchBlock>();
+    if (scratchBlock.CollisionLines.IsFull())
+    {
+        return false;
+    }
+
+    scratchBlock.CollisionLines.PushBack(CollisionLine{line});
+    scratchBlock.bCollisionLinesDirty = true;
+    return true;
+}
+
+void FeaturePhysics::ClearCollisionLines(WorldRef world)
+{
+    FeaturePhysicsScratchBlock& scratchBlock = world.GetBlockRef<FeaturePhysicsScratchBlock>();
+    scratchBlock.CollisionLines.Reset();
+    scratchBlock.bCollisionLinesDirty = true;
+}
+
+void FeaturePhysics::WakeBody(BodyComponent& bodyComp)
+{
+    SetFlagRef(bodyComp.Flags, EBodyFlags::Awake, true);
 }
 
 bool FeaturePhysics::GetDebugDrawContacts() const
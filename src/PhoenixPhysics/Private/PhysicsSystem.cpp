@@ -4,6 +4,7 @@
 #include <execution>
 
 #include "BodyComponent.h"
+#include "CTZ.h"
 #include "Color.h"
 #include "Debug.h"
 #include "FeaturePhysics.h"
@@ -18,10 +19,29 @@ using namespace Phoenix::Physics;
 
 constexpr uint8 SLEEP_TIMER = 1;
 
+// The share of the impulse of the previous step that a persisting contact starts with.
+constexpr float WARM_START_FACTOR = 0.8f;
+
+// The number of contacts of the same color that are worth splitting across workers.
+constexpr uint32 CONTACT_BATCH_SIZE = 128;
+
+static_assert(PHX_PHS_MAX_CONTACT_COLORS > 0 && PHX_PHS_MAX_CONTACT_COLORS <= 64, "Contact colors are tracked in 64-bit masks.");
+
 namespace PhysicsSystemDetail
 {
+    // Static bodies are never moved by contacts so they don't take part in coloring or sleeping.
+    bool IsStaticBody(const BodyComponent& bodyComp)
+    {
+        return HasAnyFlags(bodyComp.Flags, EBodyFlags::Static);
+    }
+
     struct PopulateSortedEntitiesJob : IBufferJob<TransformComponent&, BodyComponent&>
     {
+        PopulateSortedEntitiesJob()
+        {
+            DeclareWrite<FeaturePhysicsScratchBlock>();
+        }
+
         void Execute(const EntityComponentSpan<TransformComponent&, BodyComponent&>& span) override
         {
             PHX_PROFILE_ZONE_SCOPED_N("PopulateSortedEntitiesJob");
@@ -30,12 +50,23 @@ namespace PhysicsSystemDetail
 
             for (auto && [entityId, index, transformComp, bodyComp] : span)
             {
+                // Bodies of sleeping islands stay in the sleeping bodies unless something woke them
+                if (bodyComp.SleepIsland != Index<uint32>::None && !HasAnyFlags(bodyComp.Flags, EBodyFlags::Awake))
+                {
+                    continue;
+                }
+
                 uint32 sortedEntityIndex = scratchBlock.SortedEntityCount.fetch_add(1);
                 scratchBlock.SortedEntities[sortedEntityIndex] = EntityBody{entityId, &transformComp, &bodyComp, transformComp.ZCode};
             }
         }
     };
 
+    uint32 GetNumSortedEntities(WorldRef world)
+    {
+        return world.GetBlockRef<FeaturePhysicsScratchBlock>().SortedEntities.Num();
+    }
+
     void SortEntitiesByZCodeTask(WorldRef world)
     {
         PHX_PROFILE_ZONE_SCOPED;
@@ -45,35 +76,98 @@ namespace PhysicsSystemDetail
         // Calculated from PopulateSortedEntitiesJob
         scratchBlock.SortedEntities.SetSize(scratchBlock.SortedEntityCount);
 
-        // Sort entities by their zcodes
+        // Sort entities by their zcodes. Bodies in the same cell are ordered by entity id so the order doesn't depend
+        // on which worker populated them first.
         std::sort(
             std::execution::par,
             scratchBlock.SortedEntities.begin(),
             scratchBlock.SortedEntities.end(),
             [](const EntityBody& a, const EntityBody& b)
             {
-                return a.ZCode < b.ZCode;
+                return a.ZCode != b.ZCode ? a.ZCode < b.ZCode : entityid_t(a.EntityId) < entityid_t(b.EntityId);
             });
     }
 
+    // Buckets the collision lines by the morton cells they pass through.
+    void RebuildCollisionLineCellsTask(WorldRef world)
+    {
+        PHX_PROFILE_ZONE_SCOPED;
+
+        FeaturePhysicsScratchBlock& scratchBlock = world.GetBlockRef<FeaturePhysicsScratchBlock>();
+        auto& cells = scratchBlock.CollisionLineCells;
+
+        scratchBlock.bCollisionLinesDirty = false;
+        scratchBlock.bCollisionLineCellsOverflow = false;
+        cells.Reset();
+
+        constexpr int32 cellSize = 1 << MortonCodeGridBits;
+
+        // Cells are only roughly where the center is assumed to be since positions are truncated to whole units
+        // before being put into cells, this covers the corners of the cells with some slack
+        const Distance cellReach = Distance(2 * cellSize + 1);
+
+        for (uint32 i = 0; i < scratchBlock.CollisionLines.Num(); ++i)
+        {
+            const Line2& line = scratchBlock.CollisionLines[i].Line;
+            Vec2 center = (line.Start + line.End) * 0.5f;
+            Vec2 extents = line.End - line.Start;
+            Distance halfSize = Max(Abs(extents.X), Abs(extents.Y)) * 0.5f;
+
+            MortonCodeAABB aabb = ToMortonCodeAABB(center, halfSize);
+            for (int32 y = aabb.MinY; y <= aabb.MaxY; ++y)
+            {
+                for (int32 x = aabb.MinX; x <= aabb.MaxX; ++x)
+                {
+                    Vec2 cellCenter = { Distance(x * cellSize + cellSize / 2), Distance(y * cellSize + cellSize / 2) };
+                    if (Line2::DistanceToLine(line, cellCenter) > cellReach)
+                    {
+                        continue;
+                    }
+
+                    if (cells.IsFull())
+                    {
+                        scratchBlock.bCollisionLineCellsOverflow = true;
+                        cells.Reset();
+                        return;
+                    }
+
+                    cells.PushBack(CollisionLineCell{ ToMortonCode(x, y, 0), i });
+                }
+            }
+        }
+
+        std::sort(cells.begin(), cells.end(), [](const CollisionLineCell& a, const CollisionLineCell& b)
+        {
+            return a.ZCode != b.ZCode ? a.ZCode < b.ZCode : a.Line < b.Line;
+        });
+    }
+
     struct CalculateContactPairsJob : IBufferJob<TransformComponent&, BodyComponent&>
     {
         DeltaTime DeltaTime;
 
+        CalculateContactPairsJob()
+        {
+            DeclareRead<FeaturePhysicsDynamicBlock>();
+            DeclareWrite<FeaturePhysicsScratchBlock>();
+        }
+
         void Execute(const EntityComponentSpan<TransformComponent&, BodyComponent&>& span) override
         {
             PHX_PROFILE_ZONE_SCOPED_N("CalculateContactPairsJob");
 
             FeaturePhysicsScratchBlock& scratchBlock = World->GetBlockRef<FeaturePhysicsScratchBlock>();
+            const FeaturePhysicsDynamicBlock& dynamicBlock = World->GetBlockRef<FeaturePhysicsDynamicBlock>();
                 
             TMortonCodeRangeArray ranges;
 
-            const EntityBody* overlappingBodies[PHX_PHS_MAX_CONTACTS_PER_ENTITY * 4];
+            EntityBody overlappingBodies[PHX_PHS_MAX_CONTACTS_PER_ENTITY * 4];
             uint32 overlappingBodiesCount = 0;
 
             for (auto && [entityIdA, index, transformCompA, bodyCompA] : span)
             {
-                if (!HasAnyFlags(bodyCompA.Flags, EBodyFlags::Awake))
+                // Static bodies are found by the bodies touching them so they don't wake sleeping bodies
+                if (!HasAnyFlags(bodyCompA.Flags, EBodyFlags::Awake) || IsStaticBody(bodyCompA))
                 {
                     continue;
                 }
@@ -105,14 +199,48 @@ namespace PhysicsSystemDetail
                                 return false;
                             }
 
-                            overlappingBodies[overlappingBodiesCount++] = &eb;
+                            overlappingBodies[overlappingBodiesCount++] = eb;
+                            return overlappingBodiesCount == _countof(overlappingBodies);
+                        });
+
+                    // Sleeping bodies aren't in the sorted entities but touching one wakes its island
+                    ForEachInMortonCodeRanges<SleepingBody, &SleepingBody::ZCode>(
+                        dynamicBlock.SleepingBodies,
+                        ranges,
+                        [&](const SleepingBody& sb)
+                        {
+                            if (overlappingBodiesCount == _countof(overlappingBodies))
+                            {
+                                return true;
+                            }
+
+                            if (sb.Island == Index<uint32>::None)
+                            {
+                                return false;
+                            }
+
+                            BodyComponent* bodyCompB = FeatureECS::GetComponent<BodyComponent>(*World, sb.EntityId);
+                            TransformComponent* transformCompB = FeatureECS::GetComponent<TransformComponent>(*World, sb.EntityId);
+
+                            // Woken bodies are already in the sorted entities
+                            if (!bodyCompB || !transformCompB || HasAnyFlags(bodyCompB->Flags, EBodyFlags::Awake))
+                            {
+                                return false;
+                            }
+
+                            if ((bodyCompA.CollisionMask & bodyCompB->CollisionMask) == 0)
+                            {
+                                return false;
+                            }
+
+                            overlappingBodies[overlappingBodiesCount++] = EntityBody{sb.EntityId, transformCompB, bodyCompB, sb.ZCode};
                             return overlappingBodiesCount == _countof(overlappingBodies);
                         });
                 }
 
                 for (uint32 i = 0; i < overlappingBodiesCount; ++i)
                 {
-                    const EntityBody* entityBodyB = overlappingBodies[i];
+                    const EntityBody* entityBodyB = &overlappingBodies[i];
                     TransformComponent& transformCompB = *entityBodyB->TransformComponent;
                     BodyComponent& bodyCompB = *entityBodyB->BodyComponent;
 
@@ -132,12 +260,16 @@ namespace PhysicsSystemDetail
                     if (contactIndex >= scratchBlock.ContactPairs.Capacity)
                         break;
 
+                    // Both bodies of a pair find each other, keep the order of the bodies the same either way so the
+                    // cached contact of the pair stays valid
+                    bool isLo = loId == entityIdA;
+
                     ContactPair& pair = scratchBlock.ContactPairs[contactIndex];
                     pair.Key = key;
-                    pair.TransformA = &transformCompA;
-                    pair.BodyA = &bodyCompA;
-                    pair.TransformB = &transformCompB;
-                    pair.BodyB = &bodyCompB;
+                    pair.TransformA = isLo ? &transformCompA : &transformCompB;
+                    pair.BodyA = isLo ? &bodyCompA : &bodyCompB;
+                    pair.TransformB = isLo ? &transformCompB : &transformCompA;
+                    pair.BodyB = isLo ? &bodyCompB : &bodyCompA;
                 }
             }
         }
@@ -148,6 +280,7 @@ namespace PhysicsSystemDetail
         PHX_PROFILE_ZONE_SCOPED;
     
         FeaturePhysicsScratchBlock& scratchBlock = world.GetBlockRef<FeaturePhysicsScratchBlock>();
+        const FeaturePhysicsDynamicBlock& dynamicBlock = world.GetBlockRef<FeaturePhysicsDynamicBlock>();
 
         for (uint32 i = 0; i < count; ++i)
         {
@@ -158,13 +291,47 @@ namespace PhysicsSystemDetail
             auto& transformCompA = *contactPair.TransformA;
             auto& transformCompB = *contactPair.TransformB;
 
+            // Static bodies can be in contacts of any color at once so they must not be written
+            bool isStaticA = IsStaticBody(bodyCompA);
+            bool isStaticB = IsStaticBody(bodyCompB);
+            if (!isStaticA)
+            {
+                SetFlagRef(bodyCompA.Flags, EBodyFlags::Awake, true);
+            }
+            if (!isStaticB)
+            {
+                SetFlagRef(bodyCompB.Flags, EBodyFlags::Awake, true);
+            }
+
+            const CachedContact* cached = dynamicBlock.ContactCache.GetPtr(contactPair.Key);
+            contact.Impulse = cached ? Value(cached->Impulse * WARM_START_FACTOR) : Value(0);
+
+            // Bodies that haven't moved relative to each other, e.g. resting in a blob, keep their contact
+            if (cached
+                && Vec2::Equals(transformCompB.Transform.Position - transformCompA.Transform.Position, cached->Offset)
+                && cached->RR == bodyCompA.Radius + bodyCompB.Radius)
+            {
+                contact.Normal = cached->Normal;
+                contact.Bias = cached->Bias;
+                contact.EffMass = OneDivBy(bodyCompA.InvMass + bodyCompB.InvMass);
+                continue;
+            }
+
             Vec2 v;
             if (Vec2::Equals(transformCompA.Transform.Position, transformCompB.Transform.Position))
             {
-                v = Vec2::RandUnitVector();
+                // Push coincident bodies apart in a direction picked from the pair so every run agrees on it
+                Angle deg = static_cast<float>(ContactPairHasher()(contactPair.Key) % 1440) / 4.0f;
+                v = Vec2::XAxis.Rotate(deg);
                 auto correction = OneDivBy(bodyCompA.InvMass + bodyCompB.InvMass);
-                transformCompA.Transform.Position -= v * correction * 0.01f;
-                transformCompB.Transform.Position += v * correction * 0.01f;
+                if (!isStaticA)
+                {
+                    transformCompA.Transform.Position -= v * correction * 0.01f;
+                }
+                if (!isStaticB)
+                {
+                    transformCompB.Transform.Position += v * correction * 0.01f;
+                }
             }
 
             v = transformCompB.Transform.Position - transformCompA.Transform.Position;
@@ -180,10 +347,88 @@ namespace PhysicsSystemDetail
             contact.Normal = v.Normalized();
             contact.Bias = bias;
             contact.EffMass = OneDivBy(bodyCompA.InvMass + bodyCompB.InvMass);
-            contact.Impulse = 0;
+        }
+    }
 
-            SetFlagRef(bodyCompA.Flags, EBodyFlags::Awake, true);
-            SetFlagRef(bodyCompB.Flags, EBodyFlags::Awake, true);
+    void ApplyContactImpulse(ContactPair& contactPair, const Vec2& p)
+    {
+        if (contactPair.BodyA && !IsStaticBody(*contactPair.BodyA))
+        {
+            contactPair.BodyA->LinearVelocity -= p * contactPair.BodyA->InvMass;
+        }
+        if (contactPair.BodyB && !IsStaticBody(*contactPair.BodyB))
+        {
+            contactPair.BodyB->LinearVelocity += p * contactPair.BodyB->InvMass;
+        }
+    }
+
+    // Greedily gives each contact the lowest color that no other contact of either of its bodies has. Contacts
+    // are visited in key order so the colors don't depend on how the contacts were found. Static bodies are never
+    // written by contacts so any number of contacts of the same color can share one.
+    void ColorContacts(FeaturePhysicsScratchBlock& scratchBlock)
+    {
+        PHX_PROFILE_ZONE_SCOPED;
+
+        constexpr uint32 serialColor = PHX_PHS_MAX_CONTACT_COLORS;
+        constexpr uint64 allColors = PHX_PHS_MAX_CONTACT_COLORS == 64 ? ~uint64(0) : (uint64(1) << PHX_PHS_MAX_CONTACT_COLORS) - 1;
+
+        // Returns null for static bodies
+        auto getBodyColors = [&](const ContactPair& contactPair, bool isA) -> uint64*
+        {
+            const BodyComponent& bodyComp = isA ? *contactPair.BodyA : *contactPair.BodyB;
+            if (IsStaticBody(bodyComp))
+            {
+                return nullptr;
+            }
+            EntityId entityId = entityid_t(isA ? contactPair.Key : contactPair.Key >> 32);
+            return &scratchBlock.BodyContactColors[entityId.GetIndex()];
+        };
+
+        uint32 colorCounts[serialColor + 1] = {};
+
+        for (Contact& contact : scratchBlock.Contacts)
+        {
+            const ContactPair& contactPair = scratchBlock.ContactPairs[contact.ContactPair];
+            uint64* colorsA = getBodyColors(contactPair, true);
+            uint64* colorsB = getBodyColors(contactPair, false);
+            uint64 usedColors = (colorsA ? *colorsA : 0) | (colorsB ? *colorsB : 0);
+            uint64 freeColors = ~usedColors & allColors;
+
+            if (freeColors == 0)
+            {
+                contact.Color = serialColor;
+            }
+            else
+            {
+                contact.Color = (uint8)CTZ(freeColors);
+                if (colorsA) *colorsA |= uint64(1) << contact.Color;
+                if (colorsB) *colorsB |= uint64(1) << contact.Color;
+            }
+
+            ++colorCounts[contact.Color];
+        }
+
+        // Only the masks of bodies with contacts were touched
+        for (const Contact& contact : scratchBlock.Contacts)
+        {
+            const ContactPair& contactPair = scratchBlock.ContactPairs[contact.ContactPair];
+            if (uint64* colorsA = getBodyColors(contactPair, true)) *colorsA = 0;
+            if (uint64* colorsB = getBodyColors(contactPair, false)) *colorsB = 0;
+        }
+
+        std::sort(
+            std::execution::par,
+            scratchBlock.Contacts.begin(),
+            scratchBlock.Contacts.end(),
+            [](const Contact& a, const Contact& b)
+            {
+                return a.Color != b.Color ? a.Color < b.Color : a.ContactPair < b.ContactPair;
+            });
+
+        scratchBlock.ContactColorOffsets[0] = 0;
+        for (uint32 color = 0; color <= serialColor; ++color)
+        {
+            scratchBlock.ContactColorOffsets[color + 1] = scratchBlock.ContactColorOffsets[color] + colorCounts[color];
         }
     }
 
@@ -236,6 +481,50 @@ namespace PhysicsSystemDetail
 
             scratchBlock.Contacts.SetSize(contacts);
         }
+
+        ColorContacts(scratchBlock);
+    }
+
+    // Runs func over the contacts one color at a time. Contacts of the same color don't share a body so they are
+    // split across workers, the result is the same no matter how many workers there are.
+    template <class TFunc>
+    void ForEachContactColor(WorldRef world, const TFunc& func)
+    {
+        const FeaturePhysicsScratchBlock& scratchBlock = world.GetBlockRef<FeaturePhysicsScratchBlock>();
+        ThreadPool* threadPool = world.GetTaskQueue()->GetThreadPool();
+
+        for (uint32 color = 0; color <= PHX_PHS_MAX_CONTACT_COLORS; ++color)
+        {
+            uint32 start = scratchBlock.ContactColorOffsets[color];
+            uint32 count = scratchBlock.ContactColorOffsets[color + 1] - start;
+            if (count == 0)
+            {
+                continue;
+            }
+
+            // Contacts that ran out of colors can share bodies
+            if (!threadPool || color == PHX_PHS_MAX_CONTACT_COLORS || count <= CONTACT_BATCH_SIZE)
+            {
+                func(start, count);
+                continue;
+            }
+
+            // Returns once the whole color is done, which is the barrier before the next color
+            ParallelRange(*threadPool, count, CONTACT_BATCH_SIZE, [&](uint32 rangeStart, uint32 rangeCount)
+            {
+                func(start + rangeStart, rangeCount);
+            });
+        }
+    }
+
+    void CalculateContactsByColorTask(WorldRef world, DeltaTime dt)
+    {
+        PHX_PROFILE_ZONE_SCOPED;
+
+        ForEachContactColor(world, [&](uint32 start, uint32 count)
+        {
+            CalculateContactsTask(world, start, count, dt);
+        });
     }
 
     void PGSTask(WorldRef world, uint32 startIndex, uint32 count, uint32 iter)
@@ -249,6 +538,12 @@ namespace PhysicsSystemDetail
         {
             Contact& contact = scratchBlock.Contacts[startIndex + i];
             ContactPair& contactPair = scratchBlock.ContactPairs[contact.ContactPair];
+
+            // Apply the warm-start impulse before the first iteration
+            if (iter == 0 && contact.Impulse != 0.0f)
+            {
+                ApplyContactImpulse(contactPair, contact.Normal * contact.Impulse);
+            }
         
             // Relative velocity at contact
             Vec2 velA = Vec2::Zero;
@@ -274,16 +569,73 @@ namespace PhysicsSystemDetail
             Value change = contact.Impulse - oldImpulse;
 
             // Apply impulse
-            Vec2 p = contact.Normal * change;
-            if (contactPair.BodyA && !HasAnyFlags(contactPair.BodyA->Flags, EBodyFlags::Static))
+            ApplyContactImpulse(contactPair, contact.Normal * change);
+        }
+    }
+
+    void SolveContactsTask(WorldRef world, uint32 iter)
+    {
+        PHX_PROFILE_ZONE_SCOPED;
+
+        ForEachContactColor(world, [&](uint32 start, uint32 count)
+        {
+            PGSTask(world, start, count, iter);
+        });
+    }
+
+    void UpdateContactCacheTask(WorldRef world)
+    {
+        PHX_PROFILE_ZONE_SCOPED;
+
+        const FeaturePhysicsScratchBlock& scratchBlock = world.GetBlockRef<FeaturePhysicsScratchBlock>();
+        FeaturePhysicsDynamicBlock& dynamicBlock = world.GetBlockRef<FeaturePhysicsDynamicBlock>();
+        auto& cache = dynamicBlock.ContactCache;
+
+        uint32 step = ++dynamicBlock.ContactCacheStep;
+
+        // Mark the cached contacts that persisted and evict the rest before adding new ones so the cache
+        // doesn't fill up with contacts that ended
+        for (const Contact& contact : scratchBlock.Contacts)
+        {
+            if (CachedContact* cached = cache.GetPtr(scratchBlock.ContactPairs[contact.ContactPair].Key))
             {
-                contactPair.BodyA->LinearVelocity -= p * contactPair.BodyA->InvMass;
+                cached->Step = step;
             }
-            if (contactPair.BodyB && !HasAnyFlags(contactPair.BodyB->Flags, EBodyFlags::Static))
+        }
+
+        for (uint64 key : dynamicBlock.ContactCacheKeys)
+        {
+            if (cache.Get(key).Step != step)
             {
-                contactPair.BodyB->LinearVelocity += p * contactPair.BodyB->InvMass;
+                cache.Remove(key);
             }
         }
+
+        dynamicBlock.ContactCacheKeys.Reset();
+
+        for (const Contact& contact : scratchBlock.Contacts)
+        {
+            const ContactPair& contactPair = scratchBlock.ContactPairs[contact.ContactPair];
+
+            // Keep the load of the map low, probing gets slow as it fills up
+            CachedContact* cached = cache.GetPtr(contactPair.Key);
+            if (!cached)
+            {
+                if (cache.Num() >= cache.Capacity / 2)
+                {
+                    continue;
+                }
+                cached = cache.FindOrAddDefaulted(contactPair.Key);
+            }
+
+            cached->Offset = contactPair.TransformB->Transform.Position - contactPair.TransformA->Transform.Position;
+            cached->RR = contactPair.BodyA->Radius + contactPair.BodyB->Radius;
+            cached->Normal = contact.Normal;
+            cached->Bias = contact.Bias;
+            cached->Impulse = contact.Impulse;
+            cached->Step = step;
+            dynamicBlock.ContactCacheKeys.PushBack(contactPair.Key);
+        }
     }
 
     struct IntegrateJob : IBufferJob<TransformComponent&, BodyComponent&>
@@ -294,8 +646,6 @@ namespace PhysicsSystemDetail
         {
             PHX_PROFILE_ZONE_SCOPED_N("IntegrateJob");
 
-            FeaturePhysicsDynamicBlock& dynamicBlock = World->GetBlockRef<FeaturePhysicsDynamicBlock>();
-
             for (auto && [entityIdA, index, transformComp, bodyComp] : span)
             {
                 if (bodyComp.Movement == EBodyMovement::Attached)
@@ -304,23 +654,20 @@ namespace PhysicsSystemDetail
                 }
                 else 
                 {
-                    if (dynamicBlock.bAllowSleep)
+                    if (!HasAnyFlags(bodyComp.Flags, EBodyFlags::Awake))
                     {
-                        bool isMoving = bodyComp.LinearVelocity.Length() > Distance(1E-1);
-                        if (isMoving)
-                        {
-                            bodyComp.SleepTimer = SLEEP_TIMER;
-                            SetFlagRef(bodyComp.Flags, EBodyFlags::Awake, true);
-                        }
-                        else if (bodyComp.SleepTimer > 0)
-                        {
-                            --bodyComp.SleepTimer;
-                            SetFlagRef(bodyComp.Flags, EBodyFlags::Awake, true);
-                        }
-                        else
-                        {
-                            SetFlagRef(bodyComp.Flags, EBodyFlags::Awake, false);
-                        }
+                        continue;
+                    }
+
+                    // Whether the body sleeps is decided for its whole island by UpdateIslandsTask
+                    bool isMoving = bodyComp.LinearVelocity.Length() > Distance(1E-1);
+                    if (isMoving)
+                    {
+                        bodyComp.SleepTimer = SLEEP_TIMER;
+                    }
+                    else if (bodyComp.SleepTimer > 0)
+                    {
+                        --bodyComp.SleepTimer;
                     }
                 
                     transformComp.Transform.Position += bodyComp.LinearVelocity * DeltaTime;
@@ -335,7 +682,16 @@ namespace PhysicsSystemDetail
     {
         PHX_PROFILE_ZONE_SCOPED;
     
-        FeaturePhysicsScratchBlock& scratchBlock = world.GetBlockRef<FeaturePhysicsScratchBlock>();;
+        FeaturePhysicsScratchBlock& scratchBlock = world.GetBlockRef<FeaturePhysicsScratchBlock>();
+
+        if (scratchBlock.CollisionLines.IsEmpty())
+        {
+            return;
+        }
+
+        const auto& cells = scratchBlock.CollisionLineCells;
+
+        uint32 nearbyLines[64];
 
         for (uint32 i = 0; i < count; ++i)
         {
@@ -343,10 +699,45 @@ namespace PhysicsSystemDetail
             auto bodyCompA = entityBody.BodyComponent;
             auto transformCompA = entityBody.TransformComponent;
 
+            // Gather the lines in the cells the body overlaps
+            uint32 numNearbyLines = 0;
+            bool testAllLines = scratchBlock.bCollisionLineCellsOverflow;
+            if (!testAllLines)
+            {
+                MortonCodeAABB aabb = ToMortonCodeAABB(transformCompA->Transform.Position, bodyCompA->Radius);
+                for (int32 y = aabb.MinY; y <= aabb.MaxY && !testAllLines; ++y)
+                {
+                    for (int32 x = aabb.MinX; x <= aabb.MaxX && !testAllLines; ++x)
+                    {
+                        uint64 zcode = ToMortonCode(x, y, 0);
+                        auto itr = std::lower_bound(cells.begin(), cells.end(), zcode, [](const CollisionLineCell& cell, uint64 v)
+                        {
+                            return cell.ZCode < v;
+                        });
+                        for (; itr != cells.end() && itr->ZCode == zcode; ++itr)
+                        {
+                            if (numNearbyLines == _countof(nearbyLines))
+                            {
+                                testAllLines = true;
+                                break;
+                            }
+                            nearbyLines[numNearbyLines++] = itr->Line;
+                        }
+                    }
+                }
+
+                // Lines span several cells, test each once and in the order they were added
+                std::sort(nearbyLines, nearbyLines + numNearbyLines);
+                numNearbyLines = uint32(std::unique(nearbyLines, nearbyLines + numNearbyLines) - nearbyLines);
+            }
+
+            uint32 numLines = testAllLines ? scratchBlock.CollisionLines.Num() : numNearbyLines;
+
             // Collide with lines
             {
-                for (const CollisionLine& line : scratchBlock.CollisionLines)
+                for (uint32 j = 0; j < numLines; ++j)
                 {
+                    const CollisionLine& line = scratchBlock.CollisionLines[testAllLines ? j : nearbyLines[j]];
                     Vec2 v = Line2::VectorToLine(line.Line, transformCompA->Transform.Position);
                     Distance vLen = v.Length();
                     if (vLen != 0.0f && vLen < bodyCompA->Radius)
@@ -358,35 +749,336 @@ namespace PhysicsSystemDetail
                         {
                             bodyCompA->LinearVelocity = Vec2::Reflect(line.Line.GetDirection(), bodyCompA->LinearVelocity);
                         }
-                        SetFlagRef(bodyCompA->Flags, EBodyFlags::Awake, true);
+                        bodyCompA->SleepTimer = SLEEP_TIMER;
                     }
                 }
             }
         }
     }
 
-    void OverlapSeparationTask2(WorldRef world, uint32 startIndex, uint32 count)
+    bool SleepingBodyLess(const SleepingBody& a, const SleepingBody& b)
+    {
+        return a.ZCode != b.ZCode ? a.ZCode < b.ZCode : entityid_t(a.EntityId) < entityid_t(b.EntityId);
+    }
+
+    // Leaves a tombstone for a body that isn't sleeping anymore so queries skip it.
+    void RemoveSleepingBody(FeaturePhysicsDynamicBlock& dynamicBlock, const SleepingBody& member)
+    {
+        auto& sleepingBodies = dynamicBlock.SleepingBodies;
+        auto itr = std::lower_bound(sleepingBodies.begin(), sleepingBodies.end(), member, &SleepingBodyLess);
+        if (itr != sleepingBodies.end() && entityid_t(itr->EntityId) == entityid_t(member.EntityId) && itr->Island != Index<uint32>::None)
+        {
+            itr->Island = Index<uint32>::None;
+            ++dynamicBlock.NumSleepingTombstones;
+        }
+    }
+
+    void FreeSleepingIsland(FeaturePhysicsDynamicBlock& dynamicBlock, uint32 island)
+    {
+        SleepingIsland& sleepingIsland = dynamicBlock.SleepingIslands[island];
+        for (uint32 i = 0; i < sleepingIsland.NumMembers; ++i)
+        {
+            dynamicBlock.IslandMembers[sleepingIsland.FirstMember + i].Island = Index<uint32>::None;
+        }
+
+        dynamicBlock.NumDeadIslandMembers += sleepingIsland.NumMembers;
+        sleepingIsland = SleepingIsland();
+        dynamicBlock.FreeSleepingIslands.PushBack(island);
+    }
+
+    // Wakes every body of the sleeping island, only visiting the bodies of the island.
+    void WakeSleepingIsland(WorldRef world, FeaturePhysicsDynamicBlock& dynamicBlock, uint32 island)
+    {
+        const SleepingIsland& sleepingIsland = dynamicBlock.SleepingIslands[island];
+        for (uint32 i = 0; i < sleepingIsland.NumMembers; ++i)
+        {
+            const SleepingBody& member = dynamicBlock.IslandMembers[sleepingIsland.FirstMember + i];
+            RemoveSleepingBody(dynamicBlock, member);
+
+            // Bodies that were touched already left the island
+            BodyComponent* bodyComp = FeatureECS::GetComponent<BodyComponent>(world, member.EntityId);
+            if (bodyComp && bodyComp->SleepIsland == island)
+            {
+                bodyComp->SleepIsland = Index<uint32>::None;
+                bodyComp->SleepTimer = SLEEP_TIMER;
+                SetFlagRef(bodyComp->Flags, EBodyFlags::Awake, true);
+            }
+        }
+
+        FreeSleepingIsland(dynamicBlock, island);
+    }
+
+    // Drops the tombstones and the members of woken islands once they take up as much room as the bodies that are
+    // still sleeping. When forced, also drops the bodies of entities that were destroyed while sleeping.
+    void CompactSleepingBodies(WorldRef world, FeaturePhysicsDynamicBlock& dynamicBlock, bool force)
+    {
+        constexpr uint32 none = Index<uint32>::None;
+
+        auto& sleepingBodies = dynamicBlock.SleepingBodies;
+        auto& members = dynamicBlock.IslandMembers;
+
+        if (force)
+        {
+            PHX_PROFILE_ZONE_SCOPED_N("DropDestroyedSleepingBodies");
+
+            for (SleepingBody& member : members)
+            {
+                if (member.Island != none && !FeatureECS::GetComponent<BodyComponent>(world, member.EntityId))
+                {
+                    RemoveSleepingBody(dynamicBlock, member);
+
+                    uint32 island = member.Island;
+                    member.Island = none;
+                    ++dynamicBlock.NumDeadIslandMembers;
+                    if (--dynamicBlock.SleepingIslands[island].NumMembers == 0)
+                    {
+                        dynamicBlock.FreeSleepingIslands.PushBack(island);
+                    }
+                }
+            }
+        }
+
+        if (dynamicBlock.NumSleepingTombstones > 0 && (force || dynamicBlock.NumSleepingTombstones * 2 >= sleepingBodies.Num()))
+        {
+            auto itr = std::remove_if(sleepingBodies.begin(), sleepingBodies.end(), [](const SleepingBody& sleepingBody)
+            {
+                return sleepingBody.Island == none;
+            });
+            sleepingBodies.SetSize(itr - sleepingBodies.begin());
+            dynamicBlock.NumSleepingTombstones = 0;
+        }
+
+        if (dynamicBlock.NumDeadIslandMembers > 0 && (force || dynamicBlock.NumDeadIslandMembers * 2 >= members.Num()))
+        {
+            auto itr = std::remove_if(members.begin(), members.end(), [](const SleepingBody& member)
+            {
+                return member.Island == none;
+            });
+            members.SetSize(itr - members.begin());
+            dynamicBlock.NumDeadIslandMembers = 0;
+
+            // The members of an island stay next to each other so only the start of each range moves
+            for (uint32 i = 0; i < members.Num(); ++i)
+            {
+                if (i == 0 || members[i].Island != members[i - 1].Island)
+                {
+                    dynamicBlock.SleepingIslands[members[i].Island].FirstMember = i;
+                }
+            }
+        }
+    }
+
+    // Groups the bodies that were awake this step into islands of bodies touching each other. Islands where every
+    // body is resting fall asleep together and are left out of the broadphase, the solver and the line separation
+    // until an awake body touches one of their bodies, which wakes the whole island. Static bodies never move so
+    // they are left out of islands and never sleep or wake.
+    void UpdateIslandsTask(WorldRef world)
     {
         PHX_PROFILE_ZONE_SCOPED;
 
+        constexpr uint32 none = Index<uint32>::None;
+
         FeaturePhysicsScratchBlock& scratchBlock = world.GetBlockRef<FeaturePhysicsScratchBlock>();
+        FeaturePhysicsDynamicBlock& dynamicBlock = world.GetBlockRef<FeaturePhysicsDynamicBlock>();
+        auto& parents = scratchBlock.IslandParents;
+        auto& wokenIslands = scratchBlock.WokenIslandList;
 
-        for (uint32 i = 0; i < count; ++i)
+        auto addBody = [&](EntityId entityId, TransformComponent* transformComp, BodyComponent* bodyComp)
         {
-            Contact& contact = scratchBlock.Contacts[startIndex + i];
-            ContactPair& contactPair = scratchBlock.ContactPairs[contact.ContactPair];
-    
-            Vec2 v = contactPair.TransformB->Transform.Position - contactPair.TransformA->Transform.Position;
-            Distance d = v.Length();
-            Distance rr = contactPair.BodyA->Radius + contactPair.BodyB->Radius;
-            Distance pen = rr - d;
-            if (pen > 0.01)
+            uint32 index = entityId.GetIndex();
+            if (parents[index] != 0 || IsStaticBody(*bodyComp))
+            {
+                return;
+            }
+
+            // Bodies woken while sleeping wake the rest of their island
+            if (bodyComp->SleepIsland != none)
+            {
+                if (!scratchBlock.WokenIslands[bodyComp->SleepIsland])
+                {
+                    scratchBlock.WokenIslands[bodyComp->SleepIsland] = true;
+                    wokenIslands.PushBack(bodyComp->SleepIsland);
+                }
+                bodyComp->SleepIsland = none;
+            }
+
+            parents[index] = index + 1;
+            scratchBlock.IslandBodies.PushBack(EntityBody{entityId, transformComp, bodyComp, 0});
+        };
+
+        auto find = [&](uint32 index)
+        {
+            while (parents[index] != index + 1)
+            {
+                // Path halving
+                parents[index] = parents[parents[index] - 1];
+                index = parents[index] - 1;
+            }
+            return index;
+        };
+
+        scratchBlock.IslandBodies.Reset();
+        wokenIslands.Reset();
+
+        for (const EntityBody& entityBody : scratchBlock.SortedEntities)
+        {
+            addBody(entityBody.EntityId, entityBody.TransformComponent, entityBody.BodyComponent);
+        }
+
+        // Static bodies don't move anything they touch so they don't join islands together
+        for (const Contact& contact : scratchBlock.Contacts)
+        {
+            const ContactPair& contactPair = scratchBlock.ContactPairs[contact.ContactPair];
+            if (IsStaticBody(*contactPair.BodyA) || IsStaticBody(*contactPair.BodyB))
+            {
+                continue;
+            }
+
+            EntityId entityIdA = entityid_t(contactPair.Key);
+            EntityId entityIdB = entityid_t(contactPair.Key >> 32);
+            addBody(entityIdA, contactPair.TransformA, contactPair.BodyA);
+            addBody(entityIdB, contactPair.TransformB, contactPair.BodyB);
+
+            // The lower index is the root so the islands don't depend on the order of the contacts
+            uint32 rootA = find(entityIdA.GetIndex());
+            uint32 rootB = find(entityIdB.GetIndex());
+            if (rootA != rootB)
+            {
+                parents[Max(rootA, rootB)] = Min(rootA, rootB) + 1;
+            }
+        }
+
+        // Wake the islands that were touched before any island falls asleep so their slots can be reused. Islands
+        // are woken in slot order so the free slots are in the same order no matter what order they were touched in.
+        std::sort(wokenIslands.begin(), wokenIslands.end());
+        for (uint32 island : wokenIslands)
+        {
+            scratchBlock.WokenIslands[island] = false;
+            WakeSleepingIsland(world, dynamicBlock, island);
+        }
+
+        if (!dynamicBlock.bAllowSleep && dynamicBlock.SleepingBodies.Num() > dynamicBlock.NumSleepingTombstones)
+        {
+            for (uint32 island = 0; island < dynamicBlock.SleepingIslands.Num(); ++island)
             {
-                Value correction = 0.01f * pen;
-                contactPair.TransformA->Transform.Position -= contact.Normal * correction * contactPair.BodyA->InvMass / (contactPair.BodyA->InvMass + contactPair.BodyB->InvMass);
-                contactPair.TransformB->Transform.Position += contact.Normal * correction * contactPair.BodyB->InvMass / (contactPair.BodyA->InvMass + contactPair.BodyB->InvMass);
+                if (dynamicBlock.SleepingIslands[island].NumMembers > 0)
+                {
+                    WakeSleepingIsland(world, dynamicBlock, island);
+                }
             }
         }
+
+        // Make sure every island body could fall asleep. Destroyed sleeping bodies are only dropped when out of room.
+        uint32 maxNewSleepers = scratchBlock.IslandBodies.Num();
+        auto hasRoom = [&]
+        {
+            return dynamicBlock.SleepingBodies.Num() + maxNewSleepers <= dynamicBlock.SleepingBodies.Capacity
+                && dynamicBlock.IslandMembers.Num() + maxNewSleepers <= dynamicBlock.IslandMembers.Capacity;
+        };
+
+        CompactSleepingBodies(world, dynamicBlock, !hasRoom());
+        bool canSleep = dynamicBlock.bAllowSleep && hasRoom();
+
+        for (const EntityBody& entityBody : scratchBlock.IslandBodies)
+        {
+            if (entityBody.BodyComponent->SleepTimer > 0 || !canSleep)
+            {
+                scratchBlock.IslandRestless[find(entityBody.EntityId.GetIndex())] = true;
+            }
+        }
+
+        // Sleeping islands are world state so they must not depend on the order the bodies were found in, which
+        // changes with the number of workers. The bodies that fall asleep are ordered by entity index, which hands
+        // out slots in the order of the island roots since the root is the lowest index of its island.
+        auto sleepers = std::partition(scratchBlock.IslandBodies.begin(), scratchBlock.IslandBodies.end(), [&](const EntityBody& entityBody)
+        {
+            return scratchBlock.IslandRestless[find(entityBody.EntityId.GetIndex())];
+        });
+
+        for (auto itr = scratchBlock.IslandBodies.begin(); itr != sleepers; ++itr)
+        {
+            SetFlagRef(itr->BodyComponent->Flags, EBodyFlags::Awake, true);
+        }
+
+        std::sort(sleepers, scratchBlock.IslandBodies.end(), [](const EntityBody& a, const EntityBody& b)
+        {
+            return a.EntityId.GetIndex() < b.EntityId.GetIndex();
+        });
+
+        // Give each island that falls asleep a slot and count its bodies
+        auto& newIslands = scratchBlock.NewSleepingIslands;
+        newIslands.Reset();
+
+        for (auto itr = sleepers; itr != scratchBlock.IslandBodies.end(); ++itr)
+        {
+            uint32 root = find(itr->EntityId.GetIndex());
+            if (scratchBlock.RootSleepingIslands[root] == 0)
+            {
+                uint32 island = 0;
+                if (!dynamicBlock.FreeSleepingIslands.IsEmpty())
+                {
+                    island = dynamicBlock.FreeSleepingIslands.PopBackAndReturn();
+                }
+                else
+                {
+                    island = (uint32)dynamicBlock.SleepingIslands.Num();
+                    dynamicBlock.SleepingIslands.AddDefaulted();
+                }
+
+                scratchBlock.RootSleepingIslands[root] = island + 1;
+                newIslands.PushBack(island);
+            }
+
+            ++dynamicBlock.SleepingIslands[scratchBlock.RootSleepingIslands[root] - 1].NumMembers;
+        }
+
+        // Members of the same island are stored next to each other
+        uint32 numMembers = (uint32)dynamicBlock.IslandMembers.Num();
+        for (uint32 island : newIslands)
+        {
+            SleepingIsland& sleepingIsland = dynamicBlock.SleepingIslands[island];
+            sleepingIsland.FirstMember = numMembers;
+            numMembers += sleepingIsland.NumMembers;
+            sleepingIsland.NumMembers = 0;
+        }
+        dynamicBlock.IslandMembers.SetSize(numMembers);
+
+        auto& sleepingBodies = dynamicBlock.SleepingBodies;
+        size_t numSleepingBodies = sleepingBodies.Num();
+
+        for (auto itr = sleepers; itr != scratchBlock.IslandBodies.end(); ++itr)
+        {
+            const EntityBody& entityBody = *itr;
+            uint32 root = find(entityBody.EntityId.GetIndex());
+            uint32 island = scratchBlock.RootSleepingIslands[root] - 1;
+            SleepingIsland& sleepingIsland = dynamicBlock.SleepingIslands[island];
+
+            BodyComponent& bodyComp = *entityBody.BodyComponent;
+            bodyComp.SleepIsland = island;
+            bodyComp.LinearVelocity = Vec2::Zero;
+            SetFlagRef(bodyComp.Flags, EBodyFlags::Awake, false);
+
+            Vec2 position = entityBody.TransformComponent->Transform.Position;
+            SleepingBody member = SleepingBody{entityBody.EntityId, island, ToMortonCode(position)};
+            dynamicBlock.IslandMembers[sleepingIsland.FirstMember + sleepingIsland.NumMembers++] = member;
+            sleepingBodies.PushBack(member);
+        }
+
+        // Only the bodies that fell asleep need sorting, the rest already are
+        if (sleepingBodies.Num() > numSleepingBodies)
+        {
+            auto mid = sleepingBodies.begin() + numSleepingBodies;
+            std::sort(mid, sleepingBodies.end(), &SleepingBodyLess);
+            std::inplace_merge(sleepingBodies.begin(), mid, sleepingBodies.end(), &SleepingBodyLess);
+        }
+
+        for (const EntityBody& entityBody : scratchBlock.IslandBodies)
+        {
+            uint32 index = entityBody.EntityId.GetIndex();
+            scratchBlock.IslandRestless[index] = false;
+            scratchBlock.RootSleepingIslands[index] = 0;
+            parents[index] = 0;
+        }
     }
 }
 
@@ -405,6 +1097,11 @@ void PhysicsSystem::OnPreWorldUpdate(WorldRef world, const SystemUpdateArgs& arg
     FeatureECS::ScheduleParallel(world, job);
 
     WorldTaskQueue::Schedule(world, &PhysicsSystemDetail::SortEntitiesByZCodeTask);
+
+    if (scratchBlock.bCollisionLinesDirty)
+    {
+        WorldTaskQueue::Schedule(world, &PhysicsSystemDetail::RebuildCollisionLineCellsTask);
+    }
 }
 
 void PhysicsSystem::OnWorldUpdate(WorldRef world, const SystemUpdateArgs& args)
@@ -413,8 +1110,6 @@ void PhysicsSystem::OnWorldUpdate(WorldRef world, const SystemUpdateArgs& args)
 
     DeltaTime dt = args.DeltaTime;
 
-    FeaturePhysicsScratchBlock& scratchBlock = world.GetBlockRef<FeaturePhysicsScratchBlock>();
-    
     // Determine contacts
     {
         PhysicsSystemDetail::CalculateContactPairsJob job;
@@ -423,27 +1118,30 @@ void PhysicsSystem::OnWorldUpdate(WorldRef world, const SystemUpdateArgs& args)
 
         WorldTaskQueue::Schedule(world, &PhysicsSystemDetail::ResolveContactPairsTask);
 
-        // CalculateContactsTask depends on scratchBlock.Contacts.Num() to be calculated by ResolveContactPairs
-        // TODO (jfarris): can we have tasks depend on the result of other tasks?
-        WorldTaskQueue::Flush(world);
-
-        WorldTaskQueue::ScheduleParallelRange(world, scratchBlock.Contacts.Num(), 128, &PhysicsSystemDetail::CalculateContactsTask, dt);
+        // Contacts write to both of their bodies so they are processed in parallel one color at a time
+        WorldTaskQueue::Schedule(world, &PhysicsSystemDetail::CalculateContactsByColorTask, dt);
     }
 
     // Multi-pass solver
     for (uint32 i = 0; i < 4; ++i)
     {
-        WorldTaskQueue::ScheduleParallelRange(world, scratchBlock.Contacts.Num(), 128, &PhysicsSystemDetail::PGSTask, i);
+        WorldTaskQueue::Schedule(world, &PhysicsSystemDetail::SolveContactsTask, i);
     }
 
+    // Keep the solved contacts to warm-start the next step. Runs before integrating so the cached offsets match
+    // the positions the contacts were calculated from.
+    WorldTaskQueue::Schedule(world, &PhysicsSystemDetail::UpdateContactCacheTask);
+
     // Integrate velocities
     PhysicsSystemDetail::IntegrateJob job;
     job.DeltaTime = dt;
     FeatureECS::ScheduleParallel(world, job);
 
-    // Multi-pass overlap separation
-    WorldTaskQueue::ScheduleParallelRange(world, scratchBlock.SortedEntities.Num(), 128, &PhysicsSystemDetail::OverlapSeparationTask);
-    WorldTaskQueue::ScheduleParallelRange(world, scratchBlock.Contacts.Num(), 128, &PhysicsSystemDetail::OverlapSeparationTask2);
+    // Separate bodies from collision lines
+    WorldTaskQueue::ScheduleParallelRangeDeferred(world, &PhysicsSystemDetail::GetNumSortedEntities, 128, &PhysicsSystemDetail::OverlapSeparationTask);
+
+    // Put resting islands to sleep and wake the ones that were touched
+    WorldTaskQueue::Schedule(world, &PhysicsSystemDetail::UpdateIslandsTask);
 }
 
 void PhysicsSystem::OnDebugRender(WorldConstRef world, const IDebugState& state, IDebugRenderer& renderer)
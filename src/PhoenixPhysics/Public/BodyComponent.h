@@ -51,6 +51,9 @@ namespace Phoenix
             InvValue InvMass;
 
             uint8 SleepTimer = 0;
+
+            // The sleeping island the body is in, None while the body is awake. Set by the physics system.
+            uint32 SleepIsland = Index<uint32>::None;
         };
         
     }
@@ -4,6 +4,7 @@
 #include "PhysicsSystem.h"
 #include "System.h"
 #include "Containers/FixedArray.h"
+#include "Containers/FixedMap.h"
 #include "Containers/FixedSet.h"
 #include "FixedPoint/FixedPoint.h"
 #include "FixedPoint/FixedVector.h"
@@ -17,6 +18,25 @@
 #define PHX_PHS_MAX_CONTACTS (PHX_ECS_MAX_ENTITIES * PHX_PHS_MAX_CONTACTS_PER_ENTITY)
 #endif
 
+// The number of colors contacts are split into so they can be solved in parallel. At most 64.
+#ifndef PHX_PHS_MAX_CONTACT_COLORS
+#define PHX_PHS_MAX_CONTACT_COLORS 32
+#endif
+
+#ifndef PHX_PHS_MAX_COLLISION_LINES
+#define PHX_PHS_MAX_COLLISION_LINES 1000
+#endif
+
+// The number of morton cells the collision lines can be bucketed into.
+#ifndef PHX_PHS_MAX_COLLISION_LINE_CELLS
+#define PHX_PHS_MAX_COLLISION_LINE_CELLS 65536
+#endif
+
+// Must be a power of 2. Contacts beyond half of the capacity aren't cached and start cold.
+#ifndef PHX_PHS_CONTACT_CACHE_CAPACITY
+#define PHX_PHS_CONTACT_CACHE_CAPACITY 65536
+#endif
+
 namespace Phoenix
 {
     namespace Physics
@@ -28,6 +48,13 @@ namespace Phoenix
             Line2 Line;
         };
 
+        // A morton cell that a collision line passes through.
+        struct CollisionLineCell
+        {
+            uint64 ZCode;
+            uint32 Line;
+        };
+
         struct EntityBody
         {
             ECS::EntityId EntityId;
@@ -36,6 +63,25 @@ namespace Phoenix
             uint64 ZCode;
         };
 
+        // A body of a sleeping island. Sleeping bodies don't move so they are kept sorted by their zcodes across
+        // steps instead of being sorted with the awake bodies every step. Island is None for bodies that have
+        // woken up but haven't been compacted away yet.
+        struct SleepingBody
+        {
+            ECS::EntityId EntityId;
+            uint32 Island;
+            uint64 ZCode;
+        };
+
+        // The members of a sleeping island are stored next to each other in FeaturePhysicsDynamicBlock::IslandMembers
+        // so waking the island only visits its own bodies. Free slots have no members.
+        struct SleepingIsland
+        {
+            uint32 FirstMember = 0;
+            uint32 NumMembers = 0;
+        };
+
+        // BodyA is always the body of the entity with the lower id.
         struct ContactPair
         {
             uint64 Key;
@@ -52,6 +98,20 @@ namespace Phoenix
             Value EffMass;
             Value Bias;
             Value Impulse;
+            uint8 Color = 0;
+        };
+
+        // The state of a contact from the previous step. Used to warm-start the solver with the impulse that was
+        // accumulated for the contact and to skip recalculating contacts whose bodies haven't moved relative to
+        // each other.
+        struct CachedContact
+        {
+            Vec2 Offset;
+            Distance RR;
+            Vec2 Normal;
+            Value Bias;
+            Value Impulse;
+            uint32 Step = 0;
         };
 
         struct ContactPairHasher
@@ -74,12 +134,34 @@ namespace Phoenix
             PHX_DECLARE_BLOCK_SCRATCH(FeaturePhysicsDynamicBlock)
 
             bool bAllowSleep = true;
+
+            // The contacts of the previous step keyed by ContactPair::Key.
+            TFixedMap<uint64, CachedContact, PHX_PHS_CONTACT_CACHE_CAPACITY, ContactPairHasher> ContactCache;
+
+            // The keys of ContactCache so contacts that ended can be evicted without visiting every slot of the map.
+            TFixedArray<uint64, PHX_PHS_CONTACT_CACHE_CAPACITY> ContactCacheKeys;
+
+            uint32 ContactCacheStep = 0;
+
+            // The bodies of all sleeping islands sorted by zcode. Woken bodies are left behind as tombstones and
+            // compacted away once there are as many tombstones as sleeping bodies.
+            TFixedArray<SleepingBody, PHX_ECS_MAX_ENTITIES> SleepingBodies;
+            uint32 NumSleepingTombstones = 0;
+
+            // The sleeping islands indexed by BodyComponent::SleepIsland. Slots of woken islands are reused.
+            TFixedArray<SleepingIsland, PHX_ECS_MAX_ENTITIES> SleepingIslands;
+            TFixedArray<uint32, PHX_ECS_MAX_ENTITIES> FreeSleepingIslands;
+
+            // The bodies of each sleeping island. The ranges of woken islands are compacted away like the tombstones.
+            TFixedArray<SleepingBody, PHX_ECS_MAX_ENTITIES> IslandMembers;
+            uint32 NumDeadIslandMembers = 0;
         };
 
         struct PHOENIXSIM_API FeaturePhysicsScratchBlock : BufferBlockBase
         {
             PHX_DECLARE_BLOCK_SCRATCH(FeaturePhysicsScratchBlock)
 
+            // The awake bodies sorted by zcode. Bodies of sleeping islands are in FeaturePhysicsDynamicBlock::SleepingBodies.
             TFixedArray<EntityBody, PHX_ECS_MAX_ENTITIES> SortedEntities;
             TAtomic<uint32> SortedEntityCount = 0;
 
@@ -87,7 +169,43 @@ namespace Phoenix
             TAtomic<uint32> ContactPairsCount = 0;
 
             TFixedArray<Contact, PHX_PHS_MAX_CONTACTS> Contacts;
-            TFixedArray<CollisionLine, 1000> CollisionLines;
+
+            // Contacts are sorted by color and contacts of the same color never share a body. The contacts of color
+            // PHX_PHS_MAX_CONTACT_COLORS are the ones that ran out of colors, those are solved serially.
+            uint32 ContactColorOffsets[PHX_PHS_MAX_CONTACT_COLORS + 2] = {};
+
+            // The colors taken by the contacts of each body while coloring, indexed by entity index.
+            uint64 BodyContactColors[1u << ECS::EntityId::IndexBits] = {};
+
+            TFixedArray<CollisionLine, PHX_PHS_MAX_COLLISION_LINES> CollisionLines;
+
+            // The cells the collision lines pass through sorted by zcode so bodies only test the lines near them.
+            // Rebuilt at the start of the step when the lines have changed.
+            TFixedArray<CollisionLineCell, PHX_PHS_MAX_COLLISION_LINE_CELLS> CollisionLineCells;
+            bool bCollisionLinesDirty = false;
+
+            // Set when the lines didn't fit into the cells, bodies test every line then.
+            bool bCollisionLineCellsOverflow = false;
+
+            // The bodies that were awake this step, grouped into islands by their contacts at the end of the step.
+            TFixedArray<EntityBody, PHX_ECS_MAX_ENTITIES> IslandBodies;
+
+            // Union-find parents of the island bodies plus one, indexed by entity index. Zero for bodies that aren't
+            // in IslandBodies. Cleared after the islands are built.
+            uint32 IslandParents[1u << ECS::EntityId::IndexBits] = {};
+
+            // Whether any body of the island rooted at the entity index is still moving.
+            bool IslandRestless[1u << ECS::EntityId::IndexBits] = {};
+
+            // The sleeping island each island root falls asleep as plus one, zero for roots that stay awake.
+            uint32 RootSleepingIslands[1u << ECS::EntityId::IndexBits] = {};
+
+            // The sleeping islands that were woken this step, WokenIslands is indexed by sleeping island.
+            TFixedArray<uint32, PHX_ECS_MAX_ENTITIES> WokenIslandList;
+            bool WokenIslands[PHX_ECS_MAX_ENTITIES] = {};
+
+            // The sleeping islands that fell asleep this step.
+            TFixedArray<uint32, PHX_ECS_MAX_ENTITIES> NewSleepingIslands;
         };
 
         class PHOENIXSIM_API FeaturePhysics : public IFeature
@@ -118,6 +236,14 @@ namespace Phoenix
 
             static void AddForce(WorldRef& world, ECS::EntityId entityId, const Vec2& force);
 
+            // Adds a static line that bodies are separated from. Returns false if there is no room for it.
+            static bool AddCollisionLine(WorldRef& world, const Line2& line);
+
+            static void ClearCollisionLines(WorldRef& world);
+
+            // Wakes the body. The rest of its island wakes at the end of the next step.
+            static void WakeBody(BodyComponent& bodyComp);
+
             bool GetDebugDrawContacts() const;
             void SetDebugDrawContacts(const bool& value);
 
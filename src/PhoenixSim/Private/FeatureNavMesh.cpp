@@ -11,6 +11,23 @@
 using namespace Phoenix;
 using namespace Phoenix::Pathfinding;
 
+namespace FeatureNavMeshDetail
+{
+    // Finds the path of a find_path_async action over several steps. The search state lives with the task since
+    // the world buffer can move between steps, the path is copied into the scratch block once it has been found.
+    SimTask FindPathActionAsync(WorldRef world, NavMesh::TVec start, NavMesh::TVec goal, NavMesh::TVecComp radius)
+    {
+        TUniquePtr<TMeshPath<NavMesh>> meshPath = MakeUnique<TMeshPath<NavMesh>>();
+
+        co_await FeatureNavMesh::FindPathAsync(world, *meshPath, start, goal, radius);
+
+        if (meshPath->LastStepResult == TMeshPath<NavMesh>::EStepResult::FoundPath)
+        {
+            world.GetBlockRef<FeatureNavMeshScratchBlock>().MeshPath = *meshPath;
+        }
+    }
+}
+
 FeatureNavMesh::FeatureNavMesh()
 {
 }
@@ -24,6 +41,8 @@ void FeatureNavMesh::RebuildNavMesh(WorldRef world)
     auto tl = Vec2(0, block.MapSize.Y);
     auto tr = Vec2(block.MapSize.X, block.MapSize.Y);
 
+    ++block.Version;
+
     block.DynamicNavMesh.Reset();
     block.DynamicNavMesh.InsertFace(bl, tr, tl, 1);
     block.DynamicNavMesh.InsertFace(bl, br, tr, 2);
@@ -113,6 +132,19 @@ bool FeatureNavMesh::OnHandleWorldAction(WorldRef world, const FeatureActionArgs
         return true;
     }
 
+    if (action.Action.Verb == "find_path_async"_n)
+    {
+        auto pt0x = action.Action.Data[0].Distance;
+        auto pt0y = action.Action.Data[1].Distance;
+        auto pt1x = action.Action.Data[2].Distance;
+        auto pt1y = action.Action.Data[3].Distance;
+        auto r = action.Action.Data[4].Distance;
+        SimTask task = FeatureNavMeshDetail::FindPathActionAsync(world, { pt0x, pt0y }, { pt1x, pt1y }, r);
+        world.GetSimTasks()->Start(std::move(task), ESimTaskPriority::Background);
+
+        return true;
+    }
+
     if (action.Action.Verb == "delete_edges_and_points"_n)
     {
         Vec2 pos = {action.Action.Data[0].Distance, action.Action.Data[1].Distance};
@@ -286,12 +318,14 @@ void FeatureNavMesh::OnDebugRender(WorldConstRef world, const IDebugState& state
 NavMesh::TIndex FeatureNavMesh::InsertPoint(WorldRef world, const NavMesh::TVec& pt)
 {
     FeatureNavMeshDynamicBlock& block = world.GetBlockRef<FeatureNavMeshDynamicBlock>();
+    ++block.Version;
     return block.DynamicNavMesh.CDT_InsertPoint(pt);
 }
 
 bool FeatureNavMesh::InsertEdge(WorldRef world, const NavMesh::TVec& start, const NavMesh::TVec& end)
 {
     FeatureNavMeshDynamicBlock& block = world.GetBlockRef<FeatureNavMeshDynamicBlock>();
+    ++block.Version;
     return block.DynamicNavMesh.CDT_InsertEdge({ start, end });
 }
 
@@ -309,6 +343,49 @@ PathResult FeatureNavMesh::PathTo(
     return { scratchBlock.MeshPath.LastStepResult == TMeshPath<>::EStepResult::FoundPath, scratchBlock.MeshPath.Path[1] };
 }
 
+SimTask FeatureNavMesh::FindPathAsync(
+    WorldRef world,
+    TMeshPath<NavMesh>& meshPath,
+    NavMesh::TVec start,
+    NavMesh::TVec goal,
+    NavMesh::TVecComp radius)
+{
+    for (;;)
+    {
+        // The block is looked up again after every suspension in case the world buffer moved
+        const FeatureNavMeshDynamicBlock* dynamicBlock = world.GetBlock<FeatureNavMeshDynamicBlock>();
+        uint32 version = dynamicBlock->Version;
+
+        if (!meshPath.FindPath(dynamicBlock->DynamicNavMesh, start, goal, radius, true))
+        {
+            co_return;
+        }
+
+        while (meshPath.Step(dynamicBlock->DynamicNavMesh) == TMeshPath<NavMesh>::EStepResult::Continue)
+        {
+            co_await Spend(1);
+
+            dynamicBlock = world.GetBlock<FeatureNavMeshDynamicBlock>();
+            if (dynamicBlock->Version != version)
+            {
+                break;
+            }
+        }
+
+        if (dynamicBlock->Version != version)
+        {
+            continue;
+        }
+
+        if (meshPath.LastStepResult == TMeshPath<NavMesh>::EStepResult::FoundPath)
+        {
+            meshPath.ResolvePath(dynamicBlock->DynamicNavMesh, false);
+        }
+
+        co_return;
+    }
+}
+
 PathResult FeatureNavMesh::CanPathTo(
     WorldConstRef world,
     const NavMesh::TVec& start,
@@ -0,0 +1,214 @@
+
+#include "SimTask.h"
+
+#include <algorithm>
+
+#include "Parallel.h"
+#include "Profiling.h"
+
+using namespace Phoenix;
+
+SimTask SimTask::promise_type::get_return_object()
+{
+    return SimTask(THandle::from_promise(*this));
+}
+
+SimTask::SimTask(THandle handle)
+    : Handle(handle)
+{
+}
+
+SimTask::SimTask(SimTask&& other) noexcept
+    : Handle(other.Handle)
+{
+    other.Handle = nullptr;
+}
+
+SimTask::~SimTask()
+{
+    if (Handle)
+    {
+        Handle.destroy();
+    }
+}
+
+SimTask& SimTask::operator=(SimTask&& other) noexcept
+{
+    if (this != &other)
+    {
+        if (Handle)
+        {
+            Handle.destroy();
+        }
+        Handle = other.Handle;
+        other.Handle = nullptr;
+    }
+    return *this;
+}
+
+bool SimTask::IsValid() const
+{
+    return Handle != nullptr;
+}
+
+bool SimTask::IsDone() const
+{
+    return !Handle || Handle.done();
+}
+
+SimTaskScheduler::SimTaskScheduler(TaskQueue* taskQueue, uint32 backgroundBudget)
+    : Queue(taskQueue)
+    , BackgroundBudget(backgroundBudget)
+    , RemainingBudget(backgroundBudget)
+{
+}
+
+SimTaskScheduler::~SimTaskScheduler()
+{
+    Clear();
+}
+
+void SimTaskScheduler::Start(SimTask&& task, ESimTaskPriority priority)
+{
+    if (task.IsDone())
+    {
+        return;
+    }
+
+    TUniquePtr<SimTaskEntry> entry = MakeUnique<SimTaskEntry>();
+    entry->Scheduler = this;
+    entry->Task = std::move(task);
+    entry->Priority = priority;
+    entry->Resume = entry->Task.Handle;
+    entry->Task.Handle.promise().Entry = entry.get();
+
+    SimTaskEntry& entryRef = *entry;
+    Entries.push_back(std::move(entry));
+
+    Resume(entryRef);
+
+    // Tasks started by other tasks are cleaned up once the scheduler is done resuming
+    if (!bIsResuming)
+    {
+        RemoveFinishedTasks();
+    }
+}
+
+void SimTaskScheduler::BeginStep()
+{
+    PHX_PROFILE_ZONE_SCOPED;
+
+    RemainingBudget = BackgroundBudget;
+
+    // Tasks started while resuming wait for the next step at the earliest
+    size_t numEntries = Entries.size();
+    for (size_t i = 0; i < numEntries; ++i)
+    {
+        SimTaskEntry& entry = *Entries[i];
+        if (entry.Wait == ESimTaskWait::NextStep)
+        {
+            Resume(entry);
+        }
+    }
+
+    RemoveFinishedTasks();
+}
+
+void SimTaskScheduler::EndStep()
+{
+    bool anyWaitingForJobs = std::ranges::any_of(Entries, [](const TUniquePtr<SimTaskEntry>& entry)
+    {
+        return entry->Wait == ESimTaskWait::Jobs;
+    });
+
+    if (!anyWaitingForJobs)
+    {
+        return;
+    }
+
+    PHX_PROFILE_ZONE_SCOPED;
+
+    Queue->Flush();
+
+    // Tasks that schedule and wait for more jobs while resuming are resumed again next step
+    size_t numEntries = Entries.size();
+    for (size_t i = 0; i < numEntries; ++i)
+    {
+        SimTaskEntry& entry = *Entries[i];
+        if (entry.Wait == ESimTaskWait::Jobs)
+        {
+            Resume(entry);
+        }
+    }
+
+    RemoveFinishedTasks();
+}
+
+uint32 SimTaskScheduler::GetNumTasks() const
+{
+    return (uint32)Entries.size();
+}
+
+void SimTaskScheduler::Clear()
+{
+    Entries.clear();
+}
+
+bool SimTaskScheduler::TrySpend(uint32 units)
+{
+    if (RemainingBudget < units)
+    {
+        RemainingBudget = 0;
+        return false;
+    }
+
+    RemainingBudget -= units;
+    return true;
+}
+
+void SimTaskScheduler::Resume(SimTaskEntry& entry)
+{
+    bool wasResuming = bIsResuming;
+    bIsResuming = true;
+
+    entry.Wait = ESimTaskWait::None;
+    entry.Resume.resume();
+
+    bIsResuming = wasResuming;
+}
+
+void SimTaskScheduler::RemoveFinishedTasks()
+{
+    std::erase_if(Entries, [](const TUniquePtr<SimTaskEntry>& entry) { return entry->Task.IsDone(); });
+}
+
+void SimTask::promise_type::GroupAwaiter::await_suspend(std::coroutine_handle<promise_type> handle) noexcept
+{
+    SimTaskEntry* entry = handle.promise().Entry;
+    PHX_ASSERT(entry);
+    entry->Wait = ESimTaskWait::Jobs;
+    entry->Resume = handle;
+}
+
+void SimTaskDetail::WaitAwaiter::await_suspend(SimTask::THandle handle) noexcept
+{
+    SimTaskEntry* entry = handle.promise().Entry;
+    PHX_ASSERT(entry);
+    entry->Wait = Wait;
+    entry->Resume = handle;
+}
+
+bool SimTaskDetail::SpendAwaiter::await_suspend(SimTask::THandle handle) noexcept
+{
+    SimTaskEntry* entry = handle.promise().Entry;
+    PHX_ASSERT(entry);
+
+    if (entry->Priority == ESimTaskPriority::Foreground || entry->Scheduler->TrySpend(Units))
+    {
+        return false;
+    }
+
+    entry->Wait = ESimTaskWait::NextStep;
+    entry->Resume = handle;
+    return true;
+}
@@ -6,6 +6,7 @@
 
 #include "Features.h"
 #include "Flags.h"
+#include "Parallel.h"
 #include "Profiling.h"
 
 
@@ -26,6 +27,8 @@ World::World(const World& other)
 World::World(World&& other) noexcept
     : Name(other.Name)
     , Buffer(std::move(other.Buffer))
+    , Tasks(std::move(other.Tasks))
+    , SimTasks(std::move(other.SimTasks))
 {
 }
 
@@ -34,6 +37,11 @@ FName World::GetName() const
     return Name;
 }
 
+uint32 World::GetNumaNode() const
+{
+    return Buffer.GetNumaNode();
+}
+
 bool World::IsInitialized() const
 {
     return HasAnyFlags(Flags, EWorldFlags::Initialized);
@@ -66,6 +74,18 @@ World& World::operator=(World&& other) noexcept
     return *this;
 }
 
+TaskQueue* World::GetTaskQueue() const
+{
+    PHX_ASSERT(Tasks);
+    return Tasks.get();
+}
+
+SimTaskScheduler* World::GetSimTasks() const
+{
+    PHX_ASSERT(SimTasks);
+    return SimTasks.get();
+}
+
 BlockBuffer& World::GetBuffer()
 {
     return Buffer;
@@ -88,6 +108,8 @@ const uint8_t* World::GetBlock(const FName& name) const
 
 WorldManager::WorldManager(const WorldManagerCtorArgs& args)
     : FeatureSet(args.FeatureSet)
+    , bDistributeWorldsAcrossNumaNodes(args.bDistributeWorldsAcrossNumaNodes)
+    , SimTaskBackgroundBudget(args.SimTaskBackgroundBudget)
     , OnPostWorldUpdate(args.OnPostWorldUpdate)
 {
     WorldBufferBlockArgs.RegisterBlock<WorldDynamicBlock>();
@@ -99,6 +121,8 @@ WorldManager::WorldManager(const WorldManagerCtorArgs& args)
         {
             WorldBufferBlockArgs.Definitions.push_back(blockArgs);
         }
+
+        bAllowParallelWorldUpdates &= worldFeatureDef.bAllowParallelWorldUpdates;
     }
 }
 
@@ -106,7 +130,7 @@ WorldManager::~WorldManager()
 {
 }
 
-WorldSharedPtr WorldManager::NewWorld(const FName& name)
+WorldSharedPtr WorldManager::NewWorld(const FName& name, uint32 numaNode)
 {
     WorldSharedPtr world = GetWorld(name);
     if (world)
@@ -119,6 +143,13 @@ WorldSharedPtr WorldManager::NewWorld(const FName& name)
     worldCtorArgs.Name = name;
     worldCtorArgs.Blocks = WorldBufferBlockArgs;
 
+    uint32 numNumaNodes = GetNumNumaThreadPools();
+    if (numaNode == AnyNumaNode && bDistributeWorldsAcrossNumaNodes && numNumaNodes > 1)
+    {
+        numaNode = NextNumaNode++ % numNumaNodes;
+    }
+    worldCtorArgs.Blocks.NumaNode = numaNode;
+
     world = std::make_shared<World>(worldCtorArgs);
     Worlds.push_back(world);
 
@@ -164,10 +195,16 @@ void WorldManager::Step(const WorldStepArgs& args)
         }
     }
 
-    // TODO (jfarris): parallelize
+    // Worlds are independent so they are updated in parallel, each running its own jobs on the same pool.
+    ForEachWorld(worlds, [&](WorldRef world)
+    {
+        UpdateWorld(world, args.SimTime, args.StepHz);
+    });
+
+    // Listeners are called after all worlds have finished and in a fixed order so they don't need to be thread-safe.
     for (const WorldSharedPtr& world : worlds)
     {
-        UpdateWorld(*world, args.SimTime, args.StepHz);
+        OnPostWorldUpdate(*world);
     }
 }
 
@@ -187,15 +224,21 @@ void WorldManager::SendAction(const WorldSendActionArgs& args)
         worlds = Worlds;
     }
 
-    // TODO (jfarris): parallelize
-    for (const WorldSharedPtr& world : worlds)
+    ForEachWorld(worlds, [&](WorldRef world)
     {
-        SendActionToWorld(*world, args.Action);
-    }
+        SendActionToWorld(world, args.Action);
+    });
 }
 
 void WorldManager::InitializeWorld(WorldRef world) const
 {
+    // Created here rather than with the world since the thread pools may be set up after worlds are created.
+    // Tasks run on the pool of the NUMA node the world buffer was allocated on, which is looked up again on every
+    // flush in case the pools are replaced while the world is alive.
+    world.Tasks = MakeShared<TaskQueue>((uint32)world.GetName());
+    world.Tasks->UseNumaThreadPool(world.GetNumaNode());
+    world.SimTasks = MakeShared<SimTaskScheduler>(world.Tasks.get(), SimTaskBackgroundBudget);
+
     TArray<FeatureSharedPtr> channelFeatures = FeatureSet->GetChannelRef(FeatureChannels::WorldInitialize);
     for (const FeatureSharedPtr& feature : channelFeatures)
     {
@@ -207,12 +250,17 @@ void WorldManager::InitializeWorld(WorldRef world) const
 
 void WorldManager::ShutdownWorld(WorldRef world) const
 {
+    // Sim tasks can refer to state owned by features so they go first
+    world.SimTasks = nullptr;
+
     TArray<FeatureSharedPtr> channelFeatures = FeatureSet->GetChannelRef(FeatureChannels::WorldShutdown);
     for (const FeatureSharedPtr& feature : channelFeatures)
     {
         feature->OnWorldShutdown(world);
     }
 
+    world.Tasks = nullptr;
+
     SetFlagRef(world.Flags, EWorldFlags::ShutDown, true);
 }
 
@@ -225,6 +273,9 @@ void WorldManager::UpdateWorld(WorldRef world, simtime_t time, clock_t stepHz) c
     FeatureUpdateArgs updateArgs;
     updateArgs.SimTime = time;
     updateArgs.StepHz = stepHz;
+
+    // Sim tasks waiting for the next step resume before any feature has updated
+    world.SimTasks->BeginStep();
     
     // Pre-update
     {
@@ -259,7 +310,7 @@ void WorldManager::UpdateWorld(WorldRef world, simtime_t time, clock_t stepHz) c
         }
     }
 
-    OnPostWorldUpdate(world);
+    world.SimTasks->EndStep();
 }
 
 void WorldManager::SendActionToWorld(WorldRef world, const Action& action) const
@@ -302,3 +353,42 @@ void WorldManager::SendActionToWorld(WorldRef world, const Action& action) const
         }
     }
 }
+
+void WorldManager::ForEachWorld(const TArray<WorldSharedPtr>& worlds, const TFunction<void(WorldRef)>& func) const
+{
+    PHX_PROFILE_ZONE_SCOPED;
+
+    ThreadPool* threadPool = GetThreadPool();
+    if (!threadPool || !bAllowParallelWorldUpdates || worlds.size() < 2)
+    {
+        for (const WorldSharedPtr& world : worlds)
+        {
+            func(*world);
+        }
+        return;
+    }
+
+    // Each world is updated on the pool of its NUMA node so it stays close to its buffer. Waiting only wakes up
+    // for tasks of the pool being waited on so there is a counter per pool.
+    TArray<TPair<ThreadPool*, TUniquePtr<TaskCounter>>> pools;
+
+    for (const WorldSharedPtr& world : worlds)
+    {
+        ThreadPool* worldPool = GetThreadPool(world->GetNumaNode());
+        auto iter = std::ranges::find_if(pools, [worldPool](const auto& pair) { return pair.first == worldPool; });
+        if (iter == pools.end())
+        {
+            pools.emplace_back(worldPool, MakeUnique<TaskCounter>());
+            iter = pools.end() - 1;
+        }
+
+        WorldPtr worldPtr = world.get();
+        iter->second->Add();
+        worldPool->Submit([&func, worldPtr] { func(*worldPtr); }, iter->second.get());
+    }
+
+    for (const auto& [pool, counter] : pools)
+    {
+        counter->Wait(pool);
+    }
+}
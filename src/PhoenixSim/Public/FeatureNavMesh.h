@@ -1,6 +1,7 @@
 ﻿#pragma once
 
 #include "Features.h"
+#include "SimTask.h"
 #include "Mesh/Mesh2.h"
 #include "Mesh/MeshPath.h"
 
@@ -30,6 +31,9 @@ namespace Phoenix
             TFixedArray<Line2, NavMesh::Capacity> DynamicEdges;
             TFixedArray<Vec2, NavMesh::Capacity> DynamicPoints;
             bool bDirty = true;
+
+            // Incremented every time the nav mesh is rebuilt or points or edges are inserted into it.
+            uint32 Version = 0;
         };
 
         struct PHOENIXSIM_API FeatureNavMeshScratchBlock : BufferBlockBase
@@ -81,6 +85,15 @@ namespace Phoenix
                 const NavMesh::TVec& goal,
                 NavMesh::TVecComp radius);
 
+            // Finds a path over as many steps as it takes, one search step per unit of sim task budget.
+            // The search starts over if the nav mesh is rebuilt in the meantime. The mesh path must outlive the task.
+            static SimTask FindPathAsync(
+                WorldRef world,
+                TMeshPath<NavMesh>& meshPath,
+                NavMesh::TVec start,
+                NavMesh::TVec goal,
+                NavMesh::TVecComp radius);
+
             // Returns whether an agent with a given radius can path from start to end.
             static PathResult CanPathTo(
                 WorldConstRef world,
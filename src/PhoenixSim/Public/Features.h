@@ -37,6 +37,7 @@ namespace Phoenix
 #define FEATURE_SESSION_BLOCK(block) definition.RegisterSessionBlock<block>();
 #define FEATURE_WORLD_BLOCK(block) definition.RegisterWorldBlock<block>();
 #define FEATURE_CHANNEL(...) definition.RegisterChannel(__VA_ARGS__);
+#define FEATURE_SERIAL_WORLD_UPDATES() definition.bAllowParallelWorldUpdates = false;
 
 namespace Phoenix
 {
@@ -196,6 +197,10 @@ namespace Phoenix
         TArray<FeatureChannelInsertArgs> Channels;
         TArray<FName> DependentFeatures;
 
+        // Worlds are only updated in parallel if every feature allows it. Features with state shared between
+        // worlds (e.g. a scripting VM) should disallow it.
+        bool bAllowParallelWorldUpdates = true;
+
         template <class TBlock>
         void RegisterSessionBlock()
         {
@@ -0,0 +1,258 @@
+
+#pragma once
+
+#include <coroutine>
+
+#include "DLLExport.h"
+#include "Parallel.h"
+#include "Platform.h"
+
+#ifndef PHX_SIM_TASK_BACKGROUND_BUDGET
+#define PHX_SIM_TASK_BACKGROUND_BUDGET 1024
+#endif
+
+namespace Phoenix
+{
+    class SimTaskScheduler;
+    struct SimTaskEntry;
+
+    enum class ESimTaskPriority : uint8
+    {
+        // Runs until it suspends itself, Spend never suspends it.
+        Foreground,
+
+        // Shares the background budget of the scheduler with the other background tasks.
+        Background
+    };
+
+    // A coroutine that runs as part of the world step. Sim tasks let work that doesn't fit into a single step be
+    // written as straight-line code instead of a hand-written state machine:
+    //
+    //     SimTask RebuildSomething(WorldRef world)
+    //     {
+    //         for (uint32 i = 0; i < numItems; ++i)
+    //         {
+    //             ProcessItem(world, i);
+    //             co_await Spend(1);
+    //         }
+    //     }
+    //
+    // Tasks only ever resume at fixed points of the step and the budget is counted in units of work rather than
+    // time, so how far a task gets in each step is deterministic. Sim tasks are not part of the world buffer and
+    // are not copied or rolled back with it.
+    class PHOENIXSIM_API SimTask
+    {
+    public:
+
+        struct PHOENIXSIM_API promise_type
+        {
+            SimTask get_return_object();
+
+            std::suspend_always initial_suspend() noexcept { return {}; }
+
+            auto final_suspend() noexcept
+            {
+                struct FinalAwaiter
+                {
+                    bool await_ready() noexcept { return false; }
+
+                    // Continue the task that awaited this one, if any
+                    std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept
+                    {
+                        std::coroutine_handle<> continuation = handle.promise().Continuation;
+                        return continuation ? continuation : std::noop_coroutine();
+                    }
+
+                    void await_resume() noexcept {}
+                };
+                return FinalAwaiter{};
+            }
+
+            void return_void() {}
+
+            // Suspends the task until a group scheduled on the task queue of the world has run:
+            //
+            //     co_await WorldTaskQueue::ScheduleWithAccess(world, access, func);
+            //
+            // Groups only run when the queue is flushed so the task resumes at the end of the step like it does
+            // for WaitForJobs.
+            struct PHOENIXSIM_API GroupAwaiter
+            {
+                bool await_ready() noexcept { return GroupId == Index<taskgroupid_t>::None; }
+                void await_suspend(std::coroutine_handle<promise_type> handle) noexcept;
+                void await_resume() noexcept {}
+
+                taskgroupid_t GroupId;
+            };
+
+            GroupAwaiter await_transform(taskgroupid_t groupId) noexcept
+            {
+                return { groupId };
+            }
+
+            template <class TAwaitable>
+            TAwaitable&& await_transform(TAwaitable&& awaitable) noexcept
+            {
+                return std::forward<TAwaitable>(awaitable);
+            }
+
+            void unhandled_exception()
+            {
+                PHX_ASSERT(!"Unhandled exception in sim task");
+                std::terminate();
+            }
+
+            // The scheduler entry of the outermost task. Shared by every task awaited from it.
+            SimTaskEntry* Entry = nullptr;
+
+            // The task that awaited this one.
+            std::coroutine_handle<> Continuation;
+        };
+
+        using THandle = std::coroutine_handle<promise_type>;
+
+        SimTask() = default;
+        SimTask(SimTask&& other) noexcept;
+        ~SimTask();
+
+        SimTask(const SimTask&) = delete;
+        SimTask& operator=(const SimTask&) = delete;
+
+        SimTask& operator=(SimTask&& other) noexcept;
+
+        bool IsValid() const;
+        bool IsDone() const;
+
+        // Awaiting a task from another task runs it as part of the awaiting task and resumes the awaiting task
+        // once it has finished.
+        auto operator co_await() && noexcept
+        {
+            struct Awaiter
+            {
+                bool await_ready() noexcept { return !Handle || Handle.done(); }
+
+                std::coroutine_handle<> await_suspend(THandle awaiting) noexcept
+                {
+                    Handle.promise().Entry = awaiting.promise().Entry;
+                    Handle.promise().Continuation = awaiting;
+                    return Handle;
+                }
+
+                void await_resume() noexcept {}
+
+                THandle Handle;
+            };
+            return Awaiter{ Handle };
+        }
+
+    private:
+
+        friend class SimTaskScheduler;
+
+        explicit SimTask(THandle handle);
+
+        THandle Handle;
+    };
+
+    // What a suspended sim task is waiting for.
+    enum class ESimTaskWait : uint8
+    {
+        None,
+        NextStep,
+        Jobs
+    };
+
+    struct PHOENIXSIM_API SimTaskEntry
+    {
+        SimTaskScheduler* Scheduler = nullptr;
+        SimTask Task;
+        ESimTaskPriority Priority = ESimTaskPriority::Foreground;
+        ESimTaskWait Wait = ESimTaskWait::None;
+
+        // The innermost task that is suspended.
+        std::coroutine_handle<> Resume;
+    };
+
+    // Runs the sim tasks of a world. Tasks resume at the start of the step when waiting for the next step and at
+    // the end of the step, after the task queue of the world has been flushed, when waiting for jobs.
+    // Everything runs on the thread stepping the world in the order the tasks were started in.
+    class PHOENIXSIM_API SimTaskScheduler
+    {
+    public:
+
+        SimTaskScheduler(TaskQueue* taskQueue, uint32 backgroundBudget = PHX_SIM_TASK_BACKGROUND_BUDGET);
+        ~SimTaskScheduler();
+
+        SimTaskScheduler(const SimTaskScheduler&) = delete;
+        SimTaskScheduler& operator=(const SimTaskScheduler&) = delete;
+
+        // Runs the task until it first suspends. Must be called from the thread stepping the world.
+        void Start(SimTask&& task, ESimTaskPriority priority = ESimTaskPriority::Foreground);
+
+        // Resumes the tasks waiting for the next step and resets the background budget.
+        void BeginStep();
+
+        // Flushes the task queue and resumes the tasks waiting for their jobs, if there are any.
+        void EndStep();
+
+        uint32 GetNumTasks() const;
+
+        // Destroys all tasks without resuming them.
+        void Clear();
+
+        // Takes units from the background budget of the current step. Returns false if there weren't enough left.
+        bool TrySpend(uint32 units);
+
+    private:
+
+        void Resume(SimTaskEntry& entry);
+
+        void RemoveFinishedTasks();
+
+        TaskQueue* Queue = nullptr;
+        TArray<TUniquePtr<SimTaskEntry>> Entries;
+        uint32 BackgroundBudget = 0;
+        uint32 RemainingBudget = 0;
+        bool bIsResuming = false;
+    };
+
+    namespace SimTaskDetail
+    {
+        struct PHOENIXSIM_API WaitAwaiter
+        {
+            bool await_ready() noexcept { return false; }
+            void await_suspend(SimTask::THandle handle) noexcept;
+            void await_resume() noexcept {}
+
+            ESimTaskWait Wait;
+        };
+
+        struct PHOENIXSIM_API SpendAwaiter
+        {
+            bool await_ready() noexcept { return false; }
+            bool await_suspend(SimTask::THandle handle) noexcept;
+            void await_resume() noexcept {}
+
+            uint32 Units;
+        };
+    }
+
+    // Suspends the task until the start of the next step.
+    inline SimTaskDetail::WaitAwaiter NextStep()
+    {
+        return { ESimTaskWait::NextStep };
+    }
+
+    // Suspends the task until the jobs scheduled on the task queue of the world have run, at the end of the step.
+    inline SimTaskDetail::WaitAwaiter WaitForJobs()
+    {
+        return { ESimTaskWait::Jobs };
+    }
+
+    // Accounts for units of work done by a background task. Suspends the task until the next step once the
+    // background budget of the step has been used up. Never suspends foreground tasks.
+    inline SimTaskDetail::SpendAwaiter Spend(uint32 units = 1)
+    {
+        return { units };
+    }
+}
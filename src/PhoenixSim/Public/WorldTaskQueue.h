@@ -1,6 +1,8 @@
 ﻿
 #pragma once
 
+#include <typeinfo>
+
 #include "Parallel.h"
 #include "Worlds.h"
 
@@ -9,17 +11,18 @@ namespace Phoenix
     struct WorldTaskQueue
     {
         using TWorldTaskFunc = std::function<void(WorldRef)>;
-        using TParallelRangeFunc = std::function<void(WorldRef, uint32, uint32)>;
+        using TParallelRangeFunc = TInlineFunction<void(WorldRef, uint32, uint32)>;
+        using TParallelRangeCountFunc = TInlineFunction<uint32(WorldRef)>;
 
         static void Schedule(WorldRef world, TTaskFunc&& func)
         {
-            TSharedPtr<TaskQueue> taskQueue = TaskQueue::GetTaskQueue((uint32)world.GetName());
+            TaskQueue* taskQueue = world.GetTaskQueue();
             taskQueue->Enqueue(std::move(func));
         }
 
         static void Schedule(WorldRef world, const Task& task)
         {
-            TSharedPtr<TaskQueue> taskQueue = TaskQueue::GetTaskQueue((uint32)world.GetName());
+            TaskQueue* taskQueue = world.GetTaskQueue();
             taskQueue->Enqueue(task);
         }
 
@@ -33,9 +36,12 @@ namespace Phoenix
         template <class _Fx, class ...TArgs>
         static void Schedule(WorldRef world, _Fx&& fx, TArgs&&... args)
         {
-            using namespace std::placeholders;
-            TWorldTaskFunc wrapper = std::bind(std::forward<_Fx>(fx), _1, std::forward<TArgs>(args)...);
-            Schedule(world, std::move(wrapper));
+            // Captured directly into the task so small tasks are stored inline instead of in a std::function
+            auto worldPtr = &world;
+            Schedule(world, TTaskFunc([worldPtr, fx = std::forward<_Fx>(fx), ...args = std::forward<TArgs>(args)]() mutable
+            {
+                std::invoke(fx, *worldPtr, args...);
+            }));
         }
 
         static void dfsdf(WorldRef, int)
@@ -55,7 +61,7 @@ namespace Phoenix
         template <class ...TArgs>
         static void Schedule(WorldRef world, const std::function<void(WorldRef, TArgs...)>& func, TArgs&& ...args)
         {
-            TSharedPtr<TaskQueue> taskQueue = TaskQueue::GetTaskQueue((uint32)world.GetName());
+            TaskQueue* taskQueue = world.GetTaskQueue();
             auto worldPtr = &world;
             taskQueue->Enqueue([=]
             {
@@ -63,43 +69,121 @@ namespace Phoenix
             });
         }
 
-        static void ScheduleParallelRange(WorldRef world, uint32 total, uint32 minRange, TParallelRangeFunc&& func)
+        template <class _Fx, class ...TArgs>
+        static void ScheduleParallelRange(WorldRef world, uint32 total, uint32 minRange, _Fx&& fx, TArgs&&... args)
+        {
+            ScheduleParallelRangeDeferred(world, [total](WorldRef) { return total; }, minRange, std::forward<_Fx>(fx), std::forward<TArgs>(args)...);
+        }
+
+        // Schedules a parallel range whose total is only calculated once the previously scheduled tasks have
+        // completed. Lets ranges depend on counts that earlier tasks produce without flushing the queue.
+        template <class _Fc, class _Fx, class ...TArgs>
+        static taskgroupid_t ScheduleParallelRangeDeferred(WorldRef world, _Fc&& getTotal, uint32 minRange, _Fx&& fx, TArgs&&... args)
+        {
+            auto worldPtr = &world;
+            TaskQueue* taskQueue = world.GetTaskQueue();
+            hash32_t costKey = GetRangeCostKey(fx);
+
+            // The callables are captured directly into the range group so small ones are stored inline.
+            taskgroupid_t groupId = taskQueue->AddRangeGroup(
+                MakeRangeCountFunc(worldPtr, std::forward<_Fc>(getTotal)),
+                minRange,
+                TRangeFunc([worldPtr, fx = std::forward<_Fx>(fx), ...args = std::forward<TArgs>(args)](uint32 start, uint32 len) mutable
+                {
+                    std::invoke(fx, *worldPtr, start, len, args...);
+                }));
+
+            taskQueue->TrackRangeCost(groupId, costKey);
+            return groupId;
+        }
+
+        // Schedules a task that only waits for the given groups instead of everything scheduled before it.
+        static taskgroupid_t ScheduleAfter(WorldRef world, std::initializer_list<taskgroupid_t> dependencies, TWorldTaskFunc&& func)
+        {
+            auto worldPtr = &world;
+            TaskQueue* taskQueue = world.GetTaskQueue();
+
+            taskgroupid_t groupId = taskQueue->AddEmptyGroup(dependencies);
+            taskQueue->GetGroupTasks(groupId).emplace_back([=] { func(*worldPtr); });
+            return groupId;
+        }
+
+        // Schedules a task that only waits for the previously scheduled tasks whose access conflicts with its own.
+        static taskgroupid_t ScheduleWithAccess(WorldRef world, const TaskAccess& access, TWorldTaskFunc&& func)
         {
             auto worldPtr = &world;
-            TSharedPtr<TaskQueue> taskQueue = TaskQueue::GetTaskQueue((uint32)world.GetName());
+            TaskQueue* taskQueue = world.GetTaskQueue();
 
-            std::vector<Task>& taskGroup = taskQueue->BeginGroup();
+            taskgroupid_t groupId = taskQueue->AddEmptyGroup(access);
+            taskQueue->GetGroupTasks(groupId).emplace_back([=] { func(*worldPtr); });
+            return groupId;
+        }
 
-            uint32 desiredRange = total / taskQueue->GetNumWorkers();
-            uint32 actualRange = desiredRange < minRange ? minRange : desiredRange;
-            uint32 start = 0;
-            while (start != total)
+        // Schedules a deferred parallel range that only waits for the given groups.
+        template <class _Fc, class _Fx>
+        static taskgroupid_t ScheduleParallelRangeAfter(
+            WorldRef world,
+            std::initializer_list<taskgroupid_t> dependencies,
+            _Fc&& getTotal,
+            uint32 minRange,
+            _Fx&& fx)
+        {
+            auto worldPtr = &world;
+            TaskQueue* taskQueue = world.GetTaskQueue();
+            hash32_t costKey = GetRangeCostKey(fx);
+
+            taskgroupid_t groupId = taskQueue->AddRangeGroup(
+                MakeRangeCountFunc(worldPtr, std::forward<_Fc>(getTotal)),
+                minRange,
+                TRangeFunc([worldPtr, fx = std::forward<_Fx>(fx)](uint32 start, uint32 len) mutable
+                {
+                    std::invoke(fx, *worldPtr, start, len);
+                }),
+                dependencies);
+
+            taskQueue->TrackRangeCost(groupId, costKey);
+            return groupId;
+        }
+
+        // Identifies the work done by a range across steps so the time it took can be used to size its chunks.
+        // Function pointers with the same signature share a type so the address is hashed as well.
+        template <class _Fx>
+        static hash32_t GetRangeCostKey(const _Fx& fx)
+        {
+            hash32_t costKey = (hash32_t)typeid(std::decay_t<_Fx>).hash_code();
+            if constexpr (std::is_pointer_v<std::decay_t<_Fx>>)
             {
-                uint32 len = actualRange;
-                len = len > (total - start) ? (total - start) : len;
-                taskGroup.emplace_back([=] { func(*worldPtr, start, len); });
-                start += len;
+                costKey = Hashing::FNV1A32(reinterpret_cast<uintptr_t>(fx), costKey);
             }
-
-            taskQueue->EndGroup();
+            return costKey;
         }
 
-        template <class _Fx, class ...TArgs>
-        static void ScheduleParallelRange(WorldRef world, uint32 total, uint32 minRange, _Fx&& fx, TArgs&&... args)
+        // Gets the most recently scheduled group so later tasks can depend on it.
+        static taskgroupid_t GetLastGroup(WorldRef world)
         {
-            using namespace std::placeholders;
-            TParallelRangeFunc wrapper = std::bind(std::forward<_Fx>(fx), _1, _2, _3, std::forward<TArgs>(args)...);
-            ScheduleParallelRange(world, total, minRange, std::move(wrapper));
+            TaskQueue* taskQueue = world.GetTaskQueue();
+            return taskQueue->GetLastGroup();
         }
-        
+
         static void Flush(WorldRef world)
         {
             PHX_PROFILE_ZONE_SCOPED;
 
-            TSharedPtr<TaskQueue> taskQueue = TaskQueue::GetTaskQueue((uint32)world.GetName());
+            TaskQueue* taskQueue = world.GetTaskQueue();
 
             // Submit any pending jobs and pause the thread until they finish.
             taskQueue->Flush();
         }
+
+    private:
+
+        template <class _Fc>
+        static TRangeCountFunc MakeRangeCountFunc(World* worldPtr, _Fc&& getTotal)
+        {
+            return TRangeCountFunc([worldPtr, getTotal = std::forward<_Fc>(getTotal)]() mutable -> uint32
+            {
+                return std::invoke(getTotal, *worldPtr);
+            });
+        }
     };
 }
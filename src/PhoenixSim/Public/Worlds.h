@@ -1,6 +1,7 @@
 ﻿#pragma once
 
 #include "Actions.h"
+#include "SimTask.h"
 #include "Containers/BlockBuffer.h"
 
 namespace Phoenix
@@ -17,6 +18,7 @@ namespace Phoenix
 {
     class FeatureSet;
     class FeatureSet;
+    class TaskQueue;
 }
 
 namespace Phoenix
@@ -45,6 +47,9 @@ namespace Phoenix
 
         FName GetName() const;
 
+        // Gets the NUMA node the world buffer was allocated on. Tasks of the world run on the pool of the node.
+        uint32 GetNumaNode() const;
+
         bool IsInitialized() const;
         bool IsShutDown() const;
         bool IsActive() const;
@@ -54,6 +59,12 @@ namespace Phoenix
         World& operator=(const World& other);
         World& operator=(World&& other) noexcept;
 
+        // Gets the queue that tasks of the world are scheduled on. Only valid while the world is initialized.
+        TaskQueue* GetTaskQueue() const;
+
+        // Gets the scheduler running the sim tasks of the world. Only valid while the world is initialized.
+        SimTaskScheduler* GetSimTasks() const;
+
         BlockBuffer& GetBuffer();
         const BlockBuffer& GetBuffer() const;
 
@@ -103,6 +114,12 @@ namespace Phoenix
         FName Name;
         BlockBuffer Buffer;
         EWorldFlags Flags = EWorldFlags::None;
+
+        // Owned by the world instead of being looked up by name so scheduling a task doesn't take a lock.
+        // Copies of a world get their own queue when they are initialized.
+        TSharedPtr<TaskQueue> Tasks;
+
+        TSharedPtr<SimTaskScheduler> SimTasks;
     };
 
     typedef World* WorldPtr;
@@ -119,6 +136,12 @@ namespace Phoenix
     {
         TSharedPtr<FeatureSet> FeatureSet;
         PostWorldUpdateDelegate OnPostWorldUpdate;
+
+        // Spreads new worlds round-robin across the NUMA nodes that have their own thread pool.
+        bool bDistributeWorldsAcrossNumaNodes = true;
+
+        // The units of work that background sim tasks of a world can spend per step.
+        uint32 SimTaskBackgroundBudget = PHX_SIM_TASK_BACKGROUND_BUDGET;
     };
 
     struct PHOENIXSIM_API WorldStepArgs
@@ -146,7 +169,9 @@ namespace Phoenix
         WorldManager(const WorldManagerCtorArgs& args);
         ~WorldManager();
 
-        WorldSharedPtr NewWorld(const FName& name);
+        // Creates a new world bound to a NUMA node. Worlds created with AnyNumaNode are assigned a node if worlds
+        // are distributed across nodes.
+        WorldSharedPtr NewWorld(const FName& name, uint32 numaNode = AnyNumaNode);
         WorldSharedPtr GetWorld(const FName& name) const;
 
         WorldSharedPtr GetPrimaryWorld() const;
@@ -162,9 +187,17 @@ namespace Phoenix
         void UpdateWorld(WorldRef world, simtime_t time, clock_t stepHz) const;
         void SendActionToWorld(WorldRef world, const Action& action) const;
 
+        // Calls func(world) for each world, on the thread pool if more than one world is given and every feature
+        // allows it. Returns once all of the calls have finished.
+        void ForEachWorld(const TArray<WorldSharedPtr>& worlds, const TFunction<void(WorldRef)>& func) const;
+
         TSharedPtr<FeatureSet> FeatureSet;
         TArray<WorldSharedPtr> Worlds;
         BlockBuffer::CtorArgs WorldBufferBlockArgs;
+        bool bAllowParallelWorldUpdates = true;
+        bool bDistributeWorldsAcrossNumaNodes = true;
+        uint32 NextNumaNode = 0;
+        uint32 SimTaskBackgroundBudget = 0;
 
         PostWorldUpdateDelegate OnPostWorldUpdate;
     };